@@ -0,0 +1,189 @@
+#include "AssetPack.hpp"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const char AssetPack::MAGIC[8] = { 'W', 'S', 'P', 'A', 'C', 'K', '\0', '\0' };
+
+/*
+ * AssetPack maps the pack read-only, so worker processes share its pages through the page cache,
+ * and finds a file with one hash probe instead of open() and fstat().
+ * The index is read through the mapping, file contents are sent from the pack's descriptor.
+ * Deploying is an atomic rename() of a new pack over the old one: reloadIfChanged() notices
+ * the new inode within a second and maps it, responses still sending from the old pack
+ * keep its descriptor open until they are done.
+ * */
+AssetPack::AssetPack()
+  : _file(NULL), _map(NULL), _mapLength(0), _header(NULL), _slots(NULL), _inode(0), _mtime(0), _lastCheck(0)
+{
+}
+
+AssetPack::~AssetPack()
+{
+  unload();
+}
+
+/*
+ * FNV-1a, also used by the pack builder to place the entries.
+ * 0 marks empty slots, so it is never returned.
+ * */
+uint64_t AssetPack::hashPath(const char *path, size_t length)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= static_cast<unsigned char>(path[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash == 0 ? 1 : hash;
+}
+
+bool AssetPack::load(const std::string& path)
+{
+  _path = path;
+  _lastCheck = time(NULL);
+
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    std::cerr << "Warning: Failed to open asset pack " << path << ". " << strerror(errno) << "\n";
+    return false;
+  }
+  struct stat packStat;
+  if (fstat(fd, &packStat) != 0 || packStat.st_size < static_cast<off_t>(sizeof(Header))) {
+    std::cerr << "Warning: Asset pack " << path << " is not valid.\n";
+    close(fd);
+    return false;
+  }
+  void *map = mmap(NULL, packStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    std::cerr << "Warning: Failed to map asset pack " << path << ". " << strerror(errno) << "\n";
+    close(fd);
+    return false;
+  }
+  if (!validate(static_cast<const char*>(map), packStat.st_size)) {
+    std::cerr << "Warning: Asset pack " << path << " is not valid.\n";
+    munmap(map, packStat.st_size);
+    close(fd);
+    return false;
+  }
+
+  unload();
+  _file = new SharedFile(fd);
+  _map = static_cast<const char*>(map);
+  _mapLength = packStat.st_size;
+  _header = reinterpret_cast<const Header*>(_map);
+  _slots = reinterpret_cast<const Entry*>(_map + sizeof(Header));
+  _inode = packStat.st_ino;
+  _mtime = packStat.st_mtime;
+  std::cout << "Asset pack loaded: " << path << " (" << _header->entryCount << " files)\n";
+  return true;
+}
+
+/*
+ * Checks the header and that every entry points inside the pack,
+ * so a corrupt pack can't make lookups read outside the mapping.
+ * */
+bool AssetPack::validate(const char *map, size_t length) const
+{
+  const Header *header = reinterpret_cast<const Header*>(map);
+  if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION
+      || header->packSize != length || header->slotCount == 0
+      || (header->slotCount & (header->slotCount - 1)) != 0
+      || header->slotCount > (length - sizeof(Header)) / sizeof(Entry)) {
+    return false;
+  }
+
+  const Entry *slots = reinterpret_cast<const Entry*>(map + sizeof(Header));
+  for (uint32_t i = 0; i < header->slotCount; ++i) {
+    const Entry& entry = slots[i];
+    if (entry.hash == 0) {
+      continue;
+    }
+    if (entry.offset > length || entry.length > length - entry.offset
+        || entry.gzipOffset > length || entry.gzipLength > length - entry.gzipOffset
+        || entry.pathOffset > length || entry.pathLength > length - entry.pathOffset
+        || entry.mimeOffset > length || entry.mimeLength > length - entry.mimeOffset
+        || entry.etagOffset > length || entry.etagLength > length - entry.etagOffset) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Maps the pack again if it was replaced on disk. Checks at most once per second.
+ * */
+void AssetPack::reloadIfChanged()
+{
+  if (_path.empty()) {
+    return;
+  }
+  time_t now = time(NULL);
+  if (now == _lastCheck) {
+    return;
+  }
+  _lastCheck = now;
+
+  struct stat packStat;
+  if (stat(_path.c_str(), &packStat) != 0) {
+    return; // Keep serving the pack that is mapped
+  }
+  if (packStat.st_ino != _inode || packStat.st_mtime != _mtime) {
+    load(_path);
+  }
+}
+
+void AssetPack::unload()
+{
+  if (_map != NULL) {
+    munmap(const_cast<char*>(_map), _mapLength);
+    _map = NULL;
+  }
+  if (_file != NULL) {
+    _file->release();
+    _file = NULL;
+  }
+  _header = NULL;
+  _slots = NULL;
+  _mapLength = 0;
+}
+
+bool AssetPack::loaded() const
+{
+  return _map != NULL;
+}
+
+/*
+ * Returns the entry for a URL path such as "/index.html", NULL if it is not in the pack.
+ * */
+const AssetPack::Entry *AssetPack::find(const StringView& path) const
+{
+  if (_map == NULL) {
+    return NULL;
+  }
+  uint64_t hash = hashPath(path.data, path.length);
+  uint32_t mask = _header->slotCount - 1;
+  for (uint32_t probe = 0; probe <= mask; ++probe) {
+    const Entry& entry = _slots[(hash + probe) & mask];
+    if (entry.hash == 0) {
+      return NULL;
+    }
+    if (entry.hash == hash && string(entry.pathOffset, entry.pathLength) == path) {
+      return &entry;
+    }
+  }
+  return NULL;
+}
+
+StringView AssetPack::string(uint32_t offset, uint32_t length) const
+{
+  return StringView(_map + offset, length);
+}
+
+SharedFile *AssetPack::file() const
+{
+  return _file;
+}
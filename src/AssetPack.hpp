@@ -0,0 +1,76 @@
+#ifndef ASSETPACK_HPP
+#define ASSETPACK_HPP
+
+#include <string>
+#include <ctime>
+#include <stdint.h>
+#include <sys/types.h>
+#include "SharedFile.hpp"
+#include "StringView.hpp"
+
+/*
+ * Read-only pack of the document root built by tools/pack_assets.
+ * Layout: Header, slotCount Entry slots (an open-addressing hash table on the path),
+ * the strings the entries refer to, then the file contents.
+ * Integers are stored in host byte order, a pack is built on the machine that serves it.
+ */
+class AssetPack {
+public:
+  static const char MAGIC[8];
+  static const uint32_t VERSION = 1;
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t slotCount;   // Power of two
+    uint32_t reserved;
+    uint64_t packSize;    // Size of the whole file, to detect truncated packs
+  };
+
+  struct Entry {
+    uint64_t hash;        // hashPath() of the path, 0 for an empty slot
+    uint64_t offset;      // Contents
+    uint64_t length;
+    uint64_t gzipOffset;  // Precompressed variant from a .gz sidecar, gzipLength is 0 if there is none
+    uint64_t gzipLength;
+    int64_t mtime;
+    uint32_t pathOffset;  // Strings, as offsets from the start of the pack
+    uint32_t pathLength;
+    uint32_t mimeOffset;
+    uint32_t mimeLength;
+    uint32_t etagOffset;
+    uint32_t etagLength;
+  };
+
+  AssetPack();
+  ~AssetPack();
+
+  static uint64_t hashPath(const char *path, size_t length);
+
+  bool load(const std::string& path);
+  void reloadIfChanged();
+  bool loaded() const;
+  const Entry *find(const StringView& path) const;
+  StringView string(uint32_t offset, uint32_t length) const;
+  SharedFile *file() const;
+
+private:
+  std::string _path;
+  SharedFile *_file;     // Contents are sent from here with sendfile(), in-flight responses keep it open
+  const char *_map;
+  size_t _mapLength;
+  const Header *_header;
+  const Entry *_slots;
+  ino_t _inode;
+  time_t _mtime;
+  time_t _lastCheck;
+
+  AssetPack(const AssetPack&);
+  AssetPack& operator=(const AssetPack&);
+
+  bool validate(const char *map, size_t length) const;
+  void unload();
+};
+
+#endif // ASSETPACK_HPP
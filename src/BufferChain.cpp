@@ -0,0 +1,277 @@
+#include "BufferChain.hpp"
+
+BufferPool::BufferPool(size_t maxFreeBlocks) : _maxFreeBlocks(maxFreeBlocks)
+{
+}
+
+BufferPool::~BufferPool()
+{
+  for (size_t i = 0; i < _freeBlocks.size(); ++i) {
+    delete[] _freeBlocks[i];
+  }
+}
+
+char *BufferPool::acquire()
+{
+  if (_freeBlocks.empty()) {
+    return new char[BLOCK_SIZE];
+  }
+  char *block = _freeBlocks.back();
+  _freeBlocks.pop_back();
+  return block;
+}
+
+/*
+ * Keeps the block for reuse unless the pool already holds enough idle blocks.
+ * */
+void BufferPool::release(char *block)
+{
+  if (_freeBlocks.size() >= _maxFreeBlocks) {
+    delete[] block;
+    return;
+  }
+  _freeBlocks.push_back(block);
+}
+
+/*
+ * BufferChain reads a socket until EAGAIN, as edge-triggered epoll requires.
+ * Each readv() fills the free space of the last block and spills into a fresh pooled block,
+ * so large request bodies are received with a single copy out of the kernel.
+ * */
+BufferChain::BufferChain(BufferPool *pool) : _pool(pool), _size(0)
+{
+}
+
+BufferChain::~BufferChain()
+{
+  clear();
+}
+
+char *BufferChain::acquireBlock()
+{
+  return _pool ? _pool->acquire() : new char[BufferPool::BLOCK_SIZE];
+}
+
+void BufferChain::releaseBlock(char *block)
+{
+  if (_pool) {
+    _pool->release(block);
+  } else {
+    delete[] block;
+  }
+}
+
+/*
+ * Reads until the socket is drained, or until maxBytes were read if it is not 0.
+ * */
+BufferChain::ReadResult BufferChain::readFrom(int fd, size_t maxBytes)
+{
+  size_t total = 0;
+  while (true) {
+    if (maxBytes > 0 && total >= maxBytes) {
+      return READ_LIMIT;
+    }
+    if (_blocks.empty() || _blocks.back().end == BufferPool::BLOCK_SIZE) {
+      Block block;
+      block.data = acquireBlock();
+      block.start = 0;
+      block.end = 0;
+      _blocks.push_back(block);
+    }
+
+    Block& tail = _blocks.back();
+    char *spare = acquireBlock();
+    struct iovec iov[2];
+    iov[0].iov_base = tail.data + tail.end;
+    iov[0].iov_len = BufferPool::BLOCK_SIZE - tail.end;
+    iov[1].iov_base = spare;
+    iov[1].iov_len = BufferPool::BLOCK_SIZE;
+
+    ssize_t bytesRead = readv(fd, iov, 2);
+    if (bytesRead <= 0) {
+      releaseBlock(spare);
+      if (bytesRead == 0) {
+        return READ_CLOSED;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      return (errno == EAGAIN || errno == EWOULDBLOCK) ? READ_AGAIN : READ_ERROR;
+    }
+
+    size_t received = bytesRead;
+    _size += received;
+    total += received;
+    if (received <= iov[0].iov_len) {
+      tail.end += received;
+      releaseBlock(spare);
+    } else {
+      tail.end = BufferPool::BLOCK_SIZE;
+      Block block;
+      block.data = spare;
+      block.start = 0;
+      block.end = received - iov[0].iov_len;
+      _blocks.push_back(block);
+    }
+  }
+}
+
+size_t BufferChain::size() const
+{
+  return _size;
+}
+
+bool BufferChain::empty() const
+{
+  return _size == 0;
+}
+
+/*
+ * Returns the number of contiguous bytes stored from pos on and points data at the first one.
+ * */
+size_t BufferChain::spanAt(size_t pos, const char **data) const
+{
+  for (size_t i = 0; i < _blocks.size(); ++i) {
+    size_t length = _blocks[i].end - _blocks[i].start;
+    if (pos < length) {
+      *data = _blocks[i].data + _blocks[i].start + pos;
+      return length - pos;
+    }
+    pos -= length;
+  }
+  *data = NULL;
+  return 0;
+}
+
+/*
+ * Makes the first length bytes contiguous and returns a pointer to them.
+ * They usually are already (they sit in the first block), otherwise they are
+ * moved to a fresh block. Returns NULL if length does not fit in a block.
+ * The bytes may be rewritten in place (see HttpParser::normalizeUrl).
+ * */
+char *BufferChain::makeContiguous(size_t length)
+{
+  if (length > _size || length > BufferPool::BLOCK_SIZE) {
+    return NULL;
+  }
+  if (_blocks.empty()) {
+    return NULL;
+  }
+  if (_blocks[0].end - _blocks[0].start >= length) {
+    return _blocks[0].data + _blocks[0].start;
+  }
+
+  Block block;
+  block.data = acquireBlock();
+  block.start = 0;
+  block.end = length;
+  size_t copied = 0;
+  while (copied < length) {
+    const char *data;
+    size_t span = spanAt(copied, &data);
+    size_t count = span < length - copied ? span : length - copied;
+    memcpy(block.data + copied, data, count);
+    copied += count;
+  }
+  consume(length);
+  _blocks.insert(_blocks.begin(), block);
+  _size += length;
+  return block.data;
+}
+
+std::string BufferChain::substr(size_t pos, size_t length) const
+{
+  std::string result;
+  if (pos >= _size) {
+    return result;
+  }
+  if (length > _size - pos) {
+    length = _size - pos;
+  }
+  result.reserve(length);
+
+  size_t blockStart = 0;
+  for (size_t i = 0; i < _blocks.size() && length > 0; ++i) {
+    size_t offset = _blocks[i].start;
+    size_t blockLength = _blocks[i].end - offset;
+    if (pos < blockStart + blockLength) {
+      size_t begin = pos - blockStart;
+      size_t count = blockLength - begin < length ? blockLength - begin : length;
+      result.append(_blocks[i].data + offset + begin, count);
+      pos += count;
+      length -= count;
+    }
+    blockStart += blockLength;
+  }
+  return result;
+}
+
+/*
+ * Drops length bytes from the front, fully consumed blocks go back to the pool.
+ * */
+void BufferChain::consume(size_t length)
+{
+  if (length >= _size) {
+    clear();
+    return;
+  }
+  _size -= length;
+  while (length > 0) {
+    size_t available = _blocks[0].end - _blocks[0].start;
+    if (length < available) {
+      _blocks[0].start += length;
+      return;
+    }
+    length -= available;
+    releaseBlock(_blocks[0].data);
+    _blocks.erase(_blocks.begin());
+  }
+}
+
+/*
+ * Drops length bytes starting at pos, for example a body that was used while the head
+ * before it is still needed. Bytes after the range move down in their block.
+ * */
+void BufferChain::erase(size_t pos, size_t length)
+{
+  if (pos >= _size) {
+    return;
+  }
+  if (length > _size - pos) {
+    length = _size - pos;
+  }
+  size_t blockStart = 0;
+  size_t i = 0;
+  while (length > 0) {
+    Block& block = _blocks[i];
+    size_t blockLength = block.end - block.start;
+    if (pos >= blockStart + blockLength) {
+      blockStart += blockLength;
+      ++i;
+      continue;
+    }
+    size_t begin = pos - blockStart;
+    size_t count = blockLength - begin < length ? blockLength - begin : length;
+    if (count == blockLength) {
+      releaseBlock(block.data);
+      _blocks.erase(_blocks.begin() + i);
+    } else {
+      char *first = block.data + block.start + begin;
+      memmove(first, first + count, blockLength - begin - count);
+      block.end -= count;
+      blockStart += blockLength - count;
+      ++i;
+    }
+    _size -= count;
+    length -= count;
+  }
+}
+
+void BufferChain::clear()
+{
+  for (size_t i = 0; i < _blocks.size(); ++i) {
+    releaseBlock(_blocks[i].data);
+  }
+  _blocks.clear();
+  _size = 0;
+}
@@ -0,0 +1,77 @@
+#ifndef BUFFERCHAIN_HPP
+#define BUFFERCHAIN_HPP
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Recycles fixed-size receive blocks, one pool per Server (per event loop).
+ */
+class BufferPool {
+public:
+  static const size_t BLOCK_SIZE = 16384;
+
+  BufferPool(size_t maxFreeBlocks = 1024);
+  ~BufferPool();
+
+  char *acquire();
+  void release(char *block);
+
+private:
+  std::vector<char*> _freeBlocks;
+  size_t _maxFreeBlocks;
+
+  BufferPool(const BufferPool&);
+  BufferPool& operator=(const BufferPool&);
+};
+
+/*
+ * Received bytes stored as a chain of pooled blocks, so growing the buffer
+ * never reallocates or copies what was already received.
+ */
+class BufferChain {
+public:
+  enum ReadResult {
+    READ_AGAIN,   // Socket drained, wait for the next EPOLLIN
+    READ_CLOSED,  // Peer closed its side of the connection
+    READ_LIMIT,   // maxBytes were read, the socket may have more
+    READ_ERROR
+  };
+
+  BufferChain(BufferPool *pool = NULL);
+  ~BufferChain();
+
+  ReadResult readFrom(int fd, size_t maxBytes = 0);
+  size_t size() const;
+  bool empty() const;
+  size_t spanAt(size_t pos, const char **data) const;
+  char *makeContiguous(size_t length);
+  std::string substr(size_t pos, size_t length) const;
+  void consume(size_t length);
+  void erase(size_t pos, size_t length);
+  void clear();
+
+private:
+  struct Block {
+    char *data;
+    size_t start; // First byte not consumed yet
+    size_t end;   // One past the last received byte
+  };
+
+  BufferPool *_pool;
+  std::vector<Block> _blocks;
+  size_t _size;
+
+  BufferChain(const BufferChain&);
+  BufferChain& operator=(const BufferChain&);
+
+  char *acquireBlock();
+  void releaseBlock(char *block);
+};
+
+#endif // BUFFERCHAIN_HPP
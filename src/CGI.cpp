@@ -1,157 +1,513 @@
 #include "CGI.hpp"
+#include "Utils.hpp"
 #include <errno.h>
 #include <stdlib.h>
+#include <cstdio>
+#include <cctype>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <spawn.h>
 
 /*
  * Handles CGI script execution.
+ * executeScript() starts the script and returns, the Server then calls readOutput(),
+ * writeInput() and handleExit() when its pipes or its pidfd are ready, so a slow script
+ * only holds its own connection. The response is complete once done() is true.
  * */
-CGI::CGI(const Config& config) : _config(config)
+CGI::CGI(const Config& config, OutputQueue& output, ServerContext& context)
+  : _config(config), _context(context), _response(config, output, context),
+    _pid(-1), _outputFd(-1), _inputFd(-1), _exitFd(-1), _bodyOffset(0), _deadline(0),
+    _exited(false), _failed(false), _timedOut(false), _paused(false),
+    _cache(NULL), _producing(false), _waiting(false)
 {
 }
 
-void CGI::executeScript(const std::string& scriptPath, const std::string& queryString, int clientSocket)
+/*
+ * A script still running when its client goes away is killed, requests waiting for
+ * its output then run the script themselves.
+ * */
+CGI::~CGI()
+{
+  if (_producing) {
+    _context.cgiCache.release(_cacheKey);
+  } else if (_waiting) {
+    _context.cgiCache.cancel(_cacheKey, this);
+  }
+  if (_pid != -1 && !_exited) {
+    kill(_pid, SIGKILL);
+    reap(true);
+  }
+  closeFd(_outputFd);
+  closeFd(_inputFd);
+  closeFd(_exitFd);
+}
+
+void CGI::setKeepAlive(bool keepAlive)
+{
+  _response.setKeepAlive(keepAlive);
+}
+
+/*
+ * Output longer than CgiOutput::OUTPUT_BUFFER_SIZE is sent chunked to clients that allow it
+ * (HTTP/1.1), to others it ends with the connection.
+ * */
+void CGI::setChunked(bool chunked)
+{
+  _response.setChunked(chunked);
+}
+
+bool CGI::keepAlive() const
+{
+  return _response.keepAlive();
+}
+
+/*
+ * Starts the script at scriptPath with pipes for its stdin and stdout. scriptName is the
+ * URL path of the script and pathInfo the rest of the URL path. A failure to start it is answered
+ * with 500 right away, done() is true then.
+ * Output of scripts matched by a cgi_cache route (cache) is looked up in the CgiCache first:
+ * a hit is answered at once, a request for output another script is producing waits for it
+ * (waiting() is true, the Server learns from CgiCache::takeTouched() when it is answered).
+ * Scripts named nph-* send the whole HTTP response themselves (CGI/1.1 section 5).
+ * */
+void CGI::executeScript(const std::string& scriptPath, const std::string& scriptName, const std::string& pathInfo,
+                        const Request& request, const Route *cache)
 {         
-  int pipefd[2];
-  if (pipe(pipefd) == -1)
+  bool nph = scriptName.compare(scriptName.rfind('/') + 1, 4, "nph-") == 0;
+  if (cache != NULL && _context.cgiCache.enabled() && !nph) {
+    _cache = cache;
+    _cacheKey = CgiCache::key(*cache, request);
+    const CgiCache::Entry *entry = NULL;
+    CgiCache::Result result = _context.cgiCache.lookup(_cacheKey, this, entry);
+    if (result == CgiCache::CACHE_HIT) {
+      sendCached(*entry);
+      return;
+    }
+    _waiting = (result == CgiCache::CACHE_WAIT);
+    _producing = (result == CgiCache::CACHE_MISS);
+    if (_producing) {
+      _response.capture(CgiCache::MAX_ENTRY_SIZE);
+    }
+  }
+
+  _scriptPath = scriptPath;
+  _env = buildEnvironment(_config, request, scriptPath, scriptName, pathInfo);
+  _body = request.getBody();
+  _response.setNph(nph);
+  if (!_waiting) {
+    startScript();
+  }
+}
+
+/*
+ * Spawns the script with the environment executeScript() prepared.
+ * */
+void CGI::startScript()
+{
+  _waiting = false;
+  std::vector<std::string> envStrings;
+  envStrings.swap(_env);
+
+  // The parent ends must not leak into other scripts, dup2() clears O_CLOEXEC on the child ends
+  int inputPipe[2];
+  int outputPipe[2];
+  if (pipe2(inputPipe, O_CLOEXEC) == -1)
   {
     std::cerr << "Error: Failed to create pipe. " << strerror(errno) << "\n";
-    throw std::runtime_error("Failed to create pipe for CGI execution");
+    finish(500);
+    return;
   }
-
-  pid_t pid = fork();
-  if (pid == -1)
+  if (pipe2(outputPipe, O_CLOEXEC) == -1)
   {
-    std::cerr << "Error: Failed to fork. " << strerror(errno) << "\n";
-    close(pipefd[0]);
-    close(pipefd[1]);
-    throw std::runtime_error("Failed to fork for CGI execution");
+    std::cerr << "Error: Failed to create pipe. " << strerror(errno) << "\n";
+    close(inputPipe[0]);
+    close(inputPipe[1]);
+    finish(500);
+    return;
   }
 
-  if (pid == 0) // Child process
+  pid_t pid;
+  int error = spawnScript(_scriptPath, envStrings, inputPipe[0], outputPipe[1], pid);
+  if (error != 0)
   {
-    try {
-      setupChildProcess(pipefd, scriptPath, queryString);
-    } catch (const std::exception& e) {
-      std::cerr << "Error in child process: " << e.what() << "\n";
-      exit(1);
-    }
-  } else { // Parent process
-    handleParentProcess(pipefd, pid, clientSocket);
+    std::cerr << "Error: Failed to execute CGI script " << _scriptPath << ". " << strerror(error) << "\n";
+    close(inputPipe[0]);
+    close(inputPipe[1]);
+    close(outputPipe[0]);
+    close(outputPipe[1]);
+    finish(500);
+    return;
   }
+  handleParentProcess(inputPipe, outputPipe, pid);
 }
 
-void CGI::setupChildProcess(int pipefd[2], const std::string& scriptPath, const std::string& queryString)
+/*
+ * Answers with output from the CgiCache.
+ * */
+void CGI::sendCached(const CgiCache::Entry& entry)
 {
-  close(pipefd[0]); // Close read end of the pipe
-    
-  // Redirect stdout to the write end of the pipr
-  if (dup2(pipefd[1], STDOUT_FILENO) == -1) {
-    std::cerr << "Error: Failed to redirect stdout. " << strerror(errno) << "\n";
-    close(pipefd[1]);
-    exit(1);
-  }
-  close(pipefd[1]);
+  _waiting = false;
+  _response.sendCached(entry.status, entry.headers, entry.body);
+}
+
+/*
+ * Meta-variables for a script as NAME=value strings (CGI/1.1 section 4.1), FastCGI sends
+ * the same ones as params. Request headers become HTTP_* variables, repeated ones joined
+ * with ", ". Proxy is left out: HTTP_PROXY would be taken for the proxy setting by
+ * many HTTP client libraries ("httpoxy").
+ * */
+std::vector<std::string> CGI::buildEnvironment(const Config& config, const Request& request,
+                                               const std::string& scriptPath, const std::string& scriptName,
+                                               const std::string& pathInfo)
+{
+  StringView url = request.getUrl();
+  StringView path = request.getPath();
 
-  // Create environment variables array for execve
-  // We'll build our own environment array instead of using setenv()
   std::vector<std::string> envStrings;
-  envStrings.push_back("QUERY_STRING=" + queryString);
-  envStrings.push_back("REQUEST_METHOD=GET");
+  envStrings.push_back("GATEWAY_INTERFACE=CGI/1.1");
+  envStrings.push_back("QUERY_STRING=" + (path.length < url.length ? std::string(path.data + path.length + 1, url.data + url.length) : ""));
+  envStrings.push_back("REQUEST_METHOD=" + request.getMethod().str());
+  envStrings.push_back("REQUEST_URI=" + url.str());
+  envStrings.push_back("SCRIPT_NAME=" + scriptName);
+  envStrings.push_back("SCRIPT_FILENAME=" + scriptPath);
+  if (!pathInfo.empty()) {
+    envStrings.push_back("PATH_INFO=" + pathInfo);
+    envStrings.push_back("PATH_TRANSLATED=" + config.getDocumentRoot() + pathInfo);
+  }
+  if (!request.getBody().empty()) {
+    std::ostringstream contentLength;
+    contentLength << request.getBody().size();
+    envStrings.push_back("CONTENT_LENGTH=" + contentLength.str());
+  }
+  StringView contentType = request.getHeader(HEADER_CONTENT_TYPE);
+  if (!contentType.empty()) {
+    envStrings.push_back("CONTENT_TYPE=" + contentType.str());
+  }
+  std::ostringstream port;
+  port << config.getPort();
+  envStrings.push_back("SERVER_NAME=" + config.getServerName());
+  envStrings.push_back("SERVER_PORT=" + port.str());
+  envStrings.push_back("SERVER_PROTOCOL=" + request.getVersion().str());
   envStrings.push_back("SERVER_SOFTWARE=WebServ/1.0");
-  envStrings.push_back("SERVER_NAME=" + _config.getServerName());
-  envStrings.push_back("DOCUMENT_ROOT=" + _config.getDocumentRoot());
+  envStrings.push_back("DOCUMENT_ROOT=" + config.getDocumentRoot());
+  if (!request.getRemoteAddress().empty()) {
+    envStrings.push_back("REMOTE_ADDR=" + request.getRemoteAddress().str());
+  }
+
+  size_t firstHeader = envStrings.size();
+  for (size_t i = 0; i < request.getHeaderCount(); ++i) {
+    StringView name = request.getHeaderName(i);
+    if (name.equalsIgnoreCase("Content-Type") || name.equalsIgnoreCase("Content-Length")
+        || name.equalsIgnoreCase("Proxy")) {
+      continue;
+    }
+    std::string variable = "HTTP_";
+    for (size_t c = 0; c < name.length; ++c) {
+      variable += name.data[c] == '-' ? '_' : static_cast<char>(toupper(static_cast<unsigned char>(name.data[c])));
+    }
+    variable += '=';
+    size_t existing = firstHeader;
+    while (existing < envStrings.size() && envStrings[existing].compare(0, variable.size(), variable) != 0) {
+      ++existing;
+    }
+    if (existing < envStrings.size()) {
+      envStrings[existing] += ", " + request.getHeaderValue(i).str();
+    } else {
+      envStrings.push_back(variable + request.getHeaderValue(i).str());
+    }
+  }
+  return envStrings;
+}
 
-  // Convert to char* array for execve
-  char* envp[envStrings.size() + 1]; // +1 for NULL terminator
+/*
+ * Starts the script with posix_spawn(), which glibc runs as clone(CLONE_VM | CLONE_VFORK):
+ * the child borrows the server's memory until execve(), so unlike fork() the cost does not
+ * grow with the server's page tables (see tests/bench_spawn.cpp) and other worker threads
+ * keep running. The pipe ends become stdin and stdout, the server's other descriptors are
+ * all O_CLOEXEC. The script gets an empty signal mask and SIGPIPE back at its default.
+ * Returns 0 or the errno value, a script that can't be executed is reported here.
+ * */
+int CGI::spawnScript(const std::string& scriptPath, const std::vector<std::string>& envStrings,
+                     int inputFd, int outputFd, pid_t& pid)
+{
+  std::vector<char*> envp;
   for (size_t i = 0; i < envStrings.size(); i++) {
-    envp[i] = const_cast<char*>(envStrings[i].c_str());
+    envp.push_back(const_cast<char*>(envStrings[i].c_str()));
   }
-  envp[envStrings.size()] = NULL; // NULL terminator
+  envp.push_back(NULL);
+  char *args[] = { const_cast<char*>(scriptPath.c_str()), NULL };
+
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attributes;
+  int error = posix_spawn_file_actions_init(&actions);
+  if (error != 0) {
+    return error;
+  }
+  error = posix_spawnattr_init(&attributes);
+  if (error != 0) {
+    posix_spawn_file_actions_destroy(&actions);
+    return error;
+  }
+  sigset_t signals;
+  sigemptyset(&signals);
+  posix_spawnattr_setsigmask(&attributes, &signals);
+  sigaddset(&signals, SIGPIPE);
+  posix_spawnattr_setsigdefault(&attributes, &signals);
+  posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+  posix_spawn_file_actions_adddup2(&actions, inputFd, STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, outputFd, STDOUT_FILENO);
+
+  error = posix_spawn(&pid, scriptPath.c_str(), &actions, &attributes, args, &envp[0]);
+  posix_spawnattr_destroy(&attributes);
+  posix_spawn_file_actions_destroy(&actions);
+  return error;
+}
 
-  // Prepare args for execve
-  char* args[2];
-  args[0] = const_cast<char*>(scriptPath.c_str());
-  args[1] = NULL;
+/*
+ * Keeps the parent ends of the pipes, non-blocking for the event loop, and a pidfd
+ * that becomes readable when the script exits. Kernels without pidfd_open() (before 5.3)
+ * leave exitFd() at -1, the exit is then noticed at EOF or by checkTimeout().
+ * */
+void CGI::handleParentProcess(int inputPipe[2], int outputPipe[2], pid_t pid)
+{
+  close(inputPipe[0]); // Close read end of the input pipe
+  close(outputPipe[1]); // Close write end of the output pipe
+  _pid = pid;
+  _inputFd = inputPipe[1];
+  _outputFd = outputPipe[0];
+  fcntl(_inputFd, F_SETFL, fcntl(_inputFd, F_GETFL) | O_NONBLOCK);
+  fcntl(_outputFd, F_SETFL, fcntl(_outputFd, F_GETFL) | O_NONBLOCK);
+#ifdef SYS_pidfd_open
+  _exitFd = syscall(SYS_pidfd_open, pid, 0);
+#endif
+  _deadline = time(NULL) + _config.getCgiTimeout();
 
-  // Execute the CGI script.
-  execve(scriptPath.c_str(), args, envp);
- 
-  // If execl fails
-  std::cerr << "Error: Failed to execute CGI script. " << strerror(errno) << "\n";
-  exit(1);
+  if (_body.empty()) {
+    closeFd(_inputFd); // The script reads EOF at once
+  }
 }
 
-void CGI::handleParentProcess(int pipefd[2], pid_t pid, int clientSocket)
+int CGI::outputFd() const
 {
-  close(pipefd[1]); // Close write end of the pipe
-  
-  // Read the output of the CGI script from the pipe
-  std::string cgiOutput = readFromPipe(pipefd[0]);
-  close(pipefd[0]);
-  
-  // Wait for the child process to finish
-  int status;
-  waitpid(pid, &status, 0);
+  return _outputFd;
+}
 
-  if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
-    // Child process exited with an error
-    std::cerr << "CGI script exited with status: " << WEXITSTATUS(status) << "\n";
-    sendErrorResponse(500, "Internal Server Error", clientSocket);
+int CGI::inputFd() const
+{
+  return _inputFd;
+}
+
+int CGI::exitFd() const
+{
+  return _exitFd;
+}
+
+/*
+ * Reads the script's output until the pipe is empty. While MAX_PENDING_OUTPUT bytes
+ * wait for a slow client the rest is left in the pipe, so the script blocks on its writes
+ * instead of the server buffering everything (see resume()).
+ * */
+void CGI::readOutput()
+{
+  char buffer[CgiOutput::OUTPUT_BUFFER_SIZE];
+  bool progress = false;
+  while (_outputFd != -1) {
+    if (_response.full()) {
+      _paused = true;
+      return;
+    }
+    ssize_t bytesRead = read(_outputFd, buffer, sizeof(buffer));
+    if (bytesRead > 0) {
+      _response.write(buffer, bytesRead);
+      if (!progress) {
+        progress = true;
+        _deadline = time(NULL) + _config.getCgiTimeout();
+      }
+      continue;
+    }
+    if (bytesRead == -1 && errno == EINTR) {
+      continue;
+    }
+    if (bytesRead == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return; // Wait for EPOLLIN
+    }
+    if (bytesRead == -1) {
+      std::cerr << "Error reading from pipe: " << strerror(errno) << "\n";
+      _failed = true;
+    }
+    closeFd(_outputFd);
+  }
+  if (_exitFd == -1) {
+    reap(false);
+  }
+  finishIfDone();
+}
+
+/*
+ * Writes the request body to the script's stdin as the pipe has room. A spooled body
+ * is spliced from its file into the pipe. The pipe is closed at the end of the body,
+ * or when the script closed its stdin without reading it all.
+ * */
+void CGI::writeInput()
+{
+  while (_inputFd != -1 && _bodyOffset < _body.size()) {
+    size_t remaining = _body.size() - _bodyOffset;
+    ssize_t written;
+    if (_body.file() != NULL) {
+      loff_t offset = _bodyOffset;
+      written = splice(_body.file()->fd, &offset, _inputFd, NULL, remaining, SPLICE_F_NONBLOCK);
+    } else {
+      written = write(_inputFd, _body.data().data() + _bodyOffset, remaining);
+    }
+    if (written > 0) {
+      _bodyOffset += written;
+      continue;
+    }
+    if (written == -1 && errno == EINTR) {
+      continue;
+    }
+    if (written == -1 && errno == EAGAIN) {
+      return; // Wait for EPOLLOUT
+    }
+    if (written == -1 && errno != EPIPE) {
+      std::cerr << "Error writing to pipe: " << strerror(errno) << "\n";
+    }
+    break;
+  }
+  closeFd(_inputFd);
+}
+
+/*
+ * Called when the pidfd is readable: the script exited.
+ * */
+void CGI::handleExit()
+{
+  reap(false);
+  finishIfDone();
+}
+
+/*
+ * Continues reading output that was left in the pipe for a slow client, once half
+ * of the pending output was sent. Returns true if anything was read.
+ * */
+bool CGI::resume()
+{
+  if (!_paused || !_response.drained()) {
+    return false;
+  }
+  _paused = false;
+  _deadline = time(NULL) + _config.getCgiTimeout();
+  size_t pending = _response.pendingBytes();
+  readOutput();
+  return _response.pendingBytes() != pending || _response.done();
+}
+
+/*
+ * Called about once per second: kills a script that produced no output for cgi_timeout
+ * seconds and reaps scripts that exited when there is no pidfd to report it.
+ * A script paused for a slow client is not timed, the Server drops stalled clients.
+ * */
+void CGI::checkTimeout(time_t now)
+{
+  if (_response.done() || _waiting) {
+    return;
+  }
+  if (_exitFd == -1 && !_exited && _pid != -1) {
+    reap(false);
+    finishIfDone();
+  }
+  if (_response.done() || _paused || now < _deadline) {
     return;
   }
+  std::cerr << "Error: CGI script produced no output for " << _config.getCgiTimeout() << " seconds.\n";
+  if (!_exited) {
+    kill(_pid, SIGKILL);
+    reap(true);
+  }
+  _failed = true;
+  _timedOut = true;
+  closeFd(_outputFd);
+  finishIfDone();
+}
 
-  // Send the CGI output as the HTTP response
-  sendCgiResponse(cgiOutput, clientSocket);
+bool CGI::done() const
+{
+  return _response.done();
 }
 
-std::string CGI::readFromPipe(int pipefd)
+/*
+ * True while the request waits for the output of the same script run for another one.
+ * */
+bool CGI::waiting() const
+{
+  return _waiting;
+}
+
+/*
+ * Collects the exit status of the script, wait blocks until it is available.
+ * */
+void CGI::reap(bool wait)
 {
-  char buffer[1024];
-  std::string cgiOutput;
-  ssize_t bytesRead;
-  
-  while ((bytesRead = read(pipefd, buffer, sizeof(buffer))) > 0) {
-    cgiOutput.append(buffer, bytesRead);
+  if (_exited) {
+    return;
   }
-  
-  if (bytesRead == -1) {
-    std::cerr << "Error reading from pipe: " << strerror(errno) << "\n";
+  int status;
+  pid_t result = waitpid(_pid, &status, wait ? 0 : WNOHANG);
+  if (result == 0) {
+    return; // Still running
+  }
+  _exited = true;
+  closeFd(_exitFd);
+  if (result == -1) {
+    std::cerr << "Error: waitpid failed. " << strerror(errno) << "\n";
+    _failed = true;
+  } else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+    // Child process exited with an error
+    std::cerr << "CGI script exited with status: " << WEXITSTATUS(status) << "\n";
+    _failed = true;
+  } else if (WIFSIGNALED(status)) {
+    std::cerr << "CGI script killed by signal: " << WTERMSIG(status) << "\n";
+    _failed = true;
   }
-  
-  return cgiOutput;
 }
 
-void CGI::sendCgiResponse(const std::string& cgiOutput, int clientSocket)
+/*
+ * The response ends once the output reached EOF and the exit status is known.
+ * */
+void CGI::finishIfDone()
 {
-  // Check if the CGI script included HTTP headers
-  size_t headerEnd = cgiOutput.find("\r\n\r\n");
-  bool hasHeaders = headerEnd != std::string::npos && 
-                   cgiOutput.find("Content-Type:") != std::string::npos;
-  
-  std::ostringstream response;
-  
-  if (!hasHeaders) {
-    // No headers found, add our own
-    response << "HTTP/1.1 200 OK\r\n";
-    response << "Content-Type: text/html\r\n";
-    response << "Content-Length: " << cgiOutput.size() << "\r\n";
-    response << "\r\n";
+  if (_response.done() || _outputFd != -1 || !_exited) {
+    return;
   }
-  
-  response << cgiOutput;
+  closeFd(_inputFd);
+  finish(_failed ? (_timedOut ? 504 : 500) : 0);
+}
 
-  write(clientSocket, response.str().c_str(), response.str().size());
+/*
+ * Ends the response. Output the CgiCache waits for is stored if it may be kept,
+ * otherwise the requests waiting for it are let go.
+ * */
+void CGI::finish(int errorStatus)
+{
+  _response.finish(errorStatus);
+  if (!_producing) {
+    return;
+  }
+  _producing = false;
+  if (errorStatus != 0 || !_response.captured()) {
+    _context.cgiCache.release(_cacheKey);
+    return;
+  }
+  int status = _response.status();
+  _context.cgiCache.store(_cacheKey, status, _response.headers(), _response.capturedBody(),
+                          CgiCache::lifetime(status, _response.headers(), _cache->cacheValid));
 }
 
-void CGI::sendErrorResponse(int statusCode, const std::string& statusMessage, int clientSocket)
+void CGI::closeFd(int& fd)
 {
-  std::ostringstream response;
-  response << "HTTP/1.1 " << statusCode << " " << statusMessage << "\r\n";
-  response << "Content-Type: text/html\r\n";
-  response << "Connection: close\r\n";
-  response << "\r\n";
-  response << "<html><body><h1>" << statusCode << " " << statusMessage << "</h1>";
-  response << "<p>CGI Script Execution Failed</p></body></html>";
-  
-  write(clientSocket, response.str().c_str(), response.str().size());
+  if (fd != -1) {
+    close(fd);
+    fd = -1;
+  }
 }
@@ -5,24 +5,85 @@
 #include <sstream>
 #include <string>
 #include <cstring>
+#include <ctime>
 #include <stdexcept>
+#include <vector>
 #include <unistd.h>
 #include <sys/wait.h>
 #include "Config.hpp"
+#include "OutputQueue.hpp"
+#include "ServerContext.hpp"
+#include "Request.hpp"
+#include "RequestBody.hpp"
+#include "CgiOutput.hpp"
+#include "CgiCache.hpp"
 
+/*
+ * A CGI script run alongside the event loop. The Server watches the pipes and the exit
+ * of the child (see outputFd(), inputFd() and exitFd()) and calls back into the CGI,
+ * which writes the request body to the script and passes its output on as it is read.
+ */
 class CGI {
 private:
   const Config& _config;
-  
-  void setupChildProcess(int pipefd[2], const std::string& scriptPath, const std::string& queryString);
-  void handleParentProcess(int pipefd[2], pid_t pid, int clientSocket);
-  std::string readFromPipe(int pipefd);
-  void sendCgiResponse(const std::string& cgiOutput, int clientSocket);
-  void sendErrorResponse(int statusCode, const std::string& statusMessage, int clientSocket);
+  ServerContext& _context;
+  CgiOutput _response;
+
+  pid_t _pid;
+  int _outputFd;        // Script's stdout, -1 after EOF
+  int _inputFd;         // Script's stdin, -1 once the body is written
+  int _exitFd;          // pidfd of the script, -1 once reaped or if the kernel has none
+  RequestBody _body;
+  size_t _bodyOffset;   // Body bytes already written to the script
+  time_t _deadline;     // The script is killed after this
+  bool _exited;
+  bool _failed;
+  bool _timedOut;
+  bool _paused;         // Output is left in the pipe until the client catches up
+  std::string _scriptPath;
+  std::vector<std::string> _env; // Kept until the script is started
+  const Route *_cache;  // cgi_cache route of the script, NULL if its output is not cached
+  std::string _cacheKey;
+  bool _producing;      // The CgiCache entry for _cacheKey waits for this script's output
+  bool _waiting;        // Another script produces the output, see CgiCache::lookup()
+
+  static int spawnScript(const std::string& scriptPath, const std::vector<std::string>& envStrings,
+                         int inputFd, int outputFd, pid_t& pid);
+  void startScript();
+  void sendCached(const CgiCache::Entry& entry);
+  void handleParentProcess(int inputPipe[2], int outputPipe[2], pid_t pid);
+  void finish(int errorStatus);
+  void reap(bool wait);
+  void finishIfDone();
+  static void closeFd(int& fd);
+
+  CGI(const CGI&);
+  CGI& operator=(const CGI&);
+
+  friend class CgiCache;
 
 public:
-  CGI(const Config& config);
-  void executeScript(const std::string& scriptPath, const std::string& queryString, int clientSocket);
+  CGI(const Config& config, OutputQueue& output, ServerContext& context);
+  ~CGI();
+  void setKeepAlive(bool keepAlive);
+  void setChunked(bool chunked);
+  bool keepAlive() const;
+  void executeScript(const std::string& scriptPath, const std::string& scriptName, const std::string& pathInfo,
+                     const Request& request, const Route *cache);
+  static std::vector<std::string> buildEnvironment(const Config& config, const Request& request,
+                                                   const std::string& scriptPath, const std::string& scriptName,
+                                                   const std::string& pathInfo);
+
+  int outputFd() const;
+  int inputFd() const;
+  int exitFd() const;
+  void readOutput();
+  void writeInput();
+  void handleExit();
+  bool resume();
+  void checkTimeout(time_t now);
+  bool done() const;
+  bool waiting() const;
 };
 
 #endif // CGI_HPP
@@ -0,0 +1,239 @@
+#include "CgiCache.hpp"
+#include "CGI.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+/*
+ * CgiCache keeps the output of scripts matched by cgi_cache, so a popular GET is answered
+ * from memory instead of starting the script every time. An entry is created by the first
+ * request for its key: that request runs the script, the ones for the same key that arrive
+ * while it runs wait for it and get the same output (one script per key, not one per request).
+ * If the output can't be kept (an error, Set-Cookie, no-store, too long) the waiters run
+ * the script themselves.
+ * Entries never exceed budget bytes together and the least recently used one is dropped
+ * first; a budget of 0 disables the cache. Each event loop has its own cache.
+ * */
+CgiCache::CgiCache(size_t budget)
+  : _budget(budget), _used(0), _hits(0), _misses(0)
+{
+}
+
+CgiCache::~CgiCache()
+{
+  while (!_entries.empty()) {
+    erase(_entries.begin());
+  }
+}
+
+bool CgiCache::enabled() const
+{
+  return _budget > 0;
+}
+
+/*
+ * The URL (path and query string) and the values of the route's cacheKeyHeaders.
+ * */
+std::string CgiCache::key(const Route& route, const Request& request)
+{
+  std::string key = request.getUrl().str();
+  for (size_t i = 0; i < route.cacheKeyHeaders.size(); ++i) {
+    key += '\n';
+    key += request.getHeader(route.cacheKeyHeaders[i]).str();
+  }
+  return key;
+}
+
+/*
+ * Seconds the output described by status and headers may be kept, 0 if it must not be.
+ * s-maxage wins over max-age, which wins over Expires (RFC 9111 section 4.2.1), output
+ * without any of them is kept defaultValid seconds. Only 200, 301 and 302 are kept.
+ * */
+int CgiCache::lifetime(int status, const std::string& headers, int defaultValid)
+{
+  if (status != 200 && status != 301 && status != 302) {
+    return 0;
+  }
+  int maxAge = -1;
+  int sharedMaxAge = -1;
+  int expires = -1;
+  size_t pos = 0;
+  while (pos < headers.size()) {
+    size_t end = headers.find("\r\n", pos);
+    if (end == std::string::npos) {
+      end = headers.size();
+    }
+    size_t colon = headers.find(':', pos);
+    if (colon > end) {
+      pos = end + 2;
+      continue;
+    }
+    StringView name(headers.data() + pos, colon - pos);
+    std::string value = StringView(headers.data() + colon + 1, end - colon - 1).trim().str();
+    pos = end + 2;
+
+    if (name.equalsIgnoreCase("Set-Cookie")) {
+      return 0;
+    }
+    if (name.equalsIgnoreCase("Expires")) {
+      time_t date;
+      if (!Utils::parseHttpDate(value, date)) {
+        return 0; // An invalid date means already expired
+      }
+      expires = static_cast<int>(std::max(static_cast<time_t>(0), date - time(NULL)));
+    } else if (name.equalsIgnoreCase("Cache-Control")) {
+      std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+      if (value.find("no-store") != std::string::npos || value.find("no-cache") != std::string::npos
+          || value.find("private") != std::string::npos) {
+        return 0;
+      }
+      size_t directive = value.find("s-maxage=");
+      if (directive != std::string::npos) {
+        sharedMaxAge = atoi(value.c_str() + directive + 9);
+      }
+      directive = value.find("max-age=");
+      if (directive != std::string::npos) {
+        maxAge = atoi(value.c_str() + directive + 8);
+      }
+    }
+  }
+  if (sharedMaxAge >= 0) {
+    return sharedMaxAge;
+  }
+  if (maxAge >= 0) {
+    return maxAge;
+  }
+  if (expires >= 0) {
+    return expires;
+  }
+  return defaultValid;
+}
+
+/*
+ * A fresh stored entry is a hit. While a script produces the entry cgi is added to its
+ * waiters. Otherwise the entry is created and cgi is expected to produce it.
+ * entry stays valid until the next call on the cache.
+ * */
+CgiCache::Result CgiCache::lookup(const std::string& key, CGI *cgi, const Entry *&entry)
+{
+  EntryMap::iterator it = _entries.find(key);
+  if (it != _entries.end() && it->second.body == NULL) {
+    it->second.waiters.push_back(cgi);
+    ++_hits;
+    return CACHE_WAIT;
+  }
+  if (it != _entries.end()) {
+    if (it->second.expires > time(NULL)) {
+      _lru.splice(_lru.begin(), _lru, it->second.lru);
+      entry = &it->second;
+      ++_hits;
+      return CACHE_HIT;
+    }
+    erase(it);
+  }
+  Entry& created = _entries[key];
+  created.status = 0;
+  created.body = NULL;
+  created.expires = 0;
+  created.size = 0;
+  ++_misses;
+  return CACHE_MISS;
+}
+
+/*
+ * Called by the script that produced key: keeps its output for lifetime seconds, evicting
+ * older entries to stay within the budget, and answers the waiters with it.
+ * */
+void CgiCache::store(const std::string& key, int status, const std::string& headers,
+                     const std::string& body, int lifetime)
+{
+  EntryMap::iterator it = _entries.find(key);
+  size_t size = key.size() + headers.size() + body.size();
+  if (it == _entries.end() || lifetime <= 0 || body.size() > MAX_ENTRY_SIZE || size > _budget) {
+    release(key);
+    return;
+  }
+  while (_used + size > _budget) {
+    erase(_entries.find(_lru.back()));
+  }
+
+  Entry& entry = it->second;
+  entry.status = status;
+  entry.headers = headers;
+  entry.body = new SharedBuffer(body);
+  entry.expires = time(NULL) + lifetime;
+  entry.size = size;
+  _lru.push_front(key);
+  entry.lru = _lru.begin();
+  _used += size;
+
+  std::vector<CGI*> waiters;
+  waiters.swap(entry.waiters);
+  for (size_t i = 0; i < waiters.size(); ++i) {
+    waiters[i]->sendCached(entry);
+    _touched.push_back(waiters[i]);
+  }
+}
+
+/*
+ * Called by the script that was to produce key when its output is not kept (or it never
+ * finished): the entry is dropped and every waiter runs the script itself.
+ * */
+void CgiCache::release(const std::string& key)
+{
+  EntryMap::iterator it = _entries.find(key);
+  if (it == _entries.end() || it->second.body != NULL) {
+    return;
+  }
+  std::vector<CGI*> waiters;
+  waiters.swap(it->second.waiters);
+  _entries.erase(it);
+  for (size_t i = 0; i < waiters.size(); ++i) {
+    waiters[i]->startScript();
+    _touched.push_back(waiters[i]);
+  }
+}
+
+/*
+ * Forgets a waiter whose client went away.
+ * */
+void CgiCache::cancel(const std::string& key, CGI *waiter)
+{
+  EntryMap::iterator it = _entries.find(key);
+  if (it != _entries.end()) {
+    std::vector<CGI*>& waiters = it->second.waiters;
+    waiters.erase(std::remove(waiters.begin(), waiters.end(), waiter), waiters.end());
+  }
+  _touched.erase(std::remove(_touched.begin(), _touched.end(), waiter), _touched.end());
+}
+
+/*
+ * Moves the waiters that were answered or started their own script since the last
+ * call into touched, for the Server to serve their clients.
+ * */
+void CgiCache::takeTouched(std::vector<CGI*>& touched)
+{
+  touched.clear();
+  touched.swap(_touched);
+}
+
+unsigned long CgiCache::hits() const
+{
+  return _hits;
+}
+
+unsigned long CgiCache::misses() const
+{
+  return _misses;
+}
+
+void CgiCache::erase(EntryMap::iterator it)
+{
+  if (it->second.body != NULL) {
+    _used -= it->second.size;
+    it->second.body->release();
+    _lru.erase(it->second.lru);
+  }
+  _entries.erase(it);
+}
@@ -0,0 +1,72 @@
+#ifndef CGICACHE_HPP
+#define CGICACHE_HPP
+
+#include <string>
+#include <map>
+#include <list>
+#include <vector>
+#include <ctime>
+#include "Route.hpp"
+#include "Request.hpp"
+#include "SharedBuffer.hpp"
+
+class CGI;
+
+/*
+ * Output of cgi_cache scripts kept in memory within a byte budget, and the requests
+ * waiting for the script that is producing an entry.
+ */
+class CgiCache {
+public:
+  // Longer output is passed on but not kept
+  static const size_t MAX_ENTRY_SIZE = 1024 * 1024;
+
+  enum Result {
+    CACHE_HIT,   // The entry is returned
+    CACHE_MISS,  // The caller runs the script and calls store() or release()
+    CACHE_WAIT   // Another script produces the entry, the caller is told when it is done
+  };
+
+  struct Entry {
+    int status;
+    std::string headers;       // Header lines from the script, CRLF terminated
+    SharedBuffer *body;        // NULL while the script runs
+    time_t expires;
+    size_t size;               // Bytes counted against the budget
+    std::vector<CGI*> waiters; // Requests for the same key that arrived meanwhile
+    std::list<std::string>::iterator lru;
+  };
+
+  explicit CgiCache(size_t budget);
+  ~CgiCache();
+
+  bool enabled() const;
+  static std::string key(const Route& route, const Request& request);
+  static int lifetime(int status, const std::string& headers, int defaultValid);
+  Result lookup(const std::string& key, CGI *cgi, const Entry *&entry);
+  void store(const std::string& key, int status, const std::string& headers, const std::string& body,
+             int lifetime);
+  void release(const std::string& key);
+  void cancel(const std::string& key, CGI *waiter);
+  void takeTouched(std::vector<CGI*>& touched);
+  unsigned long hits() const;
+  unsigned long misses() const;
+
+private:
+  typedef std::map<std::string, Entry> EntryMap;
+
+  size_t _budget;
+  size_t _used;
+  EntryMap _entries;
+  std::list<std::string> _lru; // Stored entries, most recently used first
+  std::vector<CGI*> _touched;  // Waiters that got their response or started their own script
+  unsigned long _hits;
+  unsigned long _misses;
+
+  CgiCache(const CgiCache&);
+  CgiCache& operator=(const CgiCache&);
+
+  void erase(EntryMap::iterator it);
+};
+
+#endif // CGICACHE_HPP
@@ -0,0 +1,319 @@
+#include "CgiOutput.hpp"
+#include "Utils.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+/*
+ * Output is collected until OUTPUT_BUFFER_SIZE, then the head is queued and the rest
+ * is passed on without waiting for the end. Short output is sent with a Content-Length,
+ * longer output chunked to clients that allow it (HTTP/1.1) and delimited by the
+ * connection close to others.
+ * */
+CgiOutput::CgiOutput(const Config& config, OutputQueue& output, ServerContext& context)
+  : _config(config), _output(output), _context(context), _keepAlive(false),
+    _chunked(false), _streaming(false), _chunkedOutput(false), _done(false),
+    _headersParsed(false), _nph(false), _status(0), _hasContentType(false), _hasLocation(false),
+    _capturing(false), _captureLimit(0)
+{
+}
+
+void CgiOutput::setKeepAlive(bool keepAlive)
+{
+  _keepAlive = keepAlive;
+}
+
+void CgiOutput::setChunked(bool chunked)
+{
+  _chunked = chunked;
+}
+
+/*
+ * Non-parsed header output is not framed by the server, the connection ends with it.
+ * */
+void CgiOutput::setNph(bool nph)
+{
+  _nph = nph;
+  if (nph) {
+    _keepAlive = false;
+  }
+}
+
+bool CgiOutput::keepAlive() const
+{
+  return _keepAlive;
+}
+
+void CgiOutput::write(const char *data, size_t length)
+{
+  if (_streaming || _nph) {
+    _streaming = true;
+    sendBody(data, length);
+    return;
+  }
+  _pending.append(data, length);
+  if (!_headersParsed && !parseHeaders(false)) {
+    return;
+  }
+  if (_pending.size() >= OUTPUT_BUFFER_SIZE) {
+    startOutput(false);
+  }
+}
+
+/*
+ * Ends the response, errorStatus is 0 on success. A failure before anything was queued
+ * is answered with errorStatus, after that the response is cut short (no last chunk and
+ * the connection is closed) so the client can tell it is incomplete.
+ * */
+void CgiOutput::finish(int errorStatus)
+{
+  if (_done) {
+    return;
+  }
+  _done = true;
+  if (!_streaming) {
+    if (errorStatus != 0 || _nph) {
+      sendErrorResponse(errorStatus != 0 ? errorStatus : 500);
+    } else {
+      if (!_headersParsed) {
+        parseHeaders(true);
+      }
+      startOutput(true);
+    }
+    return;
+  }
+  if (errorStatus != 0) {
+    _keepAlive = false;
+  } else if (_chunkedOutput) {
+    _output.pushLastChunk();
+  }
+}
+
+bool CgiOutput::done() const
+{
+  return _done;
+}
+
+/*
+ * True while the client is too far behind, the producer should stop reading.
+ * */
+bool CgiOutput::full() const
+{
+  return _output.pendingBytes() >= MAX_PENDING_OUTPUT;
+}
+
+/*
+ * True once the client caught up enough for reading to resume.
+ * */
+bool CgiOutput::drained() const
+{
+  return _output.pendingBytes() < MAX_PENDING_OUTPUT / 2;
+}
+
+/*
+ * Bytes queued for the client and not sent yet.
+ * */
+size_t CgiOutput::pendingBytes() const
+{
+  return _output.pendingBytes();
+}
+
+/*
+ * Keeps a copy of the body as it is sent, up to limit bytes, see captured().
+ * */
+void CgiOutput::capture(size_t limit)
+{
+  _capturing = true;
+  _captureLimit = limit;
+}
+
+/*
+ * True if capture() kept the whole body.
+ * */
+bool CgiOutput::captured() const
+{
+  return _capturing;
+}
+
+/*
+ * Status code of the response, known once the head is queued.
+ * */
+int CgiOutput::status() const
+{
+  return _status != 0 ? _status : (_hasLocation ? 302 : 200);
+}
+
+/*
+ * Header lines passed on from the output, known once the head is queued.
+ * */
+const std::string& CgiOutput::headers() const
+{
+  return _headers;
+}
+
+const std::string& CgiOutput::capturedBody() const
+{
+  return _captured;
+}
+
+/*
+ * Answers with a response kept by the CgiCache, instead of output from a script.
+ * */
+void CgiOutput::sendCached(int status, const std::string& headers, SharedBuffer *body)
+{
+  _done = true;
+  _streaming = true;
+  HeaderBuilder& head = _context.headers;
+  head.status(status);
+  head.raw(headers);
+  head.header("Content-Length", static_cast<off_t>(body->data.size()));
+  sendHead();
+  _output.pushShared(body, 0, body->data.size());
+}
+
+/*
+ * Looks for the header block the output starts with (CGI/1.1 section 6.3): header
+ * lines up to an empty line, ended by LF or CRLF. Output that does not start with one
+ * is all body. Returns false while more output is needed to tell.
+ * */
+bool CgiOutput::parseHeaders(bool complete)
+{
+  size_t pos = 0;
+  size_t end;
+  while ((end = _pending.find('\n', pos)) != std::string::npos) {
+    size_t lineEnd = (end > pos && _pending[end - 1] == '\r') ? end - 1 : end;
+    if (lineEnd == pos) {
+      for (size_t line = 0; line < pos; ) {
+        size_t next = _pending.find('\n', line);
+        size_t length = (next > line && _pending[next - 1] == '\r') ? next - 1 - line : next - line;
+        addHeader(StringView(_pending.data() + line, length));
+        line = next + 1;
+      }
+      _pending.erase(0, end + 1);
+      _headersParsed = true;
+      return true;
+    }
+    size_t colon = _pending.find(':', pos);
+    if (colon == pos || colon >= lineEnd
+        || _pending.find_first_of(" \t", pos) < colon) {
+      break;
+    }
+    pos = end + 1;
+  }
+  if (end == std::string::npos && !complete && _pending.size() < OUTPUT_BUFFER_SIZE) {
+    return false;
+  }
+  _headersParsed = true; // No header block, the output is all body
+  return true;
+}
+
+/*
+ * Status sets the status code, the framing headers are the server's and dropped,
+ * the others are passed on. A Location without a Status is a redirect (302).
+ * */
+void CgiOutput::addHeader(const StringView& line)
+{
+  size_t colon = static_cast<const char*>(memchr(line.data, ':', line.length)) - line.data;
+  StringView name(line.data, colon);
+  StringView value = StringView(line.data + colon + 1, line.length - colon - 1).trim();
+  if (name.equalsIgnoreCase("Status")) {
+    int status = atoi(std::string(value.data, value.length).c_str());
+    if (status >= 100 && status <= 999) {
+      _status = status;
+    }
+    return;
+  }
+  if (name.equalsIgnoreCase("Content-Length") || name.equalsIgnoreCase("Transfer-Encoding")
+      || name.equalsIgnoreCase("Connection") || name.equalsIgnoreCase("Keep-Alive")) {
+    return;
+  }
+  if (name.equalsIgnoreCase("Content-Type")) {
+    _hasContentType = true;
+  } else if (name.equalsIgnoreCase("Location")) {
+    _hasLocation = true;
+  }
+  _headers.append(line.data, line.length);
+  _headers += "\r\n";
+}
+
+/*
+ * Queues the head and the output collected so far. complete is true once the output
+ * ended, the length is known then.
+ * */
+void CgiOutput::startOutput(bool complete)
+{
+  _streaming = true;
+  HeaderBuilder& head = _context.headers;
+  if (!_hasContentType) {
+    _headers.insert(0, "Content-Type: text/html\r\n");
+  }
+  head.status(status());
+  head.raw(_headers);
+  if (complete) {
+    head.header("Content-Length", static_cast<off_t>(_pending.size()));
+  } else if (_chunked) {
+    head.header("Transfer-Encoding", "chunked");
+    _chunkedOutput = true;
+  } else {
+    _keepAlive = false; // The body ends when the connection is closed
+  }
+  sendHead();
+  sendBody(_pending.data(), _pending.size());
+  _pending.clear();
+}
+
+void CgiOutput::sendBody(const char *data, size_t length)
+{
+  if (_capturing) {
+    if (_captured.size() + length > _captureLimit) {
+      _capturing = false;
+      std::string().swap(_captured);
+    } else {
+      _captured.append(data, length);
+    }
+  }
+  if (_chunkedOutput) {
+    _output.pushChunk(data, length);
+  } else {
+    _output.push(data, length);
+  }
+}
+
+/*
+ * Completes the head in the HeaderBuilder with Date and Connection and queues it.
+ * */
+void CgiOutput::sendHead()
+{
+  HeaderBuilder& head = _context.headers;
+  head.date();
+  head.raw(_keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+  head.end();
+  _output.push(head.data(), head.size());
+}
+
+/*
+ * Sends the error_page configured for statusCode from memory, a generated page otherwise.
+ * */
+void CgiOutput::sendErrorResponse(int statusCode)
+{
+  HeaderBuilder& head = _context.headers;
+  const ErrorPage *page = _config.getErrorPage(statusCode);
+  if (page != NULL) {
+    head.status(statusCode);
+    head.header("Content-Type", Utils::getMimeType(page->path));
+    head.header("Content-Length", static_cast<off_t>(page->body.size()));
+    sendHead();
+    _output.pushSlice(page->body.data(), page->body.size());
+    return;
+  }
+
+  char code[16];
+  snprintf(code, sizeof(code), "%d ", statusCode);
+  std::string body = "<html><body><h1>" + (code + HeaderBuilder::reasonPhrase(statusCode).str()) + "</h1>";
+  body += "<p>CGI Script Execution Failed</p></body></html>";
+  head.status(statusCode);
+  head.header("Content-Type", "text/html");
+  head.header("Content-Length", static_cast<off_t>(body.size()));
+  sendHead();
+  _output.push(body);
+}
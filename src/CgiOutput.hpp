@@ -0,0 +1,72 @@
+#ifndef CGIOUTPUT_HPP
+#define CGIOUTPUT_HPP
+
+#include <string>
+#include "Config.hpp"
+#include "OutputQueue.hpp"
+#include "ServerContext.hpp"
+#include "StringView.hpp"
+#include "SharedBuffer.hpp"
+
+/*
+ * Turns the output of a CGI script or a FastCGI application into the HTTP response
+ * queued for the client, as the output arrives.
+ */
+class CgiOutput {
+public:
+  // Output up to this size is sent with a Content-Length, longer output is streamed
+  static const size_t OUTPUT_BUFFER_SIZE = 16384;
+  // Reading stops while this much output waits for the client, it resumes below half of it
+  static const size_t MAX_PENDING_OUTPUT = 256 * 1024;
+
+  CgiOutput(const Config& config, OutputQueue& output, ServerContext& context);
+
+  void setKeepAlive(bool keepAlive);
+  void setChunked(bool chunked);
+  void setNph(bool nph);
+  bool keepAlive() const;
+  void write(const char *data, size_t length);
+  void finish(int errorStatus);
+  bool done() const;
+  bool full() const;
+  bool drained() const;
+  size_t pendingBytes() const;
+  void capture(size_t limit);
+  bool captured() const;
+  int status() const;
+  const std::string& headers() const;
+  const std::string& capturedBody() const;
+  void sendCached(int status, const std::string& headers, SharedBuffer *body);
+
+private:
+  const Config& _config;
+  OutputQueue& _output;
+  ServerContext& _context;
+  bool _keepAlive;
+  bool _chunked;        // The client understands Transfer-Encoding: chunked
+  bool _streaming;      // The head is queued, output is passed on as it arrives
+  bool _chunkedOutput;  // The body is framed as chunks
+  bool _done;
+  bool _headersParsed;  // The header block of the output is known (possibly empty)
+  bool _nph;            // The output is the whole HTTP response, passed on as it is
+  int _status;          // From the Status header, 0 if there is none
+  bool _hasContentType;
+  bool _hasLocation;
+  std::string _headers; // Header lines from the script to pass on, CRLF terminated
+  std::string _pending; // Output received before the head was queued
+  bool _capturing;      // A copy of the body is kept for the CgiCache
+  size_t _captureLimit;
+  std::string _captured;
+
+  bool parseHeaders(bool complete);
+  void addHeader(const StringView& line);
+  void startOutput(bool complete);
+  void sendBody(const char *data, size_t length);
+  void sendHead();
+  void sendErrorResponse(int statusCode);
+
+  CgiOutput(const CgiOutput&);
+  CgiOutput& operator=(const CgiOutput&);
+};
+
+#endif // CGIOUTPUT_HPP
@@ -0,0 +1,207 @@
+#include "ChunkedDecoder.hpp"
+
+namespace
+{
+  int hexValue(char c)
+  {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+    return -1;
+  }
+}
+
+/*
+ * ChunkedDecoder follows the chunked framing of RFC 9112: each chunk is a hex size line,
+ * the data and a line end, a zero size ends the body and is followed by optional trailer
+ * fields and an empty line. Like HttpParser, a bare LF is accepted as a line end.
+ * Framing bytes go through step() one at a time, chunk data is handed out in runs.
+ * */
+ChunkedDecoder::ChunkedDecoder()
+{
+  reset();
+}
+
+void ChunkedDecoder::reset()
+{
+  _state = STATE_SIZE_START;
+  _status = CHUNKED_INCOMPLETE;
+  _errorStatus = 0;
+  _remaining = 0;
+  _lineLength = 0;
+  _trailerLength = 0;
+}
+
+/*
+ * Consumes framing bytes until chunk data, the end of the body or the end of the input.
+ * Returns the number of bytes used, the last *payloadLength of them are chunk data
+ * starting at *payload (0 if the call ended on framing). Call again with the rest.
+ * */
+size_t ChunkedDecoder::decode(const char *data, size_t length, const char **payload, size_t *payloadLength)
+{
+  *payload = NULL;
+  *payloadLength = 0;
+  size_t pos = 0;
+  while (pos < length && _status == CHUNKED_INCOMPLETE) {
+    if (_state == STATE_DATA) {
+      size_t run = length - pos < _remaining ? length - pos : _remaining;
+      *payload = data + pos;
+      *payloadLength = run;
+      _remaining -= run;
+      if (_remaining == 0) {
+        _state = STATE_DATA_CR;
+      }
+      return pos + run;
+    }
+    step(data[pos]);
+    ++pos;
+  }
+  return pos;
+}
+
+void ChunkedDecoder::step(char c)
+{
+  if (_state <= STATE_SIZE_LF && ++_lineLength > MAX_LINE_LENGTH) {
+    fail(400);
+    return;
+  }
+  if (_state >= STATE_TRAILER_START && ++_trailerLength > MAX_TRAILER_LENGTH) {
+    fail(400);
+    return;
+  }
+
+  switch (_state) {
+    case STATE_SIZE_START:
+    case STATE_SIZE: {
+      int digit = hexValue(c);
+      if (digit >= 0) {
+        if (_remaining > (static_cast<size_t>(-1) >> 4)) {
+          fail(413);
+          return;
+        }
+        _remaining = (_remaining << 4) | digit;
+        _state = STATE_SIZE;
+        return;
+      }
+      if (_state == STATE_SIZE_START) {
+        fail(400); // The size needs at least one digit
+        return;
+      }
+    }
+      // fall through
+    case STATE_SIZE_WHITESPACE:
+      if (c == ' ' || c == '\t') {
+        _state = STATE_SIZE_WHITESPACE;
+      } else if (c == ';') {
+        _state = STATE_EXTENSION;
+      } else if (c == '\r') {
+        _state = STATE_SIZE_LF;
+      } else if (c == '\n') {
+        endSizeLine();
+      } else {
+        fail(400);
+      }
+      return;
+
+    case STATE_EXTENSION:
+      if (c == '\r') {
+        _state = STATE_SIZE_LF;
+      } else if (c == '\n') {
+        endSizeLine();
+      }
+      return;
+
+    case STATE_SIZE_LF:
+      if (c != '\n') {
+        fail(400);
+        return;
+      }
+      endSizeLine();
+      return;
+
+    case STATE_DATA:
+      return; // Handed out by decode()
+
+    case STATE_DATA_CR:
+      if (c == '\r') {
+        _state = STATE_DATA_LF;
+        return;
+      }
+      _state = STATE_DATA_LF;
+      // fall through
+    case STATE_DATA_LF:
+      if (c != '\n') {
+        fail(400);
+        return;
+      }
+      _state = STATE_SIZE_START;
+      return;
+
+    case STATE_TRAILER_START:
+      if (c == '\r') {
+        _state = STATE_END_LF;
+        return;
+      }
+      if (c == '\n') {
+        _status = CHUNKED_DONE;
+        return;
+      }
+      _state = STATE_TRAILER;
+      return;
+
+    case STATE_TRAILER:
+      if (c == '\r') {
+        _state = STATE_TRAILER_LF;
+      } else if (c == '\n') {
+        _state = STATE_TRAILER_START;
+      }
+      return;
+
+    case STATE_TRAILER_LF:
+      if (c != '\n') {
+        fail(400);
+        return;
+      }
+      _state = STATE_TRAILER_START;
+      return;
+
+    case STATE_END_LF:
+      if (c != '\n') {
+        fail(400);
+        return;
+      }
+      _status = CHUNKED_DONE;
+      return;
+  }
+}
+
+/*
+ * A zero size is the last chunk, the trailer section follows it.
+ * */
+void ChunkedDecoder::endSizeLine()
+{
+  _lineLength = 0;
+  _state = _remaining > 0 ? STATE_DATA : STATE_TRAILER_START;
+}
+
+void ChunkedDecoder::fail(int status)
+{
+  _status = CHUNKED_ERROR;
+  _errorStatus = status;
+}
+
+ChunkedDecoder::Status ChunkedDecoder::status() const
+{
+  return _status;
+}
+
+/*
+ * Returns the HTTP status to answer a malformed body with.
+ * */
+int ChunkedDecoder::errorStatus() const
+{
+  return _errorStatus;
+}
@@ -0,0 +1,58 @@
+#ifndef CHUNKEDDECODER_HPP
+#define CHUNKEDDECODER_HPP
+
+#include <cstddef>
+
+/*
+ * Resumable decoder for a request body sent with Transfer-Encoding: chunked.
+ * It is fed the received bytes span by span, chunk data is returned as pointers into
+ * the input so nothing is copied. Chunk extensions and trailer fields are skipped.
+ */
+class ChunkedDecoder {
+public:
+  enum Status {
+    CHUNKED_INCOMPLETE, // Needs more bytes
+    CHUNKED_DONE,       // The last chunk and the trailer section were read
+    CHUNKED_ERROR       // Malformed framing, see errorStatus()
+  };
+
+  // Longest chunk size line (with extensions) and trailer section accepted
+  static const size_t MAX_LINE_LENGTH = 4096;
+  static const size_t MAX_TRAILER_LENGTH = 8192;
+
+  ChunkedDecoder();
+
+  void reset();
+  size_t decode(const char *data, size_t length, const char **payload, size_t *payloadLength);
+  Status status() const;
+  int errorStatus() const;
+
+private:
+  enum State {
+    STATE_SIZE_START,
+    STATE_SIZE,
+    STATE_SIZE_WHITESPACE,
+    STATE_EXTENSION,
+    STATE_SIZE_LF,
+    STATE_DATA,
+    STATE_DATA_CR,
+    STATE_DATA_LF,
+    STATE_TRAILER_START,
+    STATE_TRAILER,
+    STATE_TRAILER_LF,
+    STATE_END_LF
+  };
+
+  State _state;
+  Status _status;
+  int _errorStatus;
+  size_t _remaining;     // Data bytes left in the current chunk
+  size_t _lineLength;    // Bytes of the current size line
+  size_t _trailerLength; // Bytes of the trailer section
+
+  void step(char c);
+  void endSizeLine();
+  void fail(int status);
+};
+
+#endif // CHUNKEDDECODER_HPP
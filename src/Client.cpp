@@ -1,119 +1,363 @@
 #include "Client.hpp"
 #include <stdlib.h>
+#include <algorithm>
+#include "Response.hpp"
+#include "CGI.hpp"
+#include "FastCgiRequest.hpp"
 
 /*
- * Manages client connections and request buffering
+ * Manages client connections, request buffering and the queue of pending output.
+ * A client may send several requests over the same connection (keep-alive),
+ * so the parse state is kept in members and cleared by reset() once a response is queued.
  * */
-Client::Client() : _socket(-1), _hasCompleteRequest(false)
+Client::Client()
+  : _socket(-1),
+    _parser(BufferPool::BLOCK_SIZE),
+    _head(NULL),
+    _hasCompleteRequest(false),
+    _headersReceived(false),
+    _bodyStartPos(0),
+    _contentLength(0),
+    _parsedBytes(0),
+    _parseError(0),
+    _peerClosed(false),
+    _readPaused(false),
+    _requestCount(0),
+    _lastActivity(time(NULL)),
+    _closeAfterOutput(false),
+    _config(NULL),
+    _upload(NULL),
+    _bodyReceived(0),
+    _chunked(false),
+    _cgi(NULL),
+    _fastcgi(NULL)
 {
   memset(&_address, 0, sizeof(_address));
+  _remoteAddress[0] = '\0';
 }
 
-Client::Client(int socket, sockaddr_in address) 
-  : _socket(socket), 
+Client::Client(int socket, sockaddr_in address, BufferPool *bufferPool, const Config *config)
+  : _socket(socket),
     _address(address),
-    _hasCompleteRequest(false)
+    _rawRequest(bufferPool),
+    _parser(BufferPool::BLOCK_SIZE),
+    _head(NULL),
+    _hasCompleteRequest(false),
+    _headersReceived(false),
+    _bodyStartPos(0),
+    _contentLength(0),
+    _parsedBytes(0),
+    _parseError(0),
+    _peerClosed(false),
+    _readPaused(false),
+    _requestCount(0),
+    _lastActivity(time(NULL)),
+    _closeAfterOutput(false),
+    _config(config),
+    _upload(NULL),
+    _bodyReceived(0),
+    _chunked(false),
+    _cgi(NULL),
+    _fastcgi(NULL)
 {
+  if (inet_ntop(AF_INET, &_address.sin_addr, _remoteAddress, sizeof(_remoteAddress)) == NULL) {
+    _remoteAddress[0] = '\0';
+  }
 }
 
 Client::~Client()
 {
+  delete _cgi;
+  delete _fastcgi;
+  delete _upload;
   if (_socket != -1) {
     close(_socket);
     _socket = -1;
   }
 }
 
+/*
+ * Reads everything the socket has (edge-triggered epoll only reports new data once).
+ * Data is handled every READ_CHUNK bytes, so a streamed upload never piles up in the buffer.
+ * Reading pauses once a complete request waits for its response: the rest stays in the
+ * kernel, so a client pipelining faster than it is answered fills its own socket buffers,
+ * not the server's memory. The Server reads on once the response is queued (see isReadPaused).
+ * A peer that closed its side may still get the answer to a request it already sent.
+ * */
 bool Client::readRequest()
 {
-  char buffer[4096];
-  size_t contentLength = 0;
-  bool headersReceived = false;
-  size_t bodyStartPos = 0;
+  _readPaused = false;
+  while (true) {
+    if (_hasCompleteRequest) {
+      _readPaused = true;
+      return true;
+    }
+    BufferChain::ReadResult result = _rawRequest.readFrom(_socket, READ_CHUNK);
+    if (result == BufferChain::READ_ERROR) {
+      return false;
+    }
+    if (result == BufferChain::READ_CLOSED) {
+      _peerClosed = true;
+    }
 
-  // Read data from the socket
-  if (!readDataFromSocket(buffer, sizeof(buffer))) {
-    return false; // Error or client disconnected
+    _lastActivity = time(NULL);
+    checkForRequest();
+    if (result != BufferChain::READ_LIMIT) {
+      return true;
+    }
   }
+}
 
-  // Process headers if not already done
-  if (!headersReceived) {
-    headersReceived = processHeaders(contentLength, bodyStartPos);
+/*
+ * Processes the headers if not already done and parses the request once
+ * the whole body has arrived. Otherwise waits for more data.
+ * */
+void Client::checkForRequest()
+{
+  if (_hasCompleteRequest) {
+    return;
   }
 
-  // Check if the request is complete
-  if (headersReceived && isRequestComplete(contentLength, bodyStartPos)) {
-    // Parse the request if complete
-    parseRequest();
-    return true; // Request is complete
+  if (!_headersReceived) {
+    _headersReceived = parseHead();
+    if (_headersReceived && !startBody()) {
+      return;
+    }
+  }
+  if (_headersReceived) {
+    feedBody();
   }
 
-  // If we've received headers but not the complete body, return and wait for more data
-  if (headersReceived && !isRequestComplete(contentLength, bodyStartPos)) {
-    return true; // More data needed
+  if (_headersReceived && !_hasCompleteRequest && isRequestComplete()) {
+    parseRequest();
   }
-  
-  // Still waiting for complete headers
-  return true;
 }
 
+/*
+ * Builds the Request from slices of the receive buffer, the body was moved out as it arrived.
+ * */
 void Client::parseRequest()
 {
-  _request = Request(_rawRequest.c_str());
+  _request = Request(_head, _parser);
+  _request.setRemoteAddress(_remoteAddress);
+  if (_upload != NULL) {
+    _upload->finish();
+    _request.setUpload(_upload);
+  } else {
+    _request.setBody(_body);
+  }
   _hasCompleteRequest = true;
+  ++_requestCount;
 }
 
-bool Client::readDataFromSocket(char *buffer, size_t bufferSize)
+/*
+ * Prepares the client for the next request on the same connection.
+ * Bytes received past the end of the current request (pipelined requests)
+ * are kept, the blocks of the answered request go back to the pool.
+ * */
+void Client::reset()
 {
-  ssize_t bytesRead = recv(_socket, buffer, bufferSize, MSG_DONTWAIT);
-
-  if (bytesRead <= 0) {
-    // Either an error occured or the client disconnected
-    close(_socket);
-    return false;
+  if (_hasCompleteRequest && _parseError == 0) {
+    // The body was already dropped from the buffer
+    _rawRequest.consume(_bodyStartPos);
+  } else {
+    _rawRequest.clear();
   }
+  delete _upload;
+  _upload = NULL;
+  _body.clear();
+  _bodyReceived = 0;
+  _chunked = false;
+  _chunkedDecoder.reset();
 
-  // Append the received data tp _rawRequest
-  _rawRequest.append(buffer, bytesRead);
-  return true;
+  _request = Request();
+  _hasCompleteRequest = false;
+  _headersReceived = false;
+  _bodyStartPos = 0;
+  _contentLength = 0;
+  _parser.reset();
+  _head = NULL;
+  _parsedBytes = 0;
+  _lastActivity = time(NULL);
+
+  // A pipelined request may already be complete
+  checkForRequest();
 }
 
-bool Client::processHeaders(size_t &bodyStartPos, size_t &contentLength)
+/*
+ * Writes as much of the queued response as the socket accepts.
+ * */
+OutputQueue::FlushResult Client::flushOutput()
 {
-  size_t headerEndPos = _rawRequest.find("\r\n\r\n");
-  if (headerEndPos == std::string::npos) {
+  size_t pending = _output.pendingBytes();
+  OutputQueue::FlushResult result = _output.flush(_socket);
+  if (_output.pendingBytes() != pending) {
+    _lastActivity = time(NULL);
+  }
+  return result;
+}
+
+/*
+ * Feeds the bytes received since the last call to the parser, span by span.
+ * The head must fit in one receive block, the parser answers 431 otherwise.
+ * A malformed head completes the request with an error status for the Server to send.
+ * */
+bool Client::parseHead()
+{
+  while (_parser.status() == HttpParser::PARSE_INCOMPLETE && _parsedBytes < _rawRequest.size()) {
+    const char *data;
+    size_t span = _rawRequest.spanAt(_parsedBytes, &data);
+    _parser.parse(data, span);
+    _parsedBytes = _parser.headLength();
+  }
+
+  if (_parser.status() == HttpParser::PARSE_ERROR) {
+    _parseError = _parser.errorStatus();
+    _hasCompleteRequest = true;
+    return false;
+  }
+  if (_parser.status() != HttpParser::PARSE_DONE) {
     return false; // Headers not fully received
   }
 
-  // Headers are fully received
-  bodyStartPos = headerEndPos + 4; // Skip "\r\n\r\n"
-  
-  // Extract Content-Length
-  size_t contentPos = _rawRequest.find("Content-Length: ");
-  if (contentPos != std::string::npos) {
-    contentPos += 16; // Move past "Content-Type: "
-    size_t endPos = _rawRequest.find("\r\n", contentPos);
-    if (endPos != std::string::npos) {
-      std::string contentLengthStr = _rawRequest.substr(contentPos, endPos - contentPos);
-      contentLength = std::strtol(contentLengthStr.c_str(), NULL, 10);
-    }
+  // Slices of the Request point into the head, which must not straddle two blocks
+  char *head = _rawRequest.makeContiguous(_parser.headLength());
+  _head = head;
+  _bodyStartPos = _parser.headLength();
+  _contentLength = _parser.hasContentLength() ? _parser.contentLength() : 0;
+
+  // Routes and file paths only ever see the normalized path
+  if (_parser.normalizeUrl(head)) {
+    _parseError = _parser.transferEncodingError(_head, _chunked);
   } else {
-    contentLength = 0; // No Content-Length header
+    _parseError = _parser.errorStatus();
+  }
+  if (_parseError) {
+    _hasCompleteRequest = true;
+    return false;
   }
-  
   return true; // Headers processed
 }
 
-bool Client::isRequestComplete(size_t bodyStartPos, size_t contentLength)
+/*
+ * Decides where the body goes once the head is parsed. Bodies over client_max_body_size
+ * are answered with 413 before any of them is read. Multipart uploads to the upload handler
+ * are written to disk while they arrive (see Response::streamsBody), other bodies are kept
+ * in memory up to client_body_buffer_size and spooled to a temporary file beyond it.
+ * Returns false if the request is answered with an error instead.
+ * */
+bool Client::startBody()
 {
-  if (contentLength == 0) {
-    // No body expected, request is complete
+  if (_config == NULL || (_contentLength == 0 && !_chunked)) {
     return true;
   }
+  if (_config->getClientMaxBodySize() > 0 && _contentLength > _config->getClientMaxBodySize()) {
+    _parseError = 413;
+    _hasCompleteRequest = true;
+    return false;
+  }
+
+  Request request(_head, _parser);
+  const Route *route = _config->getRoute(request.getPath());
+  std::string boundary;
+  if (Response::streamsBody(request, route)
+      && MultipartParser::boundaryFrom(request.getHeader(HEADER_CONTENT_TYPE), boundary)) {
+    _upload = new MultipartParser(boundary, _config->getUploadsDir(*route));
+  } else {
+    _body.spoolAbove(_config->getClientBodyBufferSize(), _config->getClientBodyTempPath());
+  }
+  return true;
+}
+
+/*
+ * Moves the body bytes received so far out of the receive buffer, into the upload parser
+ * or the RequestBody, so the buffer holds at most one read of the body.
+ * */
+void Client::feedBody()
+{
+  size_t available = _rawRequest.size() - _bodyStartPos;
+  if (_chunked) {
+    _rawRequest.erase(_bodyStartPos, feedChunked(available));
+    return;
+  }
 
-  // Check if the entire body has been received
-  size_t currentBodySize = _rawRequest.size() - bodyStartPos;
-  return currentBodySize >= contentLength;
+  size_t length = std::min(available, _contentLength - _bodyReceived);
+  size_t fed = 0;
+  while (fed < length) {
+    const char *data;
+    size_t span = _rawRequest.spanAt(_bodyStartPos + fed, &data);
+    span = std::min(span, length - fed);
+    if (!passBody(data, span)) {
+      return;
+    }
+    fed += span;
+  }
+  _rawRequest.erase(_bodyStartPos, length);
+  _bodyReceived += length;
+}
+
+/*
+ * Decodes up to length bytes of chunked body and returns how many of them were framing
+ * or data, the bytes after the last chunk belong to the next request. The decoded size
+ * is checked against client_max_body_size as it grows, since no Content-Length announced it.
+ * */
+size_t Client::feedChunked(size_t length)
+{
+  size_t used = 0;
+  while (used < length && _chunkedDecoder.status() == ChunkedDecoder::CHUNKED_INCOMPLETE) {
+    const char *data;
+    size_t span = _rawRequest.spanAt(_bodyStartPos + used, &data);
+    span = std::min(span, length - used);
+    size_t pos = 0;
+    while (pos < span && _chunkedDecoder.status() == ChunkedDecoder::CHUNKED_INCOMPLETE) {
+      const char *payload;
+      size_t payloadLength;
+      pos += _chunkedDecoder.decode(data + pos, span - pos, &payload, &payloadLength);
+      if (payloadLength == 0) {
+        continue;
+      }
+      _bodyReceived += payloadLength;
+      if (_config != NULL && _config->getClientMaxBodySize() > 0
+          && _bodyReceived > _config->getClientMaxBodySize()) {
+        _parseError = 413;
+        _hasCompleteRequest = true;
+        return used + pos;
+      }
+      if (!passBody(payload, payloadLength)) {
+        return used + pos;
+      }
+    }
+    used += pos;
+  }
+  if (_chunkedDecoder.status() == ChunkedDecoder::CHUNKED_ERROR) {
+    _parseError = _chunkedDecoder.errorStatus();
+    _hasCompleteRequest = true;
+  }
+  return used;
+}
+
+/*
+ * Hands decoded body bytes to the upload parser or the RequestBody.
+ * A failed write to the spool file answers the request with 500.
+ * */
+bool Client::passBody(const char *data, size_t length)
+{
+  if (_upload != NULL) {
+    _upload->feed(data, length);
+  } else if (!_body.append(data, length)) {
+    _parseError = 500;
+    _hasCompleteRequest = true;
+    return false;
+  }
+  return true;
+}
+
+bool Client::isRequestComplete() const
+{
+  if (_chunked) {
+    return _chunkedDecoder.status() == ChunkedDecoder::CHUNKED_DONE;
+  }
+  return _bodyReceived == _contentLength;
 }
 
 int Client::getSocket() const
@@ -126,8 +370,108 @@ bool Client::hasCompleteRequest() const
   return _hasCompleteRequest;
 }
 
-Request Client::getRequest() const
+const Request& Client::getRequest() const
 {
   return _request;
 }
 
+/*
+ * The connection is kept open if the request allows it
+ * and the per-connection request limit is not reached yet.
+ * */
+bool Client::shouldKeepAlive(int maxRequests) const
+{
+  if (maxRequests > 0 && _requestCount >= maxRequests) {
+    return false;
+  }
+  return _request.isKeepAlive();
+}
+
+time_t Client::getLastActivity() const
+{
+  return _lastActivity;
+}
+
+OutputQueue& Client::getOutput()
+{
+  return _output;
+}
+
+/*
+ * Marks the connection to be closed once the queued output is sent.
+ * */
+void Client::closeAfterOutput()
+{
+  _closeAfterOutput = true;
+}
+
+bool Client::isClosing() const
+{
+  return _closeAfterOutput;
+}
+
+bool Client::isPeerClosed() const
+{
+  return _peerClosed;
+}
+
+/*
+ * True for a connection that was answered and waits for its next request: nothing of it
+ * is received yet and all output was sent. Only then keepalive_timeout applies.
+ * */
+bool Client::isBetweenRequests() const
+{
+  return _requestCount > 0 && !_headersReceived && !_hasCompleteRequest
+      && _rawRequest.empty() && _output.empty();
+}
+
+/*
+ * True if readRequest() stopped before the socket was drained, it must be called again
+ * once the pending request is answered since no new EPOLLIN reports the bytes left.
+ * */
+bool Client::isReadPaused() const
+{
+  return _readPaused;
+}
+
+/*
+ * Returns the HTTP status to answer a malformed request with, 0 if the request is valid.
+ * */
+int Client::getParseError() const
+{
+  return _parseError;
+}
+
+/*
+ * Keeps the CGI script that answers the current request until its response is complete.
+ * */
+void Client::setCgi(CGI *cgi)
+{
+  _cgi = cgi;
+}
+
+CGI *Client::getCgi() const
+{
+  return _cgi;
+}
+
+void Client::setFastCgi(FastCgiRequest *request)
+{
+  _fastcgi = request;
+}
+
+FastCgiRequest *Client::getFastCgi() const
+{
+  return _fastcgi;
+}
+
+/*
+ * Drops the script or FastCGI request once its response is queued.
+ * */
+void Client::endCgi()
+{
+  delete _cgi;
+  _cgi = NULL;
+  delete _fastcgi;
+  _fastcgi = NULL;
+}
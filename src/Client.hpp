@@ -4,34 +4,93 @@
 #include <iostream>
 #include <string>
 #include <cstring>
+#include <ctime>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <unistd.h>
 #include <errno.h>
 #include "Request.hpp"
+#include "OutputQueue.hpp"
+#include "BufferChain.hpp"
+#include "HttpParser.hpp"
+#include "Config.hpp"
+#include "MultipartParser.hpp"
+#include "RequestBody.hpp"
+#include "ChunkedDecoder.hpp"
+
+class CGI;
+class FastCgiRequest;
 
 class Client {
 private:
+  static const size_t READ_CHUNK = 4 * BufferPool::BLOCK_SIZE;
+
   int _socket;
   sockaddr_in _address;
-  std::string _rawRequest;
+  char _remoteAddress[INET_ADDRSTRLEN]; // _address as text, for REMOTE_ADDR
+  BufferChain _rawRequest;
+  HttpParser _parser;
+  const char *_head;
   Request _request;
   bool _hasCompleteRequest;
-  bool processHeaders(size_t &bodyStartPos, size_t &contentLength);
-  bool readDataFromSocket(char *buffer, size_t bufferSize);
+  bool _headersReceived;
+  size_t _bodyStartPos;
+  size_t _contentLength;
+  size_t _parsedBytes;
+  int _parseError;
+  bool _peerClosed;
+  bool _readPaused;         // The socket was left unread behind a complete request
+  int _requestCount;
+  time_t _lastActivity;
+  OutputQueue _output;
+  bool _closeAfterOutput;
+  const Config *_config;
+  MultipartParser *_upload; // Set while a multipart upload is streamed to disk
+  RequestBody _body;
+  size_t _bodyReceived;     // Body bytes already moved to _upload or _body
+  bool _chunked;            // Transfer-Encoding: chunked, the body ends with the last chunk
+  ChunkedDecoder _chunkedDecoder;
+  CGI *_cgi;                // Script answering the current request, NULL when none runs
+  FastCgiRequest *_fastcgi; // Or the FastCGI application doing it
+  bool parseHead();
   void parseRequest();
-  bool isRequestComplete(size_t bodyStartPos, size_t contentLength);
+  bool isRequestComplete() const;
+  void checkForRequest();
+  bool startBody();
+  void feedBody();
+  size_t feedChunked(size_t length);
+  bool passBody(const char *data, size_t length);
 
 
+  Client(const Client&);
+  Client& operator=(const Client&);
+
 public:
   Client();
-  Client(int socket, sockaddr_in address);
+  Client(int socket, sockaddr_in address, BufferPool *bufferPool = NULL, const Config *config = NULL);
   ~Client();
-  
+
   bool readRequest();
+  OutputQueue::FlushResult flushOutput();
+  void reset();
   int getSocket() const;
   bool hasCompleteRequest() const;
-  Request getRequest() const;
+  const Request& getRequest() const;
+  bool shouldKeepAlive(int maxRequests) const;
+  time_t getLastActivity() const;
+  OutputQueue& getOutput();
+  void closeAfterOutput();
+  bool isClosing() const;
+  bool isPeerClosed() const;
+  bool isReadPaused() const;
+  bool isBetweenRequests() const;
+  int getParseError() const;
+  void setCgi(CGI *cgi);
+  CGI *getCgi() const;
+  void setFastCgi(FastCgiRequest *request);
+  FastCgiRequest *getFastCgi() const;
+  void endCgi();
 };
 
 #endif // CLIENT_HPP
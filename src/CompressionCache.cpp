@@ -0,0 +1,118 @@
+#include "CompressionCache.hpp"
+#include <zlib.h>
+#include <cstring>
+
+/*
+ * CompressionCache keeps the gzip variant of text files so each file is compressed once
+ * per worker instead of once per request. Entries follow the FileCache generation of the
+ * file they were made from and are dropped when the file changes, the least recently used
+ * one goes first once the budget is reached. Buffers are refcounted, a response still being
+ * sent keeps its copy alive after eviction.
+ * */
+CompressionCache::CompressionCache(size_t budget, int level)
+  : _budget(budget), _level(level), _used(0)
+{
+  if (_level < 1 || _level > 9) {
+    _level = Z_DEFAULT_COMPRESSION;
+  }
+}
+
+CompressionCache::~CompressionCache()
+{
+  while (!_entries.empty()) {
+    erase(_entries.begin());
+  }
+}
+
+/*
+ * Text formats shrink well, images and archives are already compressed.
+ * */
+bool CompressionCache::compressible(const StringView& mimeType)
+{
+  return mimeType.startsWith("text/")
+      || mimeType == "application/javascript"
+      || mimeType == "application/json"
+      || mimeType == "application/xml"
+      || mimeType == "image/svg+xml";
+}
+
+/*
+ * Compresses data into a gzip stream (RFC 1952). Returns false if zlib fails.
+ * */
+bool CompressionCache::gzip(const std::string& data, int level, std::string& compressed)
+{
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // 15 window bits, +16 for a gzip header and trailer instead of zlib's
+  if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  compressed.resize(deflateBound(&stream, data.size()));
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+  stream.avail_out = compressed.size();
+
+  int result = deflate(&stream, Z_FINISH);
+  compressed.resize(stream.total_out);
+  deflateEnd(&stream);
+  return result == Z_STREAM_END;
+}
+
+/*
+ * Returns the compressed copy of file, NULL if there is none for its current version.
+ * */
+SharedBuffer *CompressionCache::lookup(const FileCache::Entry& file)
+{
+  EntryMap::iterator it = _entries.find(file.path);
+  if (it == _entries.end()) {
+    return NULL;
+  }
+  if (it->second.generation != file.generation) {
+    erase(it);
+    return NULL;
+  }
+  _lru.splice(_lru.begin(), _lru, it->second.lru);
+  return it->second.data;
+}
+
+/*
+ * Stores the compressed copy of file, unless it is larger than the whole budget.
+ * The caller holds one reference to the returned buffer and must release() it.
+ * */
+SharedBuffer *CompressionCache::insert(const FileCache::Entry& file, const std::string& compressed)
+{
+  SharedBuffer *data = new SharedBuffer(compressed);
+  if (compressed.size() > _budget) {
+    return data;
+  }
+  EntryMap::iterator existing = _entries.find(file.path);
+  if (existing != _entries.end()) {
+    erase(existing);
+  }
+  while (_used + compressed.size() > _budget) {
+    erase(_entries.find(_lru.back()));
+  }
+
+  Entry& entry = _entries[file.path];
+  entry.data = data;
+  entry.data->retain();
+  entry.generation = file.generation;
+  _lru.push_front(file.path);
+  entry.lru = _lru.begin();
+  _used += compressed.size();
+  return data;
+}
+
+void CompressionCache::erase(EntryMap::iterator it)
+{
+  _used -= it->second.data->data.size();
+  it->second.data->release();
+  _lru.erase(it->second.lru);
+  _entries.erase(it);
+}
+
+int CompressionCache::level() const
+{
+  return _level;
+}
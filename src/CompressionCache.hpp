@@ -0,0 +1,46 @@
+#ifndef COMPRESSIONCACHE_HPP
+#define COMPRESSIONCACHE_HPP
+
+#include <string>
+#include <map>
+#include <list>
+#include "FileCache.hpp"
+#include "SharedBuffer.hpp"
+#include "StringView.hpp"
+
+/*
+ * gzip-compressed copies of static files, kept in memory within a byte budget.
+ */
+class CompressionCache {
+public:
+  CompressionCache(size_t budget, int level);
+  ~CompressionCache();
+
+  static bool compressible(const StringView& mimeType);
+  static bool gzip(const std::string& data, int level, std::string& compressed);
+
+  SharedBuffer *lookup(const FileCache::Entry& file);
+  SharedBuffer *insert(const FileCache::Entry& file, const std::string& compressed);
+  int level() const;
+
+private:
+  struct Entry {
+    SharedBuffer *data;
+    unsigned long generation; // FileCache generation the data was compressed from
+    std::list<std::string>::iterator lru;
+  };
+  typedef std::map<std::string, Entry> EntryMap;
+
+  size_t _budget;
+  int _level;
+  size_t _used;
+  EntryMap _entries;
+  std::list<std::string> _lru; // Most recently used first
+
+  CompressionCache(const CompressionCache&);
+  CompressionCache& operator=(const CompressionCache&);
+
+  void erase(EntryMap::iterator it);
+};
+
+#endif // COMPRESSIONCACHE_HPP
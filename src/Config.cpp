@@ -2,6 +2,7 @@
 #include "Utils.hpp"
 #include <fstream>
 #include <sstream>
+#include <unistd.h>
 
 /*
  * Manages server configuration.
@@ -10,28 +11,111 @@
  *   - Server name: localhost
  *   - Document root: www
  *   - Uploads directory: www/uploads
- *   - Routes: empty
+ *   - Keep-alive timeout: 15 seconds an answered connection may wait for its next request
+ *     (0 disables persistent connections)
+ *   - Keep-alive requests: 100 requests per connection
+ *   - Client timeout: 60 seconds (a client that sends or takes nothing for that long while it
+ *     waits for its first request, sends one or receives a response is dropped)
+ *   - Worker threads: 1 (each worker runs its own event loop, "auto" uses one per CPU)
+ *   - Worker processes: 1 (more than 1 forks workers supervised by a master process, "auto" uses one per CPU)
+ *   - Worker CPU affinity: off (on pins worker N to CPU N)
+ *   - Open file cache: 1000 open files per worker (0 disables it)
+ *   - Open file cache validity: 60 seconds (files in directories inotify can't watch are checked again after that)
+ *   - Response cache: 8m of serialized responses per worker (0 disables it), for files up to 64k
+ *   - Asset pack: none (a pack built by tools/pack_assets is served before the document root)
+ *   - Compression: on, .br and .gz sidecars are preferred, text files from 256 bytes are gzipped
+ *     at level 6 and 16m of compressed copies are kept per worker
+ *   - MIME types: built-in table of common web types (mime_types loads a mime.types file instead)
+ *   - Error pages: generated (error_page sends a file instead, it is read once at startup)
+ *   - Request bodies: up to 1m (0 removes the limit, larger ones get 413 before they are read),
+ *     kept in memory up to 16k and spooled to an unlinked file in /tmp beyond that
+ *   - CGI timeout: 30 seconds (a script that writes no output for that long is killed)
+ *   - CGI cache: off (cgi_cache caches the GET output of matching scripts), 4m per worker
+ *   - FastCGI: no application (fastcgi_pass sends matching paths to one), up to 8 connections
+ *     per application and worker and 128 requests waiting for a free one (503 beyond that)
+ *   - Routes: the built-in ones below
  *   - Routes are defined in a config file with the following format:
  *      port=8080
  *      server_name=localhost
  *      document_root=www
  *      uploads_dir=www/uploads
- *      route=/uploads:www/uploads:POST
- *      route=/api/ *:www/api:GET,POST
- *   - Each route is defined by a path, a destination directory, and a list of allowed methods.
- *   - The path can contain a wildcard '*' at the end for prefix matching.
- *   - The destination directory is relative to the document root.
- *   - The list of allowed methods is comma-separated.
- *   - If no route matches a request, the default route is used (path='/', destination=document_root, methods='GET').
+ *      keepalive_timeout=15
+ *      keepalive_requests=100
+ *      client_timeout=60
+ *      worker_threads=auto
+ *      worker_processes=4
+ *      worker_cpu_affinity=on
+ *      open_file_cache=1000
+ *      open_file_cache_valid=60
+ *      response_cache_size=8m
+ *      response_cache_max_file=64k
+ *      asset_pack=www.pack
+ *      gzip=on
+ *      gzip_comp_level=6
+ *      gzip_min_length=256
+ *      gzip_cache_size=16m
+ *      mime_types=/etc/mime.types
+ *      error_page=404:www/errors/404.html
+ *      error_page=500,502,503:www/errors/50x.html
+ *      client_max_body_size=1m
+ *      client_body_buffer_size=16k
+ *      client_body_temp_path=/tmp
+ *      cgi_timeout=30
+ *      cgi_cache=/cgi-bin/report.py:10
+ *      cgi_cache=/cgi-bin/i18n/ *:60:Accept-Language,Cookie
+ *      cgi_cache_size=4m
+ *      fastcgi_pass=/app/ *:unix:/run/app.sock
+ *      fastcgi_pass=/api/ *:127.0.0.1:9000
+ *      fastcgi_connections=8
+ *      fastcgi_queue=128
+ *      route=/files/ *:/srv/files:GET,DELETE
+ *      route=/incoming:/srv/incoming:POST:upload
+ *      route=/scripts/ *::GET,POST:cgi
+ *      route=/old/ *:/new/:GET:redirect
+ *   - Each route is defined by a path, a destination, a list of allowed methods and optionally
+ *     a handler: static (the default), upload, cgi or redirect.
+ *   - The path can contain a wildcard '*' at the end for prefix matching. An exact route wins,
+ *     then the prefix route with the longest path.
+ *   - Request paths are matched once normalized: "//", "." and ".." segments are resolved
+ *     (also when percent-encoded), a path climbing above / gets 400.
+ *   - The destination directory replaces the matched path: /files/a.txt is /srv/files/a.txt.
+ *     Without one, files and scripts are found in the document root and uploads go to uploads_dir.
+ *     A redirect route sends 301 to the destination followed by the rest of the path.
+ *   - The list of allowed methods is comma-separated (ALL allows every method), other methods
+ *     get 405 with an Allow header.
+ *   - Built-in routes: / * serves the document root (GET, DELETE), /upload takes uploads (POST)
+ *     and /cgi-bin/ * runs CGI scripts (GET, POST). A route with the same path replaces them.
+ *   - fastcgi_pass takes a path like a route and the address of the application after the
+ *     first ':', a unix socket or host:port. Matching requests of any method go there, it is
+ *     a route like the others and replaces one with the same path.
+ *   - cgi_cache takes a path like a route, the seconds to keep output that has no Cache-Control
+ *     max-age or Expires (0 keeps only such output) and optionally the request headers the
+ *     output depends on. The path and query string are always part of the key.
  *   - The config file is loaded in the constructor.
  *   - The config file is optional. If not found, default values are used.
  * */
-Config::Config() : _port(8080), _serverName("localhost"), _documentRoot("www"), _uploadsDir("www/uploads")
+Config::Config() : _port(8080), _serverName("localhost"), _documentRoot("www"), _uploadsDir("www/uploads"),
+  _keepaliveTimeout(15), _keepaliveRequests(100), _clientTimeout(60),
+  _workerThreads(1), _workerProcesses(1), _workerCpuAffinity(false),
+  _openFileCache(1000), _openFileCacheValid(60),
+  _responseCacheSize(8 * 1024 * 1024), _responseCacheMaxFile(64 * 1024),
+  _gzip(true), _gzipCompLevel(6), _gzipMinLength(256), _gzipCacheSize(16 * 1024 * 1024),
+  _clientMaxBodySize(1024 * 1024), _clientBodyBufferSize(16 * 1024), _clientBodyTempPath("/tmp"),
+  _cgiTimeout(30), _fastcgiConnections(8), _fastcgiQueue(128), _cgiCacheSize(4 * 1024 * 1024)
 {
+  addDefaultRoutes();
 }
 
-Config::Config(const std::string& configFile) : _port(8080), _serverName("localhost"), _documentRoot("www"), _uploadsDir("www/uploads")
+Config::Config(const std::string& configFile) : _port(8080), _serverName("localhost"), _documentRoot("www"), _uploadsDir("www/uploads"),
+  _keepaliveTimeout(15), _keepaliveRequests(100), _clientTimeout(60),
+  _workerThreads(1), _workerProcesses(1), _workerCpuAffinity(false),
+  _openFileCache(1000), _openFileCacheValid(60),
+  _responseCacheSize(8 * 1024 * 1024), _responseCacheMaxFile(64 * 1024),
+  _gzip(true), _gzipCompLevel(6), _gzipMinLength(256), _gzipCacheSize(16 * 1024 * 1024),
+  _clientMaxBodySize(1024 * 1024), _clientBodyBufferSize(16 * 1024), _clientBodyTempPath("/tmp"),
+  _cgiTimeout(30), _fastcgiConnections(8), _fastcgiQueue(128), _cgiCacheSize(4 * 1024 * 1024)
 {
+  addDefaultRoutes();
   loadFromFile(configFile);
 }
 
@@ -64,6 +148,58 @@ void Config::loadFromFile(const std::string& configFile)
         _documentRoot = value;
       } else if (key == "uploads_dir") {
         _uploadsDir = value;
+      } else if (key == "keepalive_timeout") {
+        _keepaliveTimeout = Utils::stringToInt(value.c_str());
+      } else if (key == "keepalive_requests") {
+        _keepaliveRequests = Utils::stringToInt(value.c_str());
+      } else if (key == "client_timeout") {
+        _clientTimeout = Utils::stringToInt(value.c_str());
+      } else if (key == "worker_threads") {
+        _workerThreads = parseWorkerCount(value);
+      } else if (key == "worker_processes") {
+        _workerProcesses = parseWorkerCount(value);
+      } else if (key == "worker_cpu_affinity") {
+        _workerCpuAffinity = (value == "on");
+      } else if (key == "open_file_cache") {
+        _openFileCache = Utils::stringToInt(value.c_str());
+      } else if (key == "open_file_cache_valid") {
+        _openFileCacheValid = Utils::stringToInt(value.c_str());
+      } else if (key == "response_cache_size") {
+        _responseCacheSize = parseSize(value);
+      } else if (key == "response_cache_max_file") {
+        _responseCacheMaxFile = parseSize(value);
+      } else if (key == "asset_pack") {
+        _assetPack = value;
+      } else if (key == "gzip") {
+        _gzip = (value == "on");
+      } else if (key == "gzip_comp_level") {
+        _gzipCompLevel = Utils::stringToInt(value.c_str());
+      } else if (key == "gzip_min_length") {
+        _gzipMinLength = parseSize(value);
+      } else if (key == "gzip_cache_size") {
+        _gzipCacheSize = parseSize(value);
+      } else if (key == "client_max_body_size") {
+        _clientMaxBodySize = parseSize(value);
+      } else if (key == "client_body_buffer_size") {
+        _clientBodyBufferSize = parseSize(value);
+      } else if (key == "client_body_temp_path") {
+        _clientBodyTempPath = value;
+      } else if (key == "cgi_timeout") {
+        _cgiTimeout = Utils::stringToInt(value.c_str());
+      } else if (key == "fastcgi_connections") {
+        _fastcgiConnections = Utils::stringToInt(value.c_str());
+      } else if (key == "fastcgi_queue") {
+        _fastcgiQueue = Utils::stringToInt(value.c_str());
+      } else if (key == "fastcgi_pass") {
+        parseFastcgiPass(value);
+      } else if (key == "cgi_cache") {
+        parseCgiCache(value);
+      } else if (key == "cgi_cache_size") {
+        _cgiCacheSize = parseSize(value);
+      } else if (key == "mime_types") {
+        _mimeTypes = value;
+      } else if (key == "error_page") {
+        parseErrorPage(value);
       } else if (key == "route") {
         parseRoute(value);
       }
@@ -71,28 +207,178 @@ void Config::loadFromFile(const std::string& configFile)
   }
 }
 
+/*
+ * Parses "path:destination:methods" with an optional ":handler" (static, upload, cgi or
+ * redirect, static by default), for example "/old/ *:https://example.com/new/:GET:redirect".
+ * The destination may contain ':', the methods and the handler are taken from the end.
+ * */
 void Config::parseRoute(const std::string& routeConfig)
 {
-  // Format: path:destination:methods
-  std::istringstream iss(routeConfig);
-  std::string path, destination, methodList;
-  
+  size_t first = routeConfig.find(':');
+  size_t last = routeConfig.rfind(':');
+  if (first == std::string::npos || first == last) {
+    std::cerr << "Warning: Invalid route: " << routeConfig << "\n";
+    return;
+  }
+
+  Route route;
+  route.path = trim(routeConfig.substr(0, first));
+  std::string handler = trim(routeConfig.substr(last + 1));
+  if (handler == "static" || handler == "upload" || handler == "cgi" || handler == "redirect") {
+    route.handler = handler == "upload" ? ROUTE_UPLOAD
+                    : handler == "cgi" ? ROUTE_CGI
+                    : handler == "redirect" ? ROUTE_REDIRECT : ROUTE_STATIC;
+    std::string rest = routeConfig.substr(0, last);
+    last = rest.rfind(':');
+    if (last == first) {
+      std::cerr << "Warning: Invalid route: " << routeConfig << "\n";
+      return;
+    }
+  }
+  size_t methodsEnd = routeConfig.find(':', last + 1);
+  route.destination = trim(routeConfig.substr(first + 1, last - first - 1));
+  route.methods = Route::parseMethods(routeConfig.substr(last + 1, methodsEnd == std::string::npos
+                                                                   ? std::string::npos : methodsEnd - last - 1));
+  if (route.path.empty() || route.path[0] != '/' || route.methods == 0
+      || (route.handler == ROUTE_REDIRECT && route.destination.empty())) {
+    std::cerr << "Warning: Invalid route: " << routeConfig << "\n";
+    return;
+  }
+  _router.add(route);
+}
+
+/*
+ * Parses "/app/ *:unix:/run/app.sock" or "/api/ *:127.0.0.1:9000", the address is
+ * everything after the first ':'.
+ * */
+void Config::parseFastcgiPass(const std::string& value)
+{
+  size_t colon = value.find(':');
+  if (colon == std::string::npos || colon + 1 == value.size()) {
+    std::cerr << "Warning: Invalid fastcgi_pass: " << value << "\n";
+    return;
+  }
+  Route route;
+  route.path = trim(value.substr(0, colon));
+  route.handler = ROUTE_FASTCGI;
+  route.fastcgiPass = trim(value.substr(colon + 1));
+  route.methods = METHOD_ALL;
+  _router.add(route);
+}
+
+/*
+ * Routes used when the config file has none for their paths: files from the document
+ * root, multipart uploads to /upload and CGI scripts below /cgi-bin/.
+ * */
+void Config::addDefaultRoutes()
+{
+  Route files;
+  files.path = "/*";
+  files.methods = METHOD_GET | METHOD_DELETE;
+  _router.add(files);
+
+  Route upload;
+  upload.path = "/upload";
+  upload.handler = ROUTE_UPLOAD;
+  upload.methods = METHOD_POST;
+  _router.add(upload);
+
+  Route scripts;
+  scripts.path = "/cgi-bin/*";
+  scripts.handler = ROUTE_CGI;
+  scripts.methods = METHOD_GET | METHOD_POST;
+  _router.add(scripts);
+}
+
+/*
+ * Parses "/cgi-bin/report.py:10" or "/cgi-bin/i18n/ *:60:Accept-Language,Cookie".
+ * */
+void Config::parseCgiCache(const std::string& value)
+{
+  std::istringstream iss(value);
+  std::string path, valid, headers;
   std::getline(iss, path, ':');
-  std::getline(iss, destination, ':');
-  std::getline(iss, methodList);
-  
+  std::getline(iss, valid, ':');
+  std::getline(iss, headers);
+  if (trim(path).empty() || trim(valid).empty()) {
+    std::cerr << "Warning: Invalid cgi_cache: " << value << "\n";
+    return;
+  }
+
   Route route;
   route.path = trim(path);
-  route.destination = trim(destination);
-  
-  // Parse methods (comma-separated)
-  std::istringstream methodsStream(methodList);
-  std::string method;
-  while (std::getline(methodsStream, method, ',')) {
-    route.allowedMethods.push_back(trim(method));
+  route.cacheValid = Utils::stringToInt(trim(valid));
+  std::istringstream headerStream(headers);
+  std::string header;
+  while (std::getline(headerStream, header, ',')) {
+    if (!trim(header).empty()) {
+      route.cacheKeyHeaders.push_back(trim(header));
+    }
   }
-  
-  _routes.push_back(route);
+  _cgiCacheRouter.add(route);
+}
+
+/*
+ * Parses "404:www/errors/404.html" or "500,502,503:www/errors/50x.html" and reads the page.
+ * An unreadable page is skipped with a warning, the generated one is sent instead.
+ * */
+void Config::parseErrorPage(const std::string& value)
+{
+  size_t colon = value.find(':');
+  if (colon == std::string::npos) {
+    std::cerr << "Warning: Invalid error_page: " << value << "\n";
+    return;
+  }
+  ErrorPage page;
+  page.path = trim(value.substr(colon + 1));
+  std::ifstream file(page.path.c_str(), std::ios::binary);
+  if (!file) {
+    std::cerr << "Warning: Error page not found: " << page.path << "\n";
+    return;
+  }
+  std::ostringstream body;
+  body << file.rdbuf();
+  page.body = body.str();
+
+  std::istringstream codes(value.substr(0, colon));
+  std::string code;
+  while (std::getline(codes, code, ',')) {
+    _errorPages[Utils::stringToInt(trim(code))] = page;
+  }
+}
+
+/*
+ * Parses a worker count, "auto" means one worker per online CPU.
+ * */
+int Config::parseWorkerCount(const std::string& value)
+{
+  int count;
+  if (value == "auto") {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    count = cpus > 0 ? static_cast<int>(cpus) : 1;
+  } else {
+    count = Utils::stringToInt(value.c_str());
+  }
+  return count < 1 ? 1 : count;
+}
+
+/*
+ * Parses a byte count with an optional k or m suffix, for example "64k".
+ * */
+size_t Config::parseSize(const std::string& value)
+{
+  int number = Utils::stringToInt(value.c_str());
+  if (number <= 0) {
+    return 0;
+  }
+  size_t size = static_cast<size_t>(number);
+  char suffix = value.empty() ? '\0' : value[value.size() - 1];
+  if (suffix == 'k' || suffix == 'K') {
+    size *= 1024;
+  } else if (suffix == 'm' || suffix == 'M') {
+    size *= 1024 * 1024;
+  }
+  return size;
 }
 
 std::string Config::trim(const std::string& str)
@@ -113,54 +399,165 @@ int Config::getPort() const
   return _port;
 }
 
-std::string Config::getServerName() const
+const std::string& Config::getServerName() const
 {
   return _serverName;
 }
 
-std::string Config::getDocumentRoot() const
+const std::string& Config::getDocumentRoot() const
 {
   return _documentRoot;
 }
 
-std::string Config::getUploadsDir() const
+const std::string& Config::getUploadsDir() const
 {
   return _uploadsDir;
 }
 
-const std::vector<Route>& Config::getRoutes() const
+/*
+ * Where an upload route saves files: its destination, uploads_dir if it has none.
+ * */
+const std::string& Config::getUploadsDir(const Route& route) const
 {
-  return _routes;
+  return route.destination.empty() ? _uploadsDir : route.destination;
 }
 
-Route Config::getRouteForPath(const std::string& path) const
+int Config::getKeepaliveTimeout() const
 {
-  for (std::vector<Route>::const_iterator it = _routes.begin(); it != _routes.end(); ++it) {
-    if (matchesPath(path, it->path)) {
-      return *it;
-    }
-  }
-  
-  // Return default route
-  Route defaultRoute;
-  defaultRoute.path = "/";
-  defaultRoute.destination = _documentRoot + "/";
-  defaultRoute.allowedMethods.push_back("GET");
-  return defaultRoute;
+  return _keepaliveTimeout;
 }
 
-bool Config::matchesPath(const std::string& requestPath, const std::string& routePath) const
+int Config::getKeepaliveRequests() const
 {
-  // Simple direct match
-  if (requestPath == routePath) {
-    return true;
-  }
-  
-  // Check if route path ends with '*' for prefix matching
-  if (!routePath.empty() && routePath[routePath.size() - 1] == '*') {
-    std::string prefix = routePath.substr(0, routePath.size() - 1);
-    return requestPath.substr(0, prefix.size()) == prefix;
-  }
-  
-  return false;
+  return _keepaliveRequests;
+}
+
+int Config::getClientTimeout() const
+{
+  return _clientTimeout;
+}
+
+int Config::getWorkerThreads() const
+{
+  return _workerThreads;
+}
+
+int Config::getWorkerProcesses() const
+{
+  return _workerProcesses;
+}
+
+bool Config::getWorkerCpuAffinity() const
+{
+  return _workerCpuAffinity;
+}
+
+int Config::getOpenFileCache() const
+{
+  return _openFileCache < 0 ? 0 : _openFileCache;
+}
+
+int Config::getOpenFileCacheValid() const
+{
+  return _openFileCacheValid;
+}
+
+size_t Config::getResponseCacheSize() const
+{
+  return _responseCacheSize;
+}
+
+size_t Config::getResponseCacheMaxFile() const
+{
+  return _responseCacheMaxFile;
+}
+
+const std::string& Config::getAssetPack() const
+{
+  return _assetPack;
+}
+
+bool Config::getGzip() const
+{
+  return _gzip;
+}
+
+int Config::getGzipCompLevel() const
+{
+  return _gzipCompLevel;
+}
+
+size_t Config::getGzipMinLength() const
+{
+  return _gzipMinLength;
+}
+
+size_t Config::getGzipCacheSize() const
+{
+  return _gzipCacheSize;
+}
+
+size_t Config::getClientMaxBodySize() const
+{
+  return _clientMaxBodySize;
+}
+
+size_t Config::getClientBodyBufferSize() const
+{
+  return _clientBodyBufferSize;
+}
+
+const std::string& Config::getClientBodyTempPath() const
+{
+  return _clientBodyTempPath;
+}
+
+int Config::getCgiTimeout() const
+{
+  return _cgiTimeout;
+}
+
+int Config::getFastcgiConnections() const
+{
+  return _fastcgiConnections;
+}
+
+int Config::getFastcgiQueue() const
+{
+  return _fastcgiQueue;
+}
+
+size_t Config::getCgiCacheSize() const
+{
+  return _cgiCacheSize;
+}
+
+const std::string& Config::getMimeTypes() const
+{
+  return _mimeTypes;
+}
+
+/*
+ * Returns the configured page for statusCode, NULL if there is none.
+ * */
+const ErrorPage *Config::getErrorPage(int statusCode) const
+{
+  std::map<int, ErrorPage>::const_iterator it = _errorPages.find(statusCode);
+  return it == _errorPages.end() ? NULL : &it->second;
+}
+
+/*
+ * Returns the route of path (without the query string), NULL if none matches.
+ * */
+const Route *Config::getRoute(const StringView& path) const
+{
+  return _router.find(path);
+}
+
+/*
+ * Returns the cgi_cache route of path (without the query string), NULL if none matches.
+ * */
+const Route *Config::getCgiCacheRoute(const StringView& path) const
+{
+  return _cgiCacheRouter.find(path);
 }
@@ -4,7 +4,16 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <map>
 #include "Route.hpp"
+#include "Router.hpp"
+#include "StringView.hpp"
+
+// Custom error page, read into memory when the config is loaded
+struct ErrorPage {
+  std::string path;
+  std::string body;
+};
 
 class Config {
 private:
@@ -12,11 +21,41 @@ private:
   std::string _serverName;
   std::string _documentRoot;
   std::string _uploadsDir;
-  std::vector<Route> _routes;
+  int _keepaliveTimeout;
+  int _keepaliveRequests;
+  int _clientTimeout;
+  int _workerThreads;
+  int _workerProcesses;
+  bool _workerCpuAffinity;
+  int _openFileCache;
+  int _openFileCacheValid;
+  size_t _responseCacheSize;
+  size_t _responseCacheMaxFile;
+  std::string _assetPack;
+  bool _gzip;
+  int _gzipCompLevel;
+  size_t _gzipMinLength;
+  size_t _gzipCacheSize;
+  size_t _clientMaxBodySize;
+  size_t _clientBodyBufferSize;
+  std::string _clientBodyTempPath;
+  int _cgiTimeout;
+  int _fastcgiConnections;
+  int _fastcgiQueue;
+  size_t _cgiCacheSize;
+  std::string _mimeTypes;
+  std::map<int, ErrorPage> _errorPages;
+  Router _router;
+  Router _cgiCacheRouter;
   
   void parseRoute(const std::string& routeConfig);
+  void addDefaultRoutes();
+  void parseFastcgiPass(const std::string& value);
+  void parseCgiCache(const std::string& value);
+  void parseErrorPage(const std::string& value);
   std::string trim(const std::string& str);
-  bool matchesPath(const std::string& requestPath, const std::string& routePath) const;
+  int parseWorkerCount(const std::string& value);
+  size_t parseSize(const std::string& value);
 
 public:
   Config();
@@ -25,11 +64,36 @@ public:
   void loadFromFile(const std::string& configFile);
   
   int getPort() const;
-  std::string getServerName() const;
-  std::string getDocumentRoot() const;
-  std::string getUploadsDir() const;
-  const std::vector<Route>& getRoutes() const;
-  Route getRouteForPath(const std::string& path) const;
+  const std::string& getServerName() const;
+  const std::string& getDocumentRoot() const;
+  const std::string& getUploadsDir() const;
+  const std::string& getUploadsDir(const Route& route) const;
+  int getKeepaliveTimeout() const;
+  int getKeepaliveRequests() const;
+  int getClientTimeout() const;
+  int getWorkerThreads() const;
+  int getWorkerProcesses() const;
+  bool getWorkerCpuAffinity() const;
+  int getOpenFileCache() const;
+  int getOpenFileCacheValid() const;
+  size_t getResponseCacheSize() const;
+  size_t getResponseCacheMaxFile() const;
+  const std::string& getAssetPack() const;
+  bool getGzip() const;
+  int getGzipCompLevel() const;
+  size_t getGzipMinLength() const;
+  size_t getGzipCacheSize() const;
+  size_t getClientMaxBodySize() const;
+  size_t getClientBodyBufferSize() const;
+  const std::string& getClientBodyTempPath() const;
+  int getCgiTimeout() const;
+  int getFastcgiConnections() const;
+  int getFastcgiQueue() const;
+  size_t getCgiCacheSize() const;
+  const std::string& getMimeTypes() const;
+  const ErrorPage *getErrorPage(int statusCode) const;
+  const Route *getRoute(const StringView& path) const;
+  const Route *getCgiCacheRoute(const StringView& path) const;
 };
 
 #endif
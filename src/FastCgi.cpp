@@ -0,0 +1,129 @@
+#include "FastCgi.hpp"
+
+namespace
+{
+  // Lengths below 128 take one byte, longer ones four with the high bit set
+  void appendLength(std::string& out, size_t length)
+  {
+    if (length < 128) {
+      out += static_cast<char>(length);
+      return;
+    }
+    out += static_cast<char>(((length >> 24) & 0x7f) | 0x80);
+    out += static_cast<char>((length >> 16) & 0xff);
+    out += static_cast<char>((length >> 8) & 0xff);
+    out += static_cast<char>(length & 0xff);
+  }
+
+  bool readLength(const unsigned char *data, size_t length, size_t& pos, size_t& value)
+  {
+    if (pos >= length) {
+      return false;
+    }
+    if (data[pos] < 128) {
+      value = data[pos++];
+      return true;
+    }
+    if (length - pos < 4) {
+      return false;
+    }
+    value = (static_cast<size_t>(data[pos] & 0x7f) << 24) | (static_cast<size_t>(data[pos + 1]) << 16)
+            | (static_cast<size_t>(data[pos + 2]) << 8) | data[pos + 3];
+    pos += 4;
+    return true;
+  }
+}
+
+/*
+ * Appends one record: the 8 byte header and the content padded to a multiple of 8.
+ * length must not exceed MAX_CONTENT_LENGTH.
+ * */
+void FastCgi::appendRecord(std::string& out, unsigned char type, unsigned short requestId,
+                           const char *content, size_t length)
+{
+  size_t padding = (8 - length % 8) % 8;
+  char header[HEADER_LENGTH] = {
+    static_cast<char>(VERSION_1),
+    static_cast<char>(type),
+    static_cast<char>(requestId >> 8),
+    static_cast<char>(requestId & 0xff),
+    static_cast<char>(length >> 8),
+    static_cast<char>(length & 0xff),
+    static_cast<char>(padding),
+    0
+  };
+  out.append(header, HEADER_LENGTH);
+  out.append(content, length);
+  out.append(padding, '\0');
+}
+
+void FastCgi::appendBeginRequest(std::string& out, unsigned short requestId, unsigned short role, unsigned char flags)
+{
+  char body[8] = { static_cast<char>(role >> 8), static_cast<char>(role & 0xff), static_cast<char>(flags), 0, 0, 0, 0, 0 };
+  appendRecord(out, BEGIN_REQUEST, requestId, body, sizeof(body));
+}
+
+void FastCgi::appendEndRequest(std::string& out, unsigned short requestId, unsigned int appStatus,
+                               unsigned char protocolStatus)
+{
+  char body[8] = {
+    static_cast<char>(appStatus >> 24),
+    static_cast<char>((appStatus >> 16) & 0xff),
+    static_cast<char>((appStatus >> 8) & 0xff),
+    static_cast<char>(appStatus & 0xff),
+    static_cast<char>(protocolStatus),
+    0, 0, 0
+  };
+  appendRecord(out, END_REQUEST, requestId, body, sizeof(body));
+}
+
+/*
+ * Appends a name-value pair as used in PARAMS and GET_VALUES content.
+ * */
+void FastCgi::appendNameValue(std::string& out, const std::string& name, const std::string& value)
+{
+  appendLength(out, name.size());
+  appendLength(out, value.size());
+  out += name;
+  out += value;
+}
+
+bool FastCgi::parseNameValues(const char *data, size_t length, NameValues& pairs)
+{
+  const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+  size_t pos = 0;
+  while (pos < length) {
+    size_t nameLength;
+    size_t valueLength;
+    if (!readLength(bytes, length, pos, nameLength) || !readLength(bytes, length, pos, valueLength)
+        || nameLength > length - pos || valueLength > length - pos - nameLength) {
+      return false;
+    }
+    pairs.push_back(std::make_pair(std::string(data + pos, nameLength),
+                                   std::string(data + pos + nameLength, valueLength)));
+    pos += nameLength + valueLength;
+  }
+  return true;
+}
+
+/*
+ * Parses the record at the start of data. Returns its length with the padding,
+ * 0 if the record is not complete yet. record.content points into data.
+ * */
+size_t FastCgi::parseRecord(const char *data, size_t length, Record& record)
+{
+  if (length < HEADER_LENGTH) {
+    return 0;
+  }
+  const unsigned char *header = reinterpret_cast<const unsigned char*>(data);
+  size_t contentLength = (static_cast<size_t>(header[4]) << 8) | header[5];
+  size_t total = HEADER_LENGTH + contentLength + header[6];
+  if (length < total) {
+    return 0;
+  }
+  record.type = header[1];
+  record.requestId = static_cast<unsigned short>((header[2] << 8) | header[3]);
+  record.content = data + HEADER_LENGTH;
+  record.contentLength = contentLength;
+  return total;
+}
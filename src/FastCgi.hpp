@@ -0,0 +1,60 @@
+#ifndef FASTCGI_HPP
+#define FASTCGI_HPP
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+/*
+ * FastCGI 1.0 record framing, shared by the client (FastCgiPool) and tools/fcgi_responder.
+ */
+namespace FastCgi
+{
+  enum RecordType {
+    BEGIN_REQUEST = 1,
+    ABORT_REQUEST = 2,
+    END_REQUEST = 3,
+    PARAMS = 4,
+    STDIN = 5,
+    STDOUT = 6,
+    STDERR = 7,
+    DATA = 8,
+    GET_VALUES = 9,
+    GET_VALUES_RESULT = 10,
+    UNKNOWN_TYPE = 11
+  };
+
+  enum ProtocolStatus {
+    REQUEST_COMPLETE = 0,
+    CANT_MPX_CONN = 1,
+    OVERLOADED = 2,
+    UNKNOWN_ROLE = 3
+  };
+
+  const unsigned char VERSION_1 = 1;
+  const unsigned short RESPONDER = 1;
+  const unsigned char KEEP_CONN = 1;
+  const size_t HEADER_LENGTH = 8;
+  const size_t MAX_CONTENT_LENGTH = 65535;
+
+  struct Record {
+    unsigned char type;
+    unsigned short requestId;
+    const char *content;
+    size_t contentLength;
+  };
+
+  typedef std::vector<std::pair<std::string, std::string> > NameValues;
+
+  void appendRecord(std::string& out, unsigned char type, unsigned short requestId,
+                    const char *content, size_t length);
+  void appendBeginRequest(std::string& out, unsigned short requestId, unsigned short role, unsigned char flags);
+  void appendEndRequest(std::string& out, unsigned short requestId, unsigned int appStatus,
+                        unsigned char protocolStatus);
+  void appendNameValue(std::string& out, const std::string& name, const std::string& value);
+  bool parseNameValues(const char *data, size_t length, NameValues& pairs);
+  size_t parseRecord(const char *data, size_t length, Record& record);
+}
+
+#endif // FASTCGI_HPP
@@ -0,0 +1,551 @@
+#include "FastCgiPool.hpp"
+#include "FastCgiRequest.hpp"
+#include "FastCgi.hpp"
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+FastCgiPool::FastCgiPool(int maxConnections, int maxQueue)
+  : _maxConnections(maxConnections > 0 ? maxConnections : 1),
+    _maxQueue(maxQueue > 0 ? maxQueue : 0), _epollFd(-1)
+{
+}
+
+/*
+ * The Clients, and with them the requests, are gone before the pool.
+ * */
+FastCgiPool::~FastCgiPool()
+{
+  for (std::map<int, Connection*>::iterator it = _connections.begin(); it != _connections.end(); ++it) {
+    close(it->first);
+    delete it->second;
+  }
+  for (size_t i = 0; i < _closed.size(); ++i) {
+    delete _closed[i];
+  }
+  for (std::map<std::string, Upstream*>::iterator it = _upstreams.begin(); it != _upstreams.end(); ++it) {
+    delete it->second;
+  }
+}
+
+void FastCgiPool::setEpoll(int epollFd)
+{
+  _epollFd = epollFd;
+}
+
+/*
+ * Sends the request on a connection with room for it, opens one if the limit allows
+ * and queues it otherwise. Returns 0, or the status to fail the request with.
+ * */
+int FastCgiPool::submit(FastCgiRequest *request)
+{
+  Upstream *upstream;
+  std::map<std::string, Upstream*>::iterator it = _upstreams.find(request->_upstream);
+  if (it == _upstreams.end()) {
+    upstream = new Upstream;
+    upstream->address = request->_upstream;
+    _upstreams[upstream->address] = upstream;
+  } else {
+    upstream = it->second;
+  }
+
+  Connection *connection = available(upstream);
+  if (connection == NULL && upstream->connections.size() < _maxConnections) {
+    connection = connect(upstream);
+    if (connection == NULL) {
+      return 502;
+    }
+  }
+  if (connection != NULL) {
+    assign(connection, request);
+    return 0;
+  }
+  if (upstream->queue.size() >= _maxQueue) {
+    std::cerr << "Error: Too many requests waiting for FastCGI application " << upstream->address << ".\n";
+    return 503;
+  }
+  upstream->queue.push_back(request);
+  return 0;
+}
+
+/*
+ * Forgets the request: the application is told to abort it, its id stays taken until
+ * the application ends it. Called when the request timed out or its client went away.
+ * */
+void FastCgiPool::cancel(FastCgiRequest *request)
+{
+  _touched.erase(std::remove(_touched.begin(), _touched.end(), request), _touched.end());
+  Connection *connection = request->_connection;
+  if (connection == NULL) {
+    std::map<std::string, Upstream*>::iterator it = _upstreams.find(request->_upstream);
+    if (it != _upstreams.end()) {
+      std::deque<FastCgiRequest*>& queue = it->second->queue;
+      queue.erase(std::remove(queue.begin(), queue.end(), request), queue.end());
+    }
+    return;
+  }
+  request->_connection = NULL;
+  connection->requests[request->_id] = NULL;
+  FastCgi::appendRecord(connection->writeBuffer, FastCgi::ABORT_REQUEST, request->_id, "", 0);
+  if (flush(connection) && connection->paused) {
+    resume(connection);
+  }
+}
+
+/*
+ * Reading a connection paused for slow clients goes on once all of them caught up.
+ * */
+void FastCgiPool::resume(FastCgiRequest *request)
+{
+  if (request->_connection != NULL && request->_connection->paused) {
+    resume(request->_connection);
+  }
+}
+
+void FastCgiPool::resume(Connection *connection)
+{
+  for (std::map<unsigned short, FastCgiRequest*>::iterator it = connection->requests.begin();
+       it != connection->requests.end(); ++it) {
+    if (it->second != NULL && !it->second->_response.drained()) {
+      return;
+    }
+  }
+  connection->paused = false;
+  read(connection);
+}
+
+/*
+ * Handles an event on a pooled connection. Returns false if fd is not one.
+ * */
+bool FastCgiPool::handleEvent(int fd, uint32_t events)
+{
+  std::map<int, Connection*>::iterator it = _connections.find(fd);
+  if (it == _connections.end()) {
+    return false;
+  }
+  Connection *connection = it->second;
+  if (!connection->connected) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1) {
+      error = errno;
+    }
+    if (error != 0) {
+      std::cerr << "Error: Failed to connect to FastCGI application " << connection->upstream->address
+                << ". " << strerror(error) << "\n";
+      fail(connection, true);
+      return true;
+    }
+    // An event left over from a closed descriptor with the same number may arrive first
+    struct sockaddr_storage peer;
+    socklen_t peerLength = sizeof(peer);
+    if (!(events & EPOLLOUT) || getpeername(fd, reinterpret_cast<struct sockaddr*>(&peer), &peerLength) == -1) {
+      return true;
+    }
+    connection->connected = true;
+  }
+  if ((events & EPOLLOUT) && !flush(connection)) {
+    return true;
+  }
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+    read(connection);
+  }
+  return true;
+}
+
+/*
+ * Moves the requests that got output or finished since the last call to requests.
+ * Failed connections are freed here, where no call is still using them.
+ * */
+void FastCgiPool::takeTouched(std::vector<FastCgiRequest*>& requests)
+{
+  requests.clear();
+  requests.swap(_touched);
+  for (size_t i = 0; i < _closed.size(); ++i) {
+    delete _closed[i];
+  }
+  _closed.clear();
+}
+
+/*
+ * Opens a non-blocking connection to the upstream. The first record asks the application
+ * whether it multiplexes requests, until the answer arrives it gets one at a time.
+ * */
+FastCgiPool::Connection *FastCgiPool::connect(Upstream *upstream)
+{
+  struct sockaddr_storage address;
+  socklen_t addressLength;
+  if (!parseAddress(upstream->address, address, addressLength)) {
+    std::cerr << "Error: Invalid FastCGI address: " << upstream->address << "\n";
+    return NULL;
+  }
+  int fd = socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    std::cerr << "Error: Failed to create FastCGI socket. " << strerror(errno) << "\n";
+    return NULL;
+  }
+  int result = ::connect(fd, reinterpret_cast<struct sockaddr*>(&address), addressLength);
+  if (result == -1 && errno != EINPROGRESS) {
+    std::cerr << "Error: Failed to connect to FastCGI application " << upstream->address
+              << ". " << strerror(errno) << "\n";
+    close(fd);
+    return NULL;
+  }
+  struct epoll_event event;
+  event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+  event.data.fd = fd;
+  if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+    std::cerr << "Error: Failed to add FastCGI socket to epoll. " << strerror(errno) << "\n";
+    close(fd);
+    return NULL;
+  }
+
+  Connection *connection = new Connection;
+  connection->fd = fd;
+  connection->upstream = upstream;
+  connection->connected = (result == 0);
+  connection->paused = false;
+  connection->maxRequests = 1;
+  connection->writeOffset = 0;
+  std::string values;
+  FastCgi::appendNameValue(values, "FCGI_MPXS_CONNS", "");
+  FastCgi::appendNameValue(values, "FCGI_MAX_REQS", "");
+  FastCgi::appendRecord(connection->writeBuffer, FastCgi::GET_VALUES, 0, values.data(), values.size());
+  upstream->connections.push_back(connection);
+  _connections[fd] = connection;
+  return connection;
+}
+
+/*
+ * Returns a connection of upstream that can take another request, NULL if none can.
+ * */
+FastCgiPool::Connection *FastCgiPool::available(Upstream *upstream)
+{
+  for (size_t i = 0; i < upstream->connections.size(); ++i) {
+    if (upstream->connections[i]->requests.size() < upstream->connections[i]->maxRequests) {
+      return upstream->connections[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Gives the request the lowest free id on the connection and queues BEGIN_REQUEST,
+ * the PARAMS and as much of the body as the write buffer takes.
+ * */
+void FastCgiPool::assign(Connection *connection, FastCgiRequest *request)
+{
+  unsigned short id = 1;
+  while (connection->requests.count(id) != 0) {
+    ++id;
+  }
+  connection->requests[id] = request;
+  request->_connection = connection;
+  request->_id = id;
+
+  std::string& out = connection->writeBuffer;
+  const std::string& params = request->_params;
+  FastCgi::appendBeginRequest(out, id, FastCgi::RESPONDER, FastCgi::KEEP_CONN);
+  for (size_t offset = 0; offset < params.size(); offset += FastCgi::MAX_CONTENT_LENGTH) {
+    size_t length = std::min(params.size() - offset, FastCgi::MAX_CONTENT_LENGTH);
+    FastCgi::appendRecord(out, FastCgi::PARAMS, id, params.data() + offset, length);
+  }
+  FastCgi::appendRecord(out, FastCgi::PARAMS, id, "", 0);
+  feedInput(connection, request);
+  flush(connection);
+}
+
+/*
+ * Sends queued requests while connections have room or new ones may be opened.
+ * */
+void FastCgiPool::dispatch(Upstream *upstream)
+{
+  while (!upstream->queue.empty()) {
+    Connection *connection = available(upstream);
+    if (connection == NULL) {
+      if (upstream->connections.size() >= _maxConnections) {
+        return;
+      }
+      connection = connect(upstream);
+      if (connection == NULL) {
+        while (!upstream->queue.empty()) {
+          FastCgiRequest *request = upstream->queue.front();
+          upstream->queue.pop_front();
+          request->finish(502);
+          touch(request);
+        }
+        return;
+      }
+    }
+    FastCgiRequest *request = upstream->queue.front();
+    upstream->queue.pop_front();
+    assign(connection, request);
+  }
+}
+
+/*
+ * Adds STDIN records of the request body until the write buffer is full, and the empty
+ * record that ends the stream after the last one.
+ * */
+void FastCgiPool::feedInput(Connection *connection, FastCgiRequest *request)
+{
+  char buffer[32768];
+  while (!request->_inputDone && connection->writeBuffer.size() - connection->writeOffset < WRITE_BUFFER_LIMIT) {
+    size_t length = request->_body.read(request->_bodyOffset, buffer, sizeof(buffer));
+    if (length == 0) {
+      FastCgi::appendRecord(connection->writeBuffer, FastCgi::STDIN, request->_id, "", 0);
+      request->_inputDone = true;
+      break;
+    }
+    FastCgi::appendRecord(connection->writeBuffer, FastCgi::STDIN, request->_id, buffer, length);
+    request->_bodyOffset += length;
+  }
+}
+
+/*
+ * Writes the buffer until the socket is full, refilling it with the bodies still being
+ * sent. Returns false if the connection failed and is gone.
+ * */
+bool FastCgiPool::flush(Connection *connection)
+{
+  while (connection->connected) {
+    if (connection->writeOffset == connection->writeBuffer.size()) {
+      connection->writeBuffer.clear();
+      connection->writeOffset = 0;
+      for (std::map<unsigned short, FastCgiRequest*>::iterator it = connection->requests.begin();
+           it != connection->requests.end(); ++it) {
+        if (it->second != NULL) {
+          feedInput(connection, it->second);
+        }
+      }
+      if (connection->writeBuffer.empty()) {
+        return true;
+      }
+    }
+    ssize_t sent = send(connection->fd, connection->writeBuffer.data() + connection->writeOffset,
+                        connection->writeBuffer.size() - connection->writeOffset, MSG_NOSIGNAL);
+    if (sent == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return true;
+      }
+      std::cerr << "Error: Failed to write to FastCGI application " << connection->upstream->address
+                << ". " << strerror(errno) << "\n";
+      fail(connection, false);
+      return false;
+    }
+    connection->writeOffset += sent;
+  }
+  return true;
+}
+
+/*
+ * Reads and handles records until the socket is empty or a client is too far behind,
+ * then the connection waits in the kernel buffer until resume().
+ * */
+void FastCgiPool::read(Connection *connection)
+{
+  char buffer[65536];
+  while (true) {
+    size_t offset = 0;
+    FastCgi::Record record;
+    size_t length;
+    while (!connection->paused && connection->fd != -1
+           && (length = FastCgi::parseRecord(connection->readBuffer.data() + offset,
+                                             connection->readBuffer.size() - offset, record)) != 0) {
+      offset += length;
+      processRecord(connection, record);
+    }
+    connection->readBuffer.erase(0, offset);
+    if (connection->paused || connection->fd == -1) {
+      return;
+    }
+
+    ssize_t received = recv(connection->fd, buffer, sizeof(buffer), 0);
+    if (received > 0) {
+      connection->readBuffer.append(buffer, received);
+      continue;
+    }
+    if (received == -1 && errno == EINTR) {
+      continue;
+    }
+    if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (received == -1) {
+      std::cerr << "Error: Failed to read from FastCGI application " << connection->upstream->address
+                << ". " << strerror(errno) << "\n";
+    }
+    fail(connection, false);
+    return;
+  }
+}
+
+void FastCgiPool::processRecord(Connection *connection, const FastCgi::Record& record)
+{
+  if (record.requestId == 0) {
+    if (record.type == FastCgi::GET_VALUES_RESULT) {
+      updateCapacity(connection, record.content, record.contentLength);
+    }
+    return;
+  }
+  std::map<unsigned short, FastCgiRequest*>::iterator it = connection->requests.find(record.requestId);
+  if (it == connection->requests.end()) {
+    return;
+  }
+  FastCgiRequest *request = it->second;
+  if (record.type == FastCgi::STDOUT) {
+    if (request != NULL && record.contentLength > 0) {
+      request->received(record.content, record.contentLength);
+      touch(request);
+      if (request->_response.full()) {
+        connection->paused = true;
+      }
+    }
+  } else if (record.type == FastCgi::STDERR) {
+    size_t length = record.contentLength;
+    while (length > 0 && record.content[length - 1] == '\n') {
+      --length;
+    }
+    if (length > 0) {
+      std::cerr << "FastCGI " << connection->upstream->address << ": ";
+      std::cerr.write(record.content, length) << "\n";
+    }
+  } else if (record.type == FastCgi::END_REQUEST) {
+    connection->requests.erase(it);
+    if (request != NULL) {
+      const unsigned char *body = reinterpret_cast<const unsigned char*>(record.content);
+      int protocolStatus = record.contentLength >= 8 ? body[4] : static_cast<int>(FastCgi::REQUEST_COMPLETE);
+      if (protocolStatus == FastCgi::CANT_MPX_CONN) {
+        connection->maxRequests = 1;
+      }
+      request->_connection = NULL;
+      if (protocolStatus == FastCgi::REQUEST_COMPLETE) {
+        request->finish(0);
+      } else {
+        std::cerr << "Error: FastCGI application " << connection->upstream->address
+                  << " refused a request (protocol status " << protocolStatus << ").\n";
+        request->finish(protocolStatus == FastCgi::UNKNOWN_ROLE ? 502 : 503);
+      }
+      touch(request);
+    }
+    dispatch(connection->upstream);
+  }
+}
+
+/*
+ * Takes FCGI_MPXS_CONNS and FCGI_MAX_REQS from GET_VALUES_RESULT. Applications that
+ * multiplex get up to MAX_MULTIPLEX requests per connection.
+ * */
+void FastCgiPool::updateCapacity(Connection *connection, const char *content, size_t length)
+{
+  FastCgi::NameValues values;
+  if (!FastCgi::parseNameValues(content, length, values)) {
+    return;
+  }
+  bool multiplexed = false;
+  size_t maxRequests = MAX_MULTIPLEX;
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (values[i].first == "FCGI_MPXS_CONNS") {
+      multiplexed = (values[i].second == "1");
+    } else if (values[i].first == "FCGI_MAX_REQS") {
+      int value = atoi(values[i].second.c_str());
+      if (value > 0) {
+        maxRequests = std::min(maxRequests, static_cast<size_t>(value));
+      }
+    }
+  }
+  if (multiplexed) {
+    connection->maxRequests = maxRequests;
+    dispatch(connection->upstream);
+  }
+}
+
+/*
+ * Closes a broken connection. Its requests fail with 502, and so do the queued ones if
+ * the application could not be reached, otherwise they go to another connection.
+ * The Connection itself stays allocated until takeTouched(), a caller up the stack may
+ * still hold it.
+ * */
+void FastCgiPool::fail(Connection *connection, bool connectFailed)
+{
+  for (std::map<unsigned short, FastCgiRequest*>::iterator it = connection->requests.begin();
+       it != connection->requests.end(); ++it) {
+    if (it->second != NULL) {
+      it->second->_connection = NULL;
+      it->second->finish(502);
+      touch(it->second);
+    }
+  }
+  Upstream *upstream = connection->upstream;
+  upstream->connections.erase(std::find(upstream->connections.begin(), upstream->connections.end(), connection));
+  _connections.erase(connection->fd);
+  close(connection->fd);
+  connection->fd = -1;
+  connection->connected = false;
+  connection->paused = true;
+  connection->requests.clear();
+  _closed.push_back(connection);
+
+  if (connectFailed) {
+    while (!upstream->queue.empty()) {
+      FastCgiRequest *request = upstream->queue.front();
+      upstream->queue.pop_front();
+      request->finish(502);
+      touch(request);
+    }
+  } else {
+    dispatch(upstream);
+  }
+}
+
+void FastCgiPool::touch(FastCgiRequest *request)
+{
+  _touched.push_back(request);
+}
+
+/*
+ * Accepts "unix:/path/to/socket" and "host:port" with an IPv4 host or localhost.
+ * */
+bool FastCgiPool::parseAddress(const std::string& address, struct sockaddr_storage& storage, socklen_t& length)
+{
+  memset(&storage, 0, sizeof(storage));
+  if (address.compare(0, 5, "unix:") == 0) {
+    struct sockaddr_un *unixAddress = reinterpret_cast<struct sockaddr_un*>(&storage);
+    std::string path = address.substr(5);
+    if (path.empty() || path.size() >= sizeof(unixAddress->sun_path)) {
+      return false;
+    }
+    unixAddress->sun_family = AF_UNIX;
+    memcpy(unixAddress->sun_path, path.c_str(), path.size() + 1);
+    length = sizeof(struct sockaddr_un);
+    return true;
+  }
+
+  size_t colon = address.rfind(':');
+  if (colon == std::string::npos) {
+    return false;
+  }
+  std::string host = address.substr(0, colon);
+  int port = atoi(address.c_str() + colon + 1);
+  if (host == "localhost") {
+    host = "127.0.0.1";
+  }
+  struct sockaddr_in *inetAddress = reinterpret_cast<struct sockaddr_in*>(&storage);
+  if (port <= 0 || port > 65535 || inet_pton(AF_INET, host.c_str(), &inetAddress->sin_addr) != 1) {
+    return false;
+  }
+  inetAddress->sin_family = AF_INET;
+  inetAddress->sin_port = htons(port);
+  length = sizeof(struct sockaddr_in);
+  return true;
+}
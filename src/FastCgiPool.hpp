@@ -0,0 +1,86 @@
+#ifndef FASTCGIPOOL_HPP
+#define FASTCGIPOOL_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "FastCgi.hpp"
+
+class FastCgiRequest;
+
+/*
+ * Persistent connections of one event loop to FastCGI applications. Requests are
+ * multiplexed over a connection when the application allows it (FCGI_MPXS_CONNS),
+ * up to maxConnections are opened per application and further requests wait in a
+ * bounded queue. The Server passes events on the connections to handleEvent() and
+ * serves the clients of the requests returned by takeTouched().
+ */
+class FastCgiPool {
+public:
+  // Most requests multiplexed on one connection, whatever FCGI_MAX_REQS says
+  static const size_t MAX_MULTIPLEX = 64;
+  // STDIN records are only added while less than this waits to be written
+  static const size_t WRITE_BUFFER_LIMIT = 64 * 1024;
+
+  FastCgiPool(int maxConnections, int maxQueue);
+  ~FastCgiPool();
+
+  void setEpoll(int epollFd);
+  int submit(FastCgiRequest *request);
+  void cancel(FastCgiRequest *request);
+  void resume(FastCgiRequest *request);
+  bool handleEvent(int fd, uint32_t events);
+  void takeTouched(std::vector<FastCgiRequest*>& requests);
+
+private:
+  friend class FastCgiRequest; // Holds the Connection it is sent on
+  struct Upstream;
+
+  struct Connection {
+    int fd;                  // -1 once failed
+    Upstream *upstream;
+    bool connected;
+    bool paused;             // Not read while a client is too far behind
+    size_t maxRequests;      // 1 until the application allows multiplexing
+    std::string writeBuffer;
+    size_t writeOffset;
+    std::string readBuffer;
+    std::map<unsigned short, FastCgiRequest*> requests; // NULL once aborted, until END_REQUEST
+  };
+
+  struct Upstream {
+    std::string address;
+    std::vector<Connection*> connections;
+    std::deque<FastCgiRequest*> queue;
+  };
+
+  size_t _maxConnections;
+  size_t _maxQueue;
+  int _epollFd;
+  std::map<std::string, Upstream*> _upstreams;
+  std::map<int, Connection*> _connections;       // By socket
+  std::vector<FastCgiRequest*> _touched;         // Produced output or finished
+  std::vector<Connection*> _closed;              // Failed, deleted in takeTouched()
+
+  Connection *connect(Upstream *upstream);
+  Connection *available(Upstream *upstream);
+  void assign(Connection *connection, FastCgiRequest *request);
+  void dispatch(Upstream *upstream);
+  void feedInput(Connection *connection, FastCgiRequest *request);
+  bool flush(Connection *connection);
+  void read(Connection *connection);
+  void processRecord(Connection *connection, const FastCgi::Record& record);
+  void resume(Connection *connection);
+  void updateCapacity(Connection *connection, const char *content, size_t length);
+  void fail(Connection *connection, bool connectFailed);
+  void touch(FastCgiRequest *request);
+  static bool parseAddress(const std::string& address, struct sockaddr_storage& storage, socklen_t& length);
+
+  FastCgiPool(const FastCgiPool&);
+  FastCgiPool& operator=(const FastCgiPool&);
+};
+
+#endif // FASTCGIPOOL_HPP
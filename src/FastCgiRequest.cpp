@@ -0,0 +1,106 @@
+#include "FastCgiRequest.hpp"
+#include "FastCgi.hpp"
+#include "CGI.hpp"
+
+FastCgiRequest::FastCgiRequest(const Config& config, OutputQueue& output, ServerContext& context)
+  : _config(config), _context(context), _response(config, output, context),
+    _bodyOffset(0), _inputDone(false), _connection(NULL), _id(0), _deadline(0)
+{
+}
+
+/*
+ * A request the application still works on is aborted, a queued one is dropped.
+ * */
+FastCgiRequest::~FastCgiRequest()
+{
+  _context.fastcgi.cancel(this);
+}
+
+void FastCgiRequest::setKeepAlive(bool keepAlive)
+{
+  _response.setKeepAlive(keepAlive);
+}
+
+void FastCgiRequest::setChunked(bool chunked)
+{
+  _response.setChunked(chunked);
+}
+
+bool FastCgiRequest::keepAlive() const
+{
+  return _response.keepAlive();
+}
+
+/*
+ * Encodes the CGI environment as PARAMS and hands the request to the pool. It fails
+ * with 502 when the application can't be reached and 503 when its queue is full.
+ * */
+void FastCgiRequest::start(const Route& route, const Request& request)
+{
+  std::string path = request.getPath().str();
+  std::vector<std::string> env = CGI::buildEnvironment(_config, request, _config.getDocumentRoot() + path, path, "");
+  for (size_t i = 0; i < env.size(); ++i) {
+    size_t equals = env[i].find('=');
+    FastCgi::appendNameValue(_params, env[i].substr(0, equals), env[i].substr(equals + 1));
+  }
+
+  _upstream = route.fastcgiPass;
+  _body = request.getBody();
+  _deadline = time(NULL) + _config.getCgiTimeout();
+  int status = _context.fastcgi.submit(this);
+  if (status != 0) {
+    _response.finish(status);
+  }
+}
+
+/*
+ * Called by the Server after flushing: reading a connection paused for a slow client
+ * goes on once every client on it caught up. Returns true if more output was queued.
+ * */
+bool FastCgiRequest::resume()
+{
+  if (_response.done()) {
+    return false;
+  }
+  size_t pending = _response.pendingBytes();
+  _context.fastcgi.resume(this);
+  return _response.pendingBytes() != pending || _response.done();
+}
+
+/*
+ * Called about once per second: aborts the request with 504 when the application sent
+ * nothing for cgi_timeout seconds. Time spent waiting for the client is not counted.
+ * */
+void FastCgiRequest::checkTimeout(time_t now)
+{
+  if (_response.done()) {
+    return;
+  }
+  if (!_response.drained()) {
+    _deadline = now + _config.getCgiTimeout();
+    return;
+  }
+  if (now < _deadline) {
+    return;
+  }
+  std::cerr << "Error: FastCGI application " << _upstream << " sent no output for "
+            << _config.getCgiTimeout() << " seconds.\n";
+  _context.fastcgi.cancel(this);
+  _response.finish(504);
+}
+
+bool FastCgiRequest::done() const
+{
+  return _response.done();
+}
+
+void FastCgiRequest::received(const char *data, size_t length)
+{
+  _deadline = time(NULL) + _config.getCgiTimeout();
+  _response.write(data, length);
+}
+
+void FastCgiRequest::finish(int errorStatus)
+{
+  _response.finish(errorStatus);
+}
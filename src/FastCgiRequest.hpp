@@ -0,0 +1,55 @@
+#ifndef FASTCGIREQUEST_HPP
+#define FASTCGIREQUEST_HPP
+
+#include <string>
+#include <ctime>
+#include "Config.hpp"
+#include "OutputQueue.hpp"
+#include "ServerContext.hpp"
+#include "Request.hpp"
+#include "RequestBody.hpp"
+#include "Route.hpp"
+#include "CgiOutput.hpp"
+
+/*
+ * A request passed to a FastCGI application (fastcgi_pass). The FastCgiPool of the
+ * event loop sends it on a pooled connection and hands the application's output to it,
+ * the Server drives it like a running CGI script.
+ */
+class FastCgiRequest {
+private:
+  friend class FastCgiPool;
+
+  const Config& _config;
+  ServerContext& _context;
+  CgiOutput _response;
+
+  std::string _upstream;   // Address of the application
+  std::string _params;     // Encoded PARAMS content
+  RequestBody _body;
+  size_t _bodyOffset;      // Body bytes already put into STDIN records
+  bool _inputDone;         // The empty STDIN record is queued
+  FastCgiPool::Connection *_connection; // While the application has the request
+  unsigned short _id;
+  time_t _deadline;        // Aborted with 504 when nothing arrived until then
+
+  void received(const char *data, size_t length);
+  void finish(int errorStatus);
+
+  FastCgiRequest(const FastCgiRequest&);
+  FastCgiRequest& operator=(const FastCgiRequest&);
+
+public:
+  FastCgiRequest(const Config& config, OutputQueue& output, ServerContext& context);
+  ~FastCgiRequest();
+  void setKeepAlive(bool keepAlive);
+  void setChunked(bool chunked);
+  bool keepAlive() const;
+  void start(const Route& route, const Request& request);
+
+  bool resume();
+  void checkTimeout(time_t now);
+  bool done() const;
+};
+
+#endif // FASTCGIREQUEST_HPP
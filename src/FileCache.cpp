@@ -0,0 +1,257 @@
+#include "FileCache.hpp"
+#include "Utils.hpp"
+#include <sstream>
+
+namespace
+{
+  const uint32_t WATCH_MASK = IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE
+                            | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+  std::string directoryOf(const std::string& path)
+  {
+    size_t slash = path.find_last_of('/');
+    if (slash == std::string::npos)
+      return ".";
+    return slash == 0 ? "/" : path.substr(0, slash);
+  }
+}
+
+/*
+ * FileCache keeps static files open between requests, together with what the response
+ * headers need (size, modification time, MIME type and ETag), so a hit costs no syscall.
+ * Failed lookups are remembered as well, repeated requests for a missing file skip open().
+ * Entries are invalidated by inotify events on the directories they live in. If a directory
+ * can't be watched, entries are checked with stat() once they are validSeconds old.
+ * At most maxEntries are kept, the least recently used entry is closed first. With 0 the cache
+ * is disabled: only the last few entries are kept and they are checked with stat() on every lookup.
+ * The descriptors are shared with the OutputQueues sending them, so an entry can be dropped
+ * while a transfer is still in progress.
+ * */
+FileCache::FileCache(size_t maxEntries, int validSeconds)
+  : _maxEntries(maxEntries), _validSeconds(validSeconds), _notifyFd(-1), _generation(0)
+{
+  if (_maxEntries == 0) {
+    _maxEntries = MIN_ENTRIES;
+    _validSeconds = 0;
+  } else {
+    if (_maxEntries < MIN_ENTRIES) {
+      _maxEntries = MIN_ENTRIES;
+    }
+    _notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_notifyFd == -1) {
+      std::cerr << "Warning: inotify unavailable, cached files are revalidated every "
+                << _validSeconds << "s. " << strerror(errno) << "\n";
+    }
+  }
+}
+
+FileCache::~FileCache()
+{
+  clear();
+  if (_notifyFd != -1) {
+    close(_notifyFd);
+  }
+}
+
+/*
+ * Returns the entry for path, opening the file on a miss.
+ * The reference stays valid for the next MIN_ENTRIES - 1 lookups.
+ * */
+const FileCache::Entry& FileCache::lookup(const std::string& path)
+{
+  EntryMap::iterator it = _entries.find(path);
+  if (it != _entries.end()) {
+    Entry& entry = it->second;
+    time_t now = time(NULL);
+    if (now - entry.validated < _validSeconds || !isStale(entry)) {
+      if (now - entry.validated >= _validSeconds) {
+        entry.validated = now;
+      }
+      _lru.splice(_lru.begin(), _lru, entry.lru);
+      return entry;
+    }
+    erase(it);
+  }
+
+  while (_entries.size() >= _maxEntries) {
+    erase(_entries.find(_lru.back()));
+  }
+  Entry& entry = _entries[path];
+  load(entry, path);
+  entry.watch = watchDirectory(path);
+  _lru.push_front(path);
+  entry.lru = _lru.begin();
+  return entry;
+}
+
+void FileCache::load(Entry& entry, const std::string& path)
+{
+  entry.path = path;
+  entry.exists = false;
+  entry.regular = false;
+  entry.file = NULL;
+  entry.size = 0;
+  entry.mtime = 0;
+  entry.inode = 0;
+  entry.mimeType.clear();
+  entry.etag.clear();
+  entry.lastModified.clear();
+  entry.validated = time(NULL);
+  entry.generation = ++_generation;
+  entry.watch = -1;
+
+  // O_NONBLOCK keeps open() from hanging on a FIFO, it has no effect on regular files
+  int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1) {
+    return;
+  }
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0) {
+    close(fd);
+    return;
+  }
+
+  entry.exists = true;
+  entry.regular = S_ISREG(fileStat.st_mode);
+  entry.size = fileStat.st_size;
+  entry.mtime = fileStat.st_mtime;
+  entry.inode = fileStat.st_ino;
+  if (!entry.regular) {
+    close(fd);
+    return;
+  }
+  entry.file = new SharedFile(fd);
+  entry.mimeType = Utils::getMimeType(path);
+
+  // Same format as nginx: hex modification time and size
+  std::ostringstream etag;
+  etag << std::hex << "\"" << fileStat.st_mtime << "-" << fileStat.st_size << "\"";
+  entry.etag = etag.str();
+  entry.lastModified = Utils::httpDate(fileStat.st_mtime);
+}
+
+bool FileCache::isStale(const Entry& entry) const
+{
+  struct stat fileStat;
+  if (stat(entry.path.c_str(), &fileStat) != 0) {
+    return entry.exists;
+  }
+  return !entry.exists
+      || fileStat.st_ino != entry.inode
+      || fileStat.st_size != entry.size
+      || fileStat.st_mtime != entry.mtime;
+}
+
+/*
+ * Watches the directory holding path. inotify returns the same watch for a directory
+ * that is already watched, even when it is spelled differently ("www" and "www/" for
+ * "www//a.txt", or through a symlink): every spelling is kept so events reach all entries.
+ * */
+int FileCache::watchDirectory(const std::string& path)
+{
+  if (_notifyFd == -1) {
+    return -1;
+  }
+  std::string directory = directoryOf(path);
+  int watch = inotify_add_watch(_notifyFd, directory.c_str(), WATCH_MASK);
+  if (watch == -1) {
+    return -1; // Missing directory: the entry is revalidated with stat()
+  }
+  _watchDirs[watch].insert(directory);
+  ++_watchUsers[watch];
+  return watch;
+}
+
+void FileCache::erase(EntryMap::iterator it)
+{
+  Entry& entry = it->second;
+  releaseEntry(entry);
+  _lru.erase(entry.lru);
+  if (entry.watch != -1 && --_watchUsers[entry.watch] == 0) {
+    inotify_rm_watch(_notifyFd, entry.watch);
+    _watchUsers.erase(entry.watch);
+    _watchDirs.erase(entry.watch);
+  }
+  _entries.erase(it);
+}
+
+void FileCache::releaseEntry(Entry& entry)
+{
+  if (entry.file) {
+    entry.file->release();
+    entry.file = NULL;
+  }
+}
+
+/*
+ * Drops the entry for path, for changes the server makes itself (uploads, DELETE)
+ * that must be visible to the next request before the inotify event is read.
+ * */
+void FileCache::invalidate(const std::string& path)
+{
+  EntryMap::iterator it = _entries.find(path);
+  if (it != _entries.end()) {
+    erase(it);
+  }
+}
+
+/*
+ * Reads the pending inotify events and drops the entries they concern.
+ * Called by the Server when the inotify descriptor is readable.
+ * */
+void FileCache::processEvents()
+{
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  while (true) {
+    ssize_t length = read(_notifyFd, buffer, sizeof(buffer));
+    if (length <= 0) {
+      return; // EAGAIN: all events read
+    }
+    for (char *position = buffer; position < buffer + length; ) {
+      struct inotify_event *event = reinterpret_cast<struct inotify_event*>(position);
+      position += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        clear(); // Events were lost, nothing can be trusted
+      } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+        dropDirectory(event->wd);
+      } else if (event->len > 0) {
+        std::map<int, std::set<std::string> >::iterator dir = _watchDirs.find(event->wd);
+        if (dir == _watchDirs.end()) {
+          continue;
+        }
+        // Copied: invalidating the last entry of the directory removes its watch
+        std::set<std::string> spellings = dir->second;
+        for (std::set<std::string>::iterator it = spellings.begin(); it != spellings.end(); ++it) {
+          invalidate(*it + "/" + event->name);
+        }
+      }
+    }
+  }
+}
+
+void FileCache::dropDirectory(int watch)
+{
+  EntryMap::iterator it = _entries.begin();
+  while (it != _entries.end()) {
+    EntryMap::iterator next = it;
+    ++next;
+    if (it->second.watch == watch) {
+      erase(it);
+    }
+    it = next;
+  }
+}
+
+void FileCache::clear()
+{
+  while (!_entries.empty()) {
+    erase(_entries.begin());
+  }
+}
+
+int FileCache::notifyFd() const
+{
+  return _notifyFd;
+}
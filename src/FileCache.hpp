@@ -0,0 +1,76 @@
+#ifndef FILECACHE_HPP
+#define FILECACHE_HPP
+
+#include <string>
+#include <map>
+#include <set>
+#include <list>
+#include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "SharedFile.hpp"
+
+/*
+ * Cache of open files under the document root, in the spirit of nginx's open_file_cache.
+ * Lookups that found nothing are cached too.
+ */
+class FileCache {
+public:
+  struct Entry {
+    std::string path;
+    bool exists;          // false: the lookup failed and is answered with 404
+    bool regular;         // Only regular files are kept open
+    SharedFile *file;
+    off_t size;
+    time_t mtime;
+    ino_t inode;
+    std::string mimeType;
+    std::string etag;
+    std::string lastModified; // mtime as an HTTP date
+    time_t validated;     // When the entry was last checked against the filesystem
+    unsigned long generation; // Changes every time the file is loaded again
+    int watch;            // inotify watch of the directory, -1 if none
+    std::list<std::string>::iterator lru;
+  };
+
+  // Entries returned by the last MIN_ENTRIES lookups stay valid, a request can use a file and its sidecars
+  static const size_t MIN_ENTRIES = 4;
+
+  FileCache(size_t maxEntries, int validSeconds);
+  ~FileCache();
+
+  const Entry& lookup(const std::string& path);
+  void invalidate(const std::string& path);
+  void processEvents();
+  int notifyFd() const;
+
+private:
+  typedef std::map<std::string, Entry> EntryMap;
+
+  size_t _maxEntries;
+  int _validSeconds;
+  int _notifyFd;
+  EntryMap _entries;
+  std::list<std::string> _lru;             // Most recently used first
+  std::map<int, std::set<std::string> > _watchDirs; // inotify watch -> directory, as spelled by the paths in it
+  std::map<int, size_t> _watchUsers;       // inotify watch -> number of entries in it
+  unsigned long _generation;
+
+  FileCache(const FileCache&);
+  FileCache& operator=(const FileCache&);
+
+  void load(Entry& entry, const std::string& path);
+  bool isStale(const Entry& entry) const;
+  int watchDirectory(const std::string& path);
+  void erase(EntryMap::iterator it);
+  void releaseEntry(Entry& entry);
+  void dropDirectory(int watch);
+  void clear();
+};
+
+#endif // FILECACHE_HPP
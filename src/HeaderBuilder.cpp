@@ -0,0 +1,214 @@
+#include "HeaderBuilder.hpp"
+#include <cstdio>
+#include <algorithm>
+
+namespace
+{
+  struct StatusLine {
+    int code;
+    const char *line;
+    size_t length;
+  };
+
+#define STATUS_LINE(code, reason) { code, "HTTP/1.1 " #code " " reason "\r\n", sizeof("HTTP/1.1 " #code " " reason "\r\n") - 1 }
+
+  // Most frequent first, the table is scanned in order
+  const StatusLine STATUS_LINES[] = {
+    STATUS_LINE(200, "OK"),
+    STATUS_LINE(304, "Not Modified"),
+    STATUS_LINE(206, "Partial Content"),
+    STATUS_LINE(404, "Not Found"),
+    STATUS_LINE(201, "Created"),
+    STATUS_LINE(204, "No Content"),
+    STATUS_LINE(301, "Moved Permanently"),
+    STATUS_LINE(302, "Found"),
+    STATUS_LINE(303, "See Other"),
+    STATUS_LINE(307, "Temporary Redirect"),
+    STATUS_LINE(308, "Permanent Redirect"),
+    STATUS_LINE(400, "Bad Request"),
+    STATUS_LINE(403, "Forbidden"),
+    STATUS_LINE(405, "Method Not Allowed"),
+    STATUS_LINE(408, "Request Timeout"),
+    STATUS_LINE(411, "Length Required"),
+    STATUS_LINE(412, "Precondition Failed"),
+    STATUS_LINE(413, "Content Too Large"),
+    STATUS_LINE(414, "URI Too Long"),
+    STATUS_LINE(415, "Unsupported Media Type"),
+    STATUS_LINE(416, "Range Not Satisfiable"),
+    STATUS_LINE(417, "Expectation Failed"),
+    STATUS_LINE(431, "Request Header Fields Too Large"),
+    STATUS_LINE(500, "Internal Server Error"),
+    STATUS_LINE(501, "Not Implemented"),
+    STATUS_LINE(502, "Bad Gateway"),
+    STATUS_LINE(503, "Service Unavailable"),
+    STATUS_LINE(504, "Gateway Timeout"),
+    STATUS_LINE(505, "HTTP Version Not Supported")
+  };
+
+#undef STATUS_LINE
+
+  const size_t STATUS_LINE_COUNT = sizeof(STATUS_LINES) / sizeof(STATUS_LINES[0]);
+  const size_t REASON_OFFSET = 13; // "HTTP/1.1 200 "
+
+  const StatusLine *findStatusLine(int statusCode)
+  {
+    for (size_t i = 0; i < STATUS_LINE_COUNT; ++i) {
+      if (STATUS_LINES[i].code == statusCode)
+        return &STATUS_LINES[i];
+    }
+    return NULL;
+  }
+}
+
+/*
+ * HeaderBuilder assembles a status line and header fields with plain memory copies:
+ * status lines are precomputed, numbers are formatted by hand and the Date header
+ * is formatted again only when the second changes. Each event loop owns one builder,
+ * a head must be queued before the next one is started.
+ * */
+HeaderBuilder::HeaderBuilder()
+  : _buffer(INITIAL_CAPACITY), _size(0), _dateTime(0), _dateLength(0)
+{
+}
+
+/*
+ * Starts a new head with the status line of statusCode.
+ * */
+void HeaderBuilder::status(int statusCode)
+{
+  _size = 0;
+  const StatusLine *line = findStatusLine(statusCode);
+  if (line != NULL) {
+    append(line->line, line->length);
+    return;
+  }
+  char buffer[32];
+  int length = snprintf(buffer, sizeof(buffer), "HTTP/1.1 %03d Error\r\n", statusCode);
+  append(buffer, length);
+}
+
+/*
+ * Starts a head without a status line, for header lines sent after a cached one.
+ * */
+void HeaderBuilder::clear()
+{
+  _size = 0;
+}
+
+void HeaderBuilder::header(const StringView& name, const StringView& value)
+{
+  append(name.data, name.length);
+  append(": ", 2);
+  append(value.data, value.length);
+  append("\r\n", 2);
+}
+
+void HeaderBuilder::header(const StringView& name, off_t value)
+{
+  append(name.data, name.length);
+  append(": ", 2);
+  appendNumber(value);
+  append("\r\n", 2);
+}
+
+/*
+ * Appends "Content-Range: bytes first-last/size", with "*" for the range if first is negative (416).
+ * */
+void HeaderBuilder::contentRange(off_t first, off_t last, off_t size)
+{
+  static const char NAME[] = "Content-Range: bytes ";
+  append(NAME, sizeof(NAME) - 1);
+  if (first < 0) {
+    append("*", 1);
+  } else {
+    appendNumber(first);
+    append("-", 1);
+    appendNumber(last);
+  }
+  append("/", 1);
+  appendNumber(size);
+  append("\r\n", 2);
+}
+
+/*
+ * Appends complete header lines, each ending with CRLF.
+ * */
+void HeaderBuilder::raw(const StringView& lines)
+{
+  append(lines.data, lines.length);
+}
+
+/*
+ * Appends the Date header (RFC 9110 section 6.6.1) for the current second.
+ * */
+void HeaderBuilder::date()
+{
+  time_t now = time(NULL);
+  if (now != _dateTime || _dateLength == 0) {
+    struct tm parts;
+    gmtime_r(&now, &parts);
+    _dateLength = strftime(_dateLine, sizeof(_dateLine), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &parts);
+    _dateTime = now;
+  }
+  append(_dateLine, _dateLength);
+}
+
+/*
+ * Ends the head with the empty line.
+ * */
+void HeaderBuilder::end()
+{
+  append("\r\n", 2);
+}
+
+const char *HeaderBuilder::data() const
+{
+  return &_buffer[0];
+}
+
+size_t HeaderBuilder::size() const
+{
+  return _size;
+}
+
+std::string HeaderBuilder::str() const
+{
+  return std::string(&_buffer[0], _size);
+}
+
+/*
+ * Reason phrase of statusCode, "Error" for codes the table doesn't have.
+ * */
+StringView HeaderBuilder::reasonPhrase(int statusCode)
+{
+  const StatusLine *line = findStatusLine(statusCode);
+  if (line == NULL) {
+    return "Error";
+  }
+  return StringView(line->line + REASON_OFFSET, line->length - REASON_OFFSET - 2);
+}
+
+void HeaderBuilder::append(const char *data, size_t length)
+{
+  if (_size + length > _buffer.size()) {
+    _buffer.resize(std::max(_buffer.size() * 2, _size + length));
+  }
+  memcpy(&_buffer[_size], data, length);
+  _size += length;
+}
+
+void HeaderBuilder::appendNumber(off_t value)
+{
+  char digits[24];
+  size_t start = sizeof(digits);
+  bool negative = value < 0;
+  unsigned long long number = negative ? -static_cast<unsigned long long>(value) : value;
+  do {
+    digits[--start] = '0' + number % 10;
+    number /= 10;
+  } while (number > 0);
+  if (negative) {
+    digits[--start] = '-';
+  }
+  append(digits + start, sizeof(digits) - start);
+}
@@ -0,0 +1,44 @@
+#ifndef HEADERBUILDER_HPP
+#define HEADERBUILDER_HPP
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <sys/types.h>
+#include "StringView.hpp"
+
+/*
+ * Writes response heads into a buffer that is reused from one response to the next.
+ */
+class HeaderBuilder {
+public:
+  HeaderBuilder();
+
+  void status(int statusCode);
+  void clear();
+  void header(const StringView& name, const StringView& value);
+  void header(const StringView& name, off_t value);
+  void raw(const StringView& lines);
+  void contentRange(off_t first, off_t last, off_t size);
+  void date();
+  void end();
+  const char *data() const;
+  size_t size() const;
+  std::string str() const;
+
+  static StringView reasonPhrase(int statusCode);
+
+private:
+  static const size_t INITIAL_CAPACITY = 1024;
+
+  std::vector<char> _buffer;
+  size_t _size;
+  time_t _dateTime;    // Second _dateLine was formatted for
+  char _dateLine[64];  // "Date: ...\r\n"
+  size_t _dateLength;
+
+  void append(const char *data, size_t length);
+  void appendNumber(off_t value);
+};
+
+#endif // HEADERBUILDER_HPP
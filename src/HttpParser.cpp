@@ -0,0 +1,640 @@
+#include "HttpParser.hpp"
+#include "Scan.hpp"
+
+namespace
+{
+  const char VERSION_PREFIX[] = "HTTP/";
+
+  struct KnownHeader {
+    const char *name;
+    size_t length;
+  };
+
+#define KNOWN_HEADER(name) { name, sizeof(name) - 1 }
+  // Lowercase names in HeaderId order
+  const KnownHeader KNOWN_HEADERS[HEADER_COUNT] = {
+    KNOWN_HEADER("host"),
+    KNOWN_HEADER("content-length"),
+    KNOWN_HEADER("content-type"),
+    KNOWN_HEADER("connection"),
+    KNOWN_HEADER("transfer-encoding"),
+    KNOWN_HEADER("range"),
+    KNOWN_HEADER("if-range"),
+    KNOWN_HEADER("if-match"),
+    KNOWN_HEADER("if-none-match"),
+    KNOWN_HEADER("if-modified-since"),
+    KNOWN_HEADER("if-unmodified-since"),
+    KNOWN_HEADER("accept-encoding"),
+    KNOWN_HEADER("expect"),
+    KNOWN_HEADER("cookie"),
+    KNOWN_HEADER("user-agent")
+  };
+#undef KNOWN_HEADER
+
+  const unsigned int ALL_HEADERS = (1u << HEADER_COUNT) - 1;
+
+  // tchar from RFC 9110: the characters allowed in methods and header names
+  bool isTokenChar(unsigned char c)
+  {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+      return true;
+    return c != '\0' && strchr("!#$%&'*+-.^_`|~", c) != NULL;
+  }
+
+  // Bytes allowed in a header value (field-vchar, obs-text and whitespace)
+  bool isValueChar(unsigned char c)
+  {
+    return c >= ' ' ? c != 0x7f : c == '\t';
+  }
+
+  char toLower(char c)
+  {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+  }
+
+  int hexValue(char c)
+  {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+    return -1;
+  }
+
+  // unreserved from RFC 3986: percent-encoding them changes nothing, they are decoded
+  bool isUnreservedChar(char c)
+  {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+        || c == '-' || c == '.' || c == '_' || c == '~';
+  }
+}
+
+/*
+ * HttpParser is a state machine over the bytes of the request head.
+ * parse() can be called with each newly received span, the state is kept between calls.
+ * Runs of URL and header value bytes are skipped with the Scan kernels, everything else goes
+ * through step() one byte at a time. Header names are matched case-insensitively against
+ * the well-known names while they are parsed, so looking one up later is an array access,
+ * and Content-Length is decoded while it is parsed.
+ * Errors map to the status the server should answer with:
+ * 400 for malformed requests, 431 for heads larger than maxHeadLength and 505 for versions other than 1.x.
+ * */
+HttpParser::HttpParser(size_t maxHeadLength) : _maxHeadLength(maxHeadLength)
+{
+  reset();
+}
+
+void HttpParser::reset()
+{
+  _state = STATE_START;
+  _status = PARSE_INCOMPLETE;
+  _errorStatus = 0;
+  _position = 0;
+  _method.offset = _method.length = 0;
+  _url.offset = _url.length = 0;
+  _version.offset = _version.length = 0;
+  _extraHeaders.clear();
+  _headerCount = 0;
+  for (int id = 0; id < HEADER_COUNT; ++id) {
+    _headerIndex[id] = -1;
+  }
+  _current.id = HEADER_OTHER;
+  _valueEnd = 0;
+  _nameCandidates = 0;
+  _hasContentLength = false;
+  _contentLengthDigits = false;
+  _contentLengthEnded = false;
+  _contentLength = 0;
+  _pendingLength = 0;
+}
+
+HttpParser::Status HttpParser::fail(int status)
+{
+  _status = PARSE_ERROR;
+  _errorStatus = status;
+  return _status;
+}
+
+HttpParser::Status HttpParser::parse(const char *data, size_t length)
+{
+  size_t i = 0;
+  while (i < length && _status == PARSE_INCOMPLETE) {
+    if (_position >= _maxHeadLength) {
+      return fail(431);
+    }
+
+    size_t budget = _maxHeadLength - _position;
+    size_t available = (length - i) < budget ? (length - i) : budget;
+    size_t skipped = 0;
+    if (_state == STATE_URL) {
+      skipped = skipUrl(data + i, available);
+    } else if (_state == STATE_HEADER_VALUE) {
+      skipped = skipValue(data + i, available);
+    }
+    if (skipped > 0) {
+      i += skipped;
+      _position += skipped;
+      continue;
+    }
+
+    step(data[i]);
+    ++i;
+    ++_position;
+  }
+  return _status;
+}
+
+size_t HttpParser::skipUrl(const char *data, size_t length)
+{
+  const char *end = Scan::findControl(data, length, 0x21);
+  return end ? end - data : length;
+}
+
+/*
+ * Skips plain value bytes and remembers where the last non-whitespace one was.
+ * Content-Length values go through step() so their digits get decoded.
+ * */
+size_t HttpParser::skipValue(const char *data, size_t length)
+{
+  if (_current.id == HEADER_CONTENT_LENGTH) {
+    return 0;
+  }
+  // Stops at CR, LF, a tab or an invalid byte, step() sorts them out
+  const char *end = Scan::findControl(data, length, 0x20);
+  size_t run = end ? end - data : length;
+
+  size_t last = run;
+  while (last > 0 && data[last - 1] == ' ') {
+    --last;
+  }
+  if (last > 0) {
+    _valueEnd = _position + last;
+  }
+  return run;
+}
+
+void HttpParser::step(char c)
+{
+  unsigned char byte = static_cast<unsigned char>(c);
+
+  switch (_state) {
+    case STATE_START:
+      // Empty lines before the request line are ignored (RFC 9112 section 2.2)
+      if (c == '\r' || c == '\n') {
+        return;
+      }
+      if (!isTokenChar(byte)) {
+        fail(400);
+        return;
+      }
+      _method.offset = _position;
+      _method.length = 1;
+      _state = STATE_METHOD;
+      return;
+
+    case STATE_METHOD:
+      if (c == ' ') {
+        _url.offset = _position + 1;
+        _url.length = 0;
+        _state = STATE_URL;
+      } else if (isTokenChar(byte)) {
+        ++_method.length;
+      } else {
+        fail(400);
+      }
+      return;
+
+    case STATE_URL:
+      // Reached with the byte that ended the run of URL characters
+      if (c != ' ' || _position == _url.offset) {
+        fail(400);
+        return;
+      }
+      _url.length = _position - _url.offset;
+      _version.offset = _position + 1;
+      _version.length = 0;
+      _state = STATE_VERSION;
+      return;
+
+    case STATE_VERSION:
+      if (c == '\r' || c == '\n') {
+        if (_version.length != 8) {
+          fail(400);
+          return;
+        }
+        _state = (c == '\r') ? STATE_REQUEST_LINE_LF : STATE_HEADER_START;
+        return;
+      }
+      checkVersion(c);
+      return;
+
+    case STATE_REQUEST_LINE_LF:
+    case STATE_HEADER_LF:
+      if (c != '\n') {
+        fail(400);
+        return;
+      }
+      if (_state == STATE_HEADER_LF) {
+        finishHeader();
+      }
+      _state = STATE_HEADER_START;
+      return;
+
+    case STATE_HEADER_START:
+      if (c == '\r') {
+        _state = STATE_HEAD_END_LF;
+        return;
+      }
+      if (c == '\n') {
+        _status = PARSE_DONE;
+        return;
+      }
+      if (!isTokenChar(byte)) {
+        fail(400); // Also rejects obsolete line folding
+        return;
+      }
+      _current.name.offset = _position;
+      _current.name.length = 1;
+      _current.id = HEADER_OTHER;
+      _nameCandidates = ALL_HEADERS;
+      matchName(c);
+      _state = STATE_HEADER_NAME;
+      return;
+
+    case STATE_HEADER_NAME:
+      if (c == ':') {
+        resolveName();
+        if (_current.id == HEADER_CONTENT_LENGTH) {
+          _contentLengthDigits = false;
+          _contentLengthEnded = false;
+          _pendingLength = 0;
+        }
+        _state = STATE_HEADER_VALUE_START;
+        return;
+      }
+      if (!isTokenChar(byte)) {
+        fail(400);
+        return;
+      }
+      ++_current.name.length;
+      matchName(c);
+      return;
+
+    case STATE_HEADER_VALUE_START:
+      if (c == ' ' || c == '\t') {
+        return;
+      }
+      _current.value.offset = _position;
+      _valueEnd = _position;
+      _state = STATE_HEADER_VALUE;
+      // fall through
+    case STATE_HEADER_VALUE:
+      if (c == '\r' || c == '\n') {
+        _current.value.length = _valueEnd - _current.value.offset;
+        if (c == '\r') {
+          _state = STATE_HEADER_LF;
+        } else {
+          finishHeader();
+          _state = STATE_HEADER_START;
+        }
+        return;
+      }
+      if (!isValueChar(byte)) {
+        fail(400);
+        return;
+      }
+      if (c != ' ' && c != '\t') {
+        _valueEnd = _position + 1;
+      }
+      if (_current.id == HEADER_CONTENT_LENGTH) {
+        parseContentLength(c);
+      }
+      return;
+
+    case STATE_HEAD_END_LF:
+      if (c != '\n') {
+        fail(400);
+        return;
+      }
+      _status = PARSE_DONE;
+      return;
+  }
+}
+
+/*
+ * Narrows down the well-known names the current header can still be.
+ * */
+void HttpParser::matchName(char c)
+{
+  size_t index = _position - _current.name.offset;
+  char lower = toLower(c);
+  unsigned int candidates = _nameCandidates;
+  while (candidates) {
+    int id = __builtin_ctz(candidates);
+    candidates &= candidates - 1;
+    if (index >= KNOWN_HEADERS[id].length || KNOWN_HEADERS[id].name[index] != lower)
+      _nameCandidates &= ~(1u << id);
+  }
+}
+
+/*
+ * Called on the colon: the name is a well-known one if a candidate of the same length is left.
+ * */
+void HttpParser::resolveName()
+{
+  unsigned int candidates = _nameCandidates;
+  while (candidates) {
+    int id = __builtin_ctz(candidates);
+    candidates &= candidates - 1;
+    if (KNOWN_HEADERS[id].length == _current.name.length) {
+      _current.id = static_cast<HeaderId>(id);
+      break;
+    }
+  }
+  _nameCandidates = 0;
+}
+
+/*
+ * Content-Length must be a plain decimal number, whitespace is only allowed around it.
+ * */
+void HttpParser::parseContentLength(char c)
+{
+  if (c == ' ' || c == '\t') {
+    _contentLengthEnded = _contentLengthDigits;
+    return;
+  }
+  if (c < '0' || c > '9' || _contentLengthEnded) {
+    fail(400);
+    return;
+  }
+  size_t digit = c - '0';
+  if (_pendingLength > (static_cast<size_t>(-1) - digit) / 10) {
+    fail(413);
+    return;
+  }
+  _pendingLength = _pendingLength * 10 + digit;
+  _contentLengthDigits = true;
+}
+
+void HttpParser::checkVersion(char c)
+{
+  size_t index = _version.length;
+  ++_version.length;
+  if (index < sizeof(VERSION_PREFIX) - 1) {
+    if (c != VERSION_PREFIX[index])
+      fail(400);
+  } else if (index == 5) {
+    if (c < '0' || c > '9')
+      fail(400);
+    else if (c != '1')
+      fail(505);
+  } else if (index == 6) {
+    if (c != '.')
+      fail(400);
+  } else if (index == 7) {
+    if (c < '0' || c > '9')
+      fail(400);
+  } else {
+    fail(400);
+  }
+}
+
+void HttpParser::finishHeader()
+{
+  if (_headerCount == MAX_HEADERS) {
+    fail(431);
+    return;
+  }
+  if (_current.id == HEADER_CONTENT_LENGTH) {
+    if (!_contentLengthDigits) {
+      fail(400);
+      return;
+    }
+    // Repeated Content-Length headers must agree
+    if (_hasContentLength && _pendingLength != _contentLength) {
+      fail(400);
+      return;
+    }
+    _hasContentLength = true;
+    _contentLength = _pendingLength;
+  }
+  if (_current.id != HEADER_OTHER && _headerIndex[_current.id] == -1) {
+    _headerIndex[_current.id] = static_cast<short>(_headerCount);
+  }
+  if (_headerCount < INLINE_HEADERS) {
+    _inlineHeaders[_headerCount] = _current;
+  } else {
+    _extraHeaders.push_back(_current);
+  }
+  ++_headerCount;
+}
+
+HttpParser::Status HttpParser::status() const
+{
+  return _status;
+}
+
+int HttpParser::errorStatus() const
+{
+  return _errorStatus;
+}
+
+/*
+ * Number of bytes parsed so far: the length of the request head,
+ * including the empty line, once parse() returned PARSE_DONE.
+ * */
+size_t HttpParser::headLength() const
+{
+  return _position;
+}
+
+const HttpParser::Slice& HttpParser::method() const
+{
+  return _method;
+}
+
+const HttpParser::Slice& HttpParser::url() const
+{
+  return _url;
+}
+
+const HttpParser::Slice& HttpParser::version() const
+{
+  return _version;
+}
+
+size_t HttpParser::headerCount() const
+{
+  return _headerCount;
+}
+
+const HttpParser::HeaderField& HttpParser::header(size_t index) const
+{
+  if (index < INLINE_HEADERS) {
+    return _inlineHeaders[index];
+  }
+  return _extraHeaders[index - INLINE_HEADERS];
+}
+
+/*
+ * Index of the first header with a well-known name, -1 if the request has none.
+ * */
+int HttpParser::headerIndex(HeaderId id) const
+{
+  if (id == HEADER_OTHER) {
+    return -1;
+  }
+  return _headerIndex[id];
+}
+
+bool HttpParser::hasContentLength() const
+{
+  return _hasContentLength;
+}
+
+size_t HttpParser::contentLength() const
+{
+  return _contentLength;
+}
+
+/*
+ * Rewrites the path of an origin-form URL in place (head is the start of the request) as
+ * RFC 3986 section 6.2.2 asks: percent-encoded unreserved characters are decoded, "." and
+ * ".." segments are removed (section 5.2.4) and runs of '/' collapsed, so "/a//b/./../c"
+ * and "/a/%2E%2E/a/c" both become "/a/c". Routes, file paths and caches only ever see this
+ * one spelling. The URL gets shorter, the query string moves along.
+ * A ".." above the root is answered with 400 and false is returned.
+ * */
+bool HttpParser::normalizeUrl(char *head)
+{
+  char *path = head + _url.offset;
+  if (_status != PARSE_DONE || _url.length == 0 || path[0] != '/') {
+    return _status == PARSE_DONE; // "*" or absolute-form, no route matches them
+  }
+  size_t length = 0;
+  while (length < _url.length && path[length] != '?') {
+    ++length;
+  }
+
+  // Output never grows, it is written behind the input: out <= in
+  size_t in = 0;
+  size_t out = 0;
+  while (in < length) {
+    while (in < length && path[in] == '/') {
+      ++in;
+    }
+    path[out] = '/';
+    size_t segment = out + 1;
+    size_t end = segment;
+    while (in < length && path[in] != '/') {
+      char c = path[in++];
+      int high, low;
+      if (c == '%' && in + 1 < length && (high = hexValue(path[in])) >= 0 && (low = hexValue(path[in + 1])) >= 0) {
+        char decoded = static_cast<char>(high * 16 + low);
+        if (isUnreservedChar(decoded)) {
+          c = decoded;
+          in += 2;
+        }
+      }
+      path[end++] = c;
+    }
+
+    StringView name(path + segment, end - segment);
+    if (name == "..") {
+      if (out == 0) {
+        fail(400); // Climbs above the root
+        return false;
+      }
+      do {
+        --out;
+      } while (path[out] != '/');
+    } else if (name != ".") {
+      out = end;
+      continue;
+    }
+    if (in == length) {
+      ++out; // "/a/." and "/a/b/.." end with the directory: "/a/"
+    }
+  }
+
+  size_t query = _url.length - length;
+  memmove(path + out, path + length, query);
+  _url.length = out + query;
+  return true;
+}
+
+/*
+ * Checks the Transfer-Encoding of the parsed head (head is the start of the request) as
+ * RFC 9112 section 6.1 asks. All Transfer-Encoding lines form one list of codings, of which
+ * chunked must be the last and appear once, and a request can't have both Transfer-Encoding
+ * and Content-Length. Returns the status to reject the request with (400, or 501 for
+ * codings before chunked, which the server doesn't decode), 0 if its framing is valid.
+ * chunked is set if the body is chunked.
+ * */
+int HttpParser::transferEncodingError(const char *head, bool& chunked) const
+{
+  chunked = false;
+  if (headerIndex(HEADER_TRANSFER_ENCODING) == -1) {
+    return 0;
+  }
+  if (_hasContentLength) {
+    return 400; // Both framings at once is a smuggling attempt
+  }
+  size_t codings = 0;
+  size_t chunkedAt = 0;
+  size_t chunkedCount = 0;
+  for (size_t i = headerIndex(HEADER_TRANSFER_ENCODING); i < _headerCount; ++i) {
+    const HeaderField& field = header(i);
+    if (field.id != HEADER_TRANSFER_ENCODING) {
+      continue;
+    }
+    StringView value(head + field.value.offset, field.value.length);
+    size_t pos = 0;
+    while (pos <= value.length) {
+      size_t end = pos;
+      while (end < value.length && value.data[end] != ',') {
+        ++end;
+      }
+      StringView coding = StringView(value.data + pos, end - pos).trim();
+      if (!coding.empty()) {
+        ++codings;
+        if (coding.equalsIgnoreCase("chunked")) {
+          ++chunkedCount;
+          chunkedAt = codings;
+        }
+      }
+      pos = end + 1;
+    }
+  }
+  if (chunkedCount != 1 || chunkedAt != codings) {
+    return 400; // Without chunked last the end of the body can't be found
+  }
+  if (codings > 1) {
+    return 501;
+  }
+  chunked = true;
+  return 0;
+}
+
+/*
+ * Maps a header name to its HeaderId, case-insensitively. HEADER_OTHER if it is not a well-known one.
+ * */
+HeaderId HttpParser::headerId(const StringView& name)
+{
+  for (int id = 0; id < HEADER_COUNT; ++id) {
+    if (name.equalsIgnoreCase(StringView(KNOWN_HEADERS[id].name, KNOWN_HEADERS[id].length))) {
+      return static_cast<HeaderId>(id);
+    }
+  }
+  return HEADER_OTHER;
+}
+
+StringView HttpParser::headerName(HeaderId id)
+{
+  if (id == HEADER_OTHER) {
+    return StringView();
+  }
+  return StringView(KNOWN_HEADERS[id].name, KNOWN_HEADERS[id].length);
+}
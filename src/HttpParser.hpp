@@ -0,0 +1,133 @@
+#ifndef HTTPPARSER_HPP
+#define HTTPPARSER_HPP
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <sys/types.h>
+#include "StringView.hpp"
+
+/*
+ * Headers the server looks at, resolved while the name is parsed.
+ * HEADER_OTHER is any other name, looked up by comparing the names.
+ */
+enum HeaderId {
+  HEADER_HOST,
+  HEADER_CONTENT_LENGTH,
+  HEADER_CONTENT_TYPE,
+  HEADER_CONNECTION,
+  HEADER_TRANSFER_ENCODING,
+  HEADER_RANGE,
+  HEADER_IF_RANGE,
+  HEADER_IF_MATCH,
+  HEADER_IF_NONE_MATCH,
+  HEADER_IF_MODIFIED_SINCE,
+  HEADER_IF_UNMODIFIED_SINCE,
+  HEADER_ACCEPT_ENCODING,
+  HEADER_EXPECT,
+  HEADER_COOKIE,
+  HEADER_USER_AGENT,
+  HEADER_COUNT,
+  HEADER_OTHER = HEADER_COUNT
+};
+
+/*
+ * Resumable HTTP/1.x request head parser.
+ * It is fed the received bytes span by span as they arrive and visits every byte once.
+ * Nothing is copied: the method, URL, version and header fields are recorded
+ * as offsets from the first byte of the request.
+ */
+class HttpParser {
+public:
+  enum Status {
+    PARSE_INCOMPLETE, // Needs more bytes
+    PARSE_DONE,       // The head ends at headLength()
+    PARSE_ERROR       // Malformed request, see errorStatus()
+  };
+
+  struct Slice {
+    size_t offset;
+    size_t length;
+  };
+
+  struct HeaderField {
+    Slice name;
+    Slice value;
+    HeaderId id;
+  };
+
+  // Headers beyond INLINE_HEADERS spill into a vector, more than MAX_HEADERS is answered with 431
+  static const size_t INLINE_HEADERS = 32;
+  static const size_t MAX_HEADERS = 100;
+
+  HttpParser(size_t maxHeadLength = 16384);
+
+  static HeaderId headerId(const StringView& name);
+  static StringView headerName(HeaderId id);
+
+  void reset();
+  Status parse(const char *data, size_t length);
+  Status status() const;
+  int errorStatus() const;
+
+  size_t headLength() const;
+  const Slice& method() const;
+  const Slice& url() const;
+  const Slice& version() const;
+  size_t headerCount() const;
+  const HeaderField& header(size_t index) const;
+  int headerIndex(HeaderId id) const;
+  bool hasContentLength() const;
+  size_t contentLength() const;
+  int transferEncodingError(const char *head, bool& chunked) const;
+  bool normalizeUrl(char *head);
+
+private:
+  enum State {
+    STATE_START,
+    STATE_METHOD,
+    STATE_URL,
+    STATE_VERSION,
+    STATE_REQUEST_LINE_LF,
+    STATE_HEADER_START,
+    STATE_HEADER_NAME,
+    STATE_HEADER_VALUE_START,
+    STATE_HEADER_VALUE,
+    STATE_HEADER_LF,
+    STATE_HEAD_END_LF
+  };
+
+  size_t _maxHeadLength;
+  State _state;
+  Status _status;
+  int _errorStatus;
+  size_t _position; // Offset of the next byte from the start of the request
+
+  Slice _method;
+  Slice _url;
+  Slice _version;
+  HeaderField _inlineHeaders[INLINE_HEADERS];
+  std::vector<HeaderField> _extraHeaders;
+  size_t _headerCount;
+  short _headerIndex[HEADER_COUNT]; // First header with each well-known name, -1 if absent
+  HeaderField _current;
+  size_t _valueEnd; // One past the last non-whitespace byte of the current value
+  unsigned int _nameCandidates; // Bit per HeaderId the current name still matches
+  bool _hasContentLength;
+  bool _contentLengthDigits;
+  bool _contentLengthEnded;
+  size_t _contentLength;
+  size_t _pendingLength;
+
+  Status fail(int status);
+  void step(char c);
+  size_t skipUrl(const char *data, size_t length);
+  size_t skipValue(const char *data, size_t length);
+  void matchName(char c);
+  void resolveName();
+  void parseContentLength(char c);
+  void checkVersion(char c);
+  void finishHeader();
+};
+
+#endif // HTTPPARSER_HPP
@@ -0,0 +1,205 @@
+#include "MimeTypes.hpp"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cctype>
+#include <algorithm>
+
+namespace
+{
+  const char *BUILTIN_TYPES[][2] = {
+    { "html", "text/html" },
+    { "htm", "text/html" },
+    { "css", "text/css" },
+    { "js", "application/javascript" },
+    { "mjs", "application/javascript" },
+    { "json", "application/json" },
+    { "xml", "application/xml" },
+    { "txt", "text/plain" },
+    { "jpg", "image/jpeg" },
+    { "jpeg", "image/jpeg" },
+    { "png", "image/png" },
+    { "gif", "image/gif" },
+    { "webp", "image/webp" },
+    { "ico", "image/x-icon" },
+    { "svg", "image/svg+xml" },
+    { "pdf", "application/pdf" },
+    { "wasm", "application/wasm" },
+    { "woff", "font/woff" },
+    { "woff2", "font/woff2" },
+    { "mp4", "video/mp4" },
+    { "webm", "video/webm" },
+    { "mp3", "audio/mpeg" }
+  };
+}
+
+/*
+ * MimeTypes maps the extension of a file name to its MIME type. The table starts with the
+ * common web types and can be replaced by a mime.types file. It is a perfect hash built with
+ * hash-and-displace: extensions are grouped into buckets, and each bucket gets a seed that
+ * puts its extensions into free slots. A lookup hashes the extension twice, lowercasing
+ * on the fly, and compares a single candidate.
+ * */
+MimeTypes::MimeTypes() : _default("application/octet-stream")
+{
+  TypeMap types;
+  for (size_t i = 0; i < sizeof(BUILTIN_TYPES) / sizeof(BUILTIN_TYPES[0]); ++i) {
+    add(types, BUILTIN_TYPES[i][0], BUILTIN_TYPES[i][1]);
+  }
+  build(types);
+}
+
+/*
+ * Replaces the table with the types of a mime.types file, in the Apache format
+ * ("text/html html htm") or the nginx one ("types { text/html html htm; }").
+ * Lines starting with '#' are comments. Returns false if the file can't be read.
+ * */
+bool MimeTypes::load(const std::string& path)
+{
+  std::ifstream file(path.c_str());
+  if (!file) {
+    std::cerr << "Warning: MIME types file not found: " << path << ". Using the built-in types.\n";
+    return false;
+  }
+
+  TypeMap types;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.find('#') != std::string::npos) {
+      line.erase(line.find('#'));
+    }
+    std::istringstream words(line);
+    std::string mimeType;
+    std::string word;
+    while (words >> word) {
+      if (!word.empty() && word[word.size() - 1] == ';') {
+        word.erase(word.size() - 1);
+      }
+      if (word.empty() || word == "types" || word == "{" || word == "}") {
+        continue;
+      }
+      if (mimeType.empty()) {
+        mimeType = word;
+      } else {
+        add(types, word, mimeType);
+      }
+    }
+  }
+  build(types);
+  return true;
+}
+
+/*
+ * Returns the MIME type for the extension of filePath, application/octet-stream if it has none
+ * or it is unknown.
+ * */
+const std::string& MimeTypes::lookup(const StringView& filePath) const
+{
+  size_t dot = filePath.length;
+  while (dot > 0 && filePath.data[dot - 1] != '.' && filePath.data[dot - 1] != '/') {
+    --dot;
+  }
+  if (dot == 0 || filePath.data[dot - 1] != '.') {
+    return _default;
+  }
+  StringView extension(filePath.data + dot, filePath.length - dot);
+  uint32_t seed = _seeds[hash(extension.data, extension.length, 0) & (_seeds.size() - 1)];
+  int index = _slots[hash(extension.data, extension.length, seed) & (_slots.size() - 1)];
+  if (index == -1 || !extension.equalsIgnoreCase(_types[index].extension)) {
+    return _default;
+  }
+  return _types[index].mimeType;
+}
+
+size_t MimeTypes::size() const
+{
+  return _types.size();
+}
+
+/*
+ * Adds an extension, a later type for the same extension replaces the earlier one.
+ * */
+void MimeTypes::add(TypeMap& types, const std::string& extension, const std::string& mimeType)
+{
+  std::string lower = extension;
+  for (size_t i = 0; i < lower.size(); ++i) {
+    lower[i] = std::tolower(static_cast<unsigned char>(lower[i]));
+  }
+  types[lower] = mimeType;
+}
+
+/*
+ * Builds the table: slots are a power of two at least twice the number of extensions,
+ * buckets are placed largest first, trying seeds until all of a bucket's extensions land
+ * in free slots. If a bucket finds no seed the table doubles and the search starts over.
+ * */
+void MimeTypes::build(const TypeMap& types)
+{
+  _types.clear();
+  for (TypeMap::const_iterator it = types.begin(); it != types.end(); ++it) {
+    Type type;
+    type.extension = it->first;
+    type.mimeType = it->second;
+    _types.push_back(type);
+  }
+
+  size_t slotCount = 16;
+  while (slotCount < _types.size() * 2) {
+    slotCount *= 2;
+  }
+  while (true) {
+    size_t bucketCount = slotCount / 4;
+    std::vector<std::vector<int> > buckets(bucketCount);
+    for (size_t i = 0; i < _types.size(); ++i) {
+      buckets[hash(_types[i].extension.data(), _types[i].extension.size(), 0) & (bucketCount - 1)].push_back(i);
+    }
+    std::vector<std::pair<size_t, size_t> > order; // (size, bucket), placed largest first
+    for (size_t b = 0; b < bucketCount; ++b) {
+      order.push_back(std::make_pair(buckets[b].size(), b));
+    }
+    std::sort(order.rbegin(), order.rend());
+
+    _seeds.assign(bucketCount, 0);
+    _slots.assign(slotCount, -1);
+    bool placed = true;
+    for (size_t o = 0; o < order.size() && placed && order[o].first > 0; ++o) {
+      const std::vector<int>& bucket = buckets[order[o].second];
+      placed = false;
+      for (uint32_t seed = 1; seed < 4096 && !placed; ++seed) {
+        std::vector<size_t> slots;
+        for (size_t k = 0; k < bucket.size(); ++k) {
+          const Type& type = _types[bucket[k]];
+          size_t slot = hash(type.extension.data(), type.extension.size(), seed) & (slotCount - 1);
+          if (_slots[slot] != -1 || std::find(slots.begin(), slots.end(), slot) != slots.end())
+            break;
+          slots.push_back(slot);
+        }
+        if (slots.size() == bucket.size()) {
+          for (size_t k = 0; k < bucket.size(); ++k) {
+            _slots[slots[k]] = bucket[k];
+          }
+          _seeds[order[o].second] = seed;
+          placed = true;
+        }
+      }
+    }
+    if (placed) {
+      return;
+    }
+    slotCount *= 2;
+  }
+}
+
+/*
+ * FNV-1a over the lowercased bytes, the seed is mixed into the offset basis.
+ * */
+uint32_t MimeTypes::hash(const char *data, size_t length, uint32_t seed)
+{
+  uint32_t hash = 2166136261u ^ (seed * 16777619u);
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= static_cast<unsigned char>(std::tolower(static_cast<unsigned char>(data[i])));
+    hash *= 16777619u;
+  }
+  // Fold the high bits in, the table only uses the low ones
+  return hash ^ (hash >> 15);
+}
@@ -0,0 +1,40 @@
+#ifndef MIMETYPES_HPP
+#define MIMETYPES_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include "StringView.hpp"
+
+/*
+ * File extension to MIME type table with a minimal-probe (perfect) hash.
+ * Not thread-safe to load: fill it before the workers start, lookups are read-only.
+ */
+class MimeTypes {
+public:
+  MimeTypes();
+
+  bool load(const std::string& path);
+  const std::string& lookup(const StringView& filePath) const;
+  size_t size() const;
+
+private:
+  struct Type {
+    std::string extension; // Lowercase
+    std::string mimeType;
+  };
+
+  typedef std::map<std::string, std::string> TypeMap;
+
+  std::vector<Type> _types;
+  std::vector<uint32_t> _seeds; // Per bucket, picks the slot hash of its extensions
+  std::vector<int> _slots;      // Index into _types, -1 if empty
+  std::string _default;
+
+  static void add(TypeMap& types, const std::string& extension, const std::string& mimeType);
+  void build(const TypeMap& types);
+  static uint32_t hash(const char *data, size_t length, uint32_t seed);
+};
+
+#endif // MIMETYPES_HPP
@@ -0,0 +1,363 @@
+#include "MultipartParser.hpp"
+#include "Scan.hpp"
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * MultipartParser takes the body of a multipart/form-data request as it arrives and writes
+ * each file part to a temporary file in directory. The files are renamed to their final names
+ * once the closing delimiter arrives: an upload that fails or is cut short leaves no file
+ * behind and replaces none. Other fields are skipped.
+ * Delimiters are found with Scan::find() (SIMD). The start of a delimiter may straddle two
+ * feeds: the last delimiter length - 1 bytes are held back until more data arrives.
+ * */
+MultipartParser::MultipartParser(const std::string& boundary, const std::string& directory)
+  : _delimiter("\r\n--" + boundary),
+    _directory(directory),
+    _pending("\r\n"), // The first delimiter may open the body without a line break before it
+    _state(STATE_PREAMBLE),
+    _status(MULTIPART_INCOMPLETE),
+    _errorStatus(0),
+    _fd(-1)
+{
+}
+
+MultipartParser::~MultipartParser()
+{
+  discardPart();
+  discardFiles();
+}
+
+/*
+ * Extracts the boundary parameter of a multipart/form-data Content-Type.
+ * Returns false for other media types or a missing or invalid boundary (RFC 2046: 1 to 70 characters).
+ * */
+bool MultipartParser::boundaryFrom(const StringView& contentType, std::string& boundary)
+{
+  size_t semicolon = 0;
+  while (semicolon < contentType.length && contentType.data[semicolon] != ';')
+    ++semicolon;
+  if (!StringView(contentType.data, semicolon).trim().equalsIgnoreCase("multipart/form-data")) {
+    return false;
+  }
+
+  size_t pos = semicolon;
+  while (pos < contentType.length) {
+    size_t end = pos + 1;
+    while (end < contentType.length && contentType.data[end] != ';')
+      ++end;
+    StringView parameter = StringView(contentType.data + pos + 1, end - pos - 1).trim();
+    pos = end;
+    if (parameter.length < 9 || strncasecmp(parameter.data, "boundary=", 9) != 0)
+      continue;
+
+    StringView value(parameter.data + 9, parameter.length - 9);
+    if (value.length >= 2 && value.data[0] == '"' && value.data[value.length - 1] == '"') {
+      value = StringView(value.data + 1, value.length - 2);
+    }
+    if (value.empty() || value.length > 70) {
+      return false;
+    }
+    boundary = value.str();
+    return true;
+  }
+  return false;
+}
+
+/*
+ * Parses the next length bytes of the body.
+ * */
+void MultipartParser::feed(const char *data, size_t length)
+{
+  while (length > 0 && _status == MULTIPART_INCOMPLETE) {
+    size_t count = length < CHUNK_SIZE ? length : CHUNK_SIZE;
+    _pending.append(data, count);
+    data += count;
+    length -= count;
+    _pending.erase(0, process());
+  }
+  if (_state == STATE_EPILOGUE) {
+    _pending.clear();
+  }
+}
+
+/*
+ * Called once the whole body was fed: a body without its closing delimiter is malformed.
+ * */
+void MultipartParser::finish()
+{
+  if (_status == MULTIPART_INCOMPLETE) {
+    fail(400);
+  }
+}
+
+/*
+ * Consumes as much of _pending as the current state allows, returns the number of bytes used.
+ * */
+size_t MultipartParser::process()
+{
+  size_t used = 0;
+  while (_status == MULTIPART_INCOMPLETE) {
+    const char *data = _pending.data() + used;
+    size_t length = _pending.size() - used;
+
+    if (_state == STATE_PREAMBLE || _state == STATE_BODY) {
+      size_t pos = Scan::find(data, length, _delimiter.data(), _delimiter.size());
+      if (pos == length) {
+        // Keep what could be the beginning of a delimiter
+        size_t safe = length >= _delimiter.size() ? length - _delimiter.size() + 1 : 0;
+        if (_state == STATE_BODY && !writePart(data, safe))
+          return used;
+        return used + safe;
+      }
+      if (_state == STATE_BODY && (!writePart(data, pos) || !endPart()))
+        return used;
+      used += pos + _delimiter.size();
+      _state = STATE_DELIMITER;
+    } else if (_state == STATE_DELIMITER) {
+      // Transport padding may follow the boundary before the line break
+      size_t skip = 0;
+      while (skip < length && (data[skip] == ' ' || data[skip] == '\t'))
+        ++skip;
+      if (length - skip < 2)
+        return used + skip;
+      if (skip == 0 && data[0] == '-' && data[1] == '-') {
+        if (!commitFiles())
+          return used;
+        _state = STATE_EPILOGUE;
+        _status = MULTIPART_DONE;
+        return _pending.size();
+      }
+      if (data[skip] != '\r' || data[skip + 1] != '\n') {
+        fail(400);
+        return used;
+      }
+      used += skip + 2;
+      _state = STATE_HEADERS;
+    } else if (_state == STATE_HEADERS) {
+      // Part headers end with an empty line, which is the first line if there are none
+      size_t end;
+      if (length >= 2 && data[0] == '\r' && data[1] == '\n') {
+        end = 0;
+      } else {
+        end = Scan::find(data, length, "\r\n\r\n", 4);
+        if (end == length) {
+          if (length > MAX_PART_HEADERS)
+            fail(400);
+          return used;
+        }
+        end += 2;
+      }
+      if (!parsePartHeaders(StringView(data, end)) || !startPart())
+        return used;
+      used += end + 2;
+      _state = STATE_BODY;
+    } else {
+      return _pending.size();
+    }
+  }
+  return used;
+}
+
+/*
+ * Reads the file name from Content-Disposition, other part headers are ignored.
+ * */
+bool MultipartParser::parsePartHeaders(const StringView& headers)
+{
+  _fileName.clear();
+  size_t pos = 0;
+  while (pos < headers.length) {
+    size_t end = Scan::find(headers.data + pos, headers.length - pos, "\r\n", 2) + pos;
+    StringView line(headers.data + pos, end - pos);
+    pos = end + 2;
+
+    size_t colon = 0;
+    while (colon < line.length && line.data[colon] != ':')
+      ++colon;
+    if (colon == line.length) {
+      fail(400);
+      return false;
+    }
+    if (StringView(line.data, colon).trim().equalsIgnoreCase("Content-Disposition")) {
+      _fileName = fileNameFrom(StringView(line.data + colon + 1, line.length - colon - 1));
+    }
+  }
+  return true;
+}
+
+/*
+ * Returns the filename parameter without any directory part, empty if there is none
+ * or it can't be used as a file name.
+ * */
+std::string MultipartParser::fileNameFrom(const StringView& disposition)
+{
+  const char *key = "filename=";
+  size_t pos = 0;
+  while (pos + 9 <= disposition.length) {
+    bool atParameter = pos == 0 || disposition.data[pos - 1] == ';' || disposition.data[pos - 1] == ' '
+                       || disposition.data[pos - 1] == '\t';
+    if (atParameter && strncasecmp(disposition.data + pos, key, 9) == 0)
+      break;
+    ++pos;
+  }
+  if (pos + 9 > disposition.length) {
+    return "";
+  }
+
+  std::string name;
+  const char *value = disposition.data + pos + 9;
+  const char *end = disposition.data + disposition.length;
+  if (value < end && *value == '"') {
+    // Browsers don't escape backslashes in file names (RFC 7578 section 4.2)
+    for (++value; value < end && *value != '"'; ++value)
+      name += *value;
+  } else {
+    while (value < end && *value != ';' && *value != ' ' && *value != '\t')
+      name += *value++;
+  }
+
+  // Browsers may send a full client path
+  size_t slash = name.find_last_of("/\\");
+  if (slash != std::string::npos) {
+    name.erase(0, slash + 1);
+  }
+  if (name == "." || name == ".." || name.find('\0') != std::string::npos) {
+    return "";
+  }
+  return name;
+}
+
+/*
+ * Opens the temporary file of a file part.
+ * */
+bool MultipartParser::startPart()
+{
+  if (_fileName.empty()) {
+    return true;
+  }
+  _tempPath = _directory + "/.upload-XXXXXX";
+  _fd = mkostemp(&_tempPath[0], O_CLOEXEC);
+  if (_fd == -1) {
+    std::cerr << "Error: Failed to create upload file in " << _directory << ". " << strerror(errno) << "\n";
+    fail(500);
+    return false;
+  }
+  // mkostemp() creates the file readable by the owner only, uploads are served like any other file
+  fchmod(_fd, 0644);
+  return true;
+}
+
+bool MultipartParser::writePart(const char *data, size_t length)
+{
+  while (_fd != -1 && length > 0) {
+    ssize_t written = write(_fd, data, length);
+    if (written == -1 && errno == EINTR)
+      continue;
+    if (written <= 0) {
+      std::cerr << "Error: Failed to write upload file " << _tempPath << ". " << strerror(errno) << "\n";
+      fail(500);
+      return false;
+    }
+    data += written;
+    length -= written;
+  }
+  return true;
+}
+
+/*
+ * Keeps a complete file part in its temporary file until the whole body has arrived.
+ * */
+bool MultipartParser::endPart()
+{
+  if (_fd == -1) {
+    return true;
+  }
+  close(_fd);
+  _fd = -1;
+  _tempPaths.push_back(_tempPath);
+  _files.push_back(_fileName);
+  return true;
+}
+
+/*
+ * Moves the complete file parts to their final names once the closing delimiter is seen.
+ * If one can't be moved, the files already moved are removed with the rest.
+ * */
+bool MultipartParser::commitFiles()
+{
+  for (size_t i = 0; i < _tempPaths.size(); ++i) {
+    std::string path = _directory + "/" + _files[i];
+    if (rename(_tempPaths[i].c_str(), path.c_str()) == -1) {
+      std::cerr << "Error: Failed to rename upload file to " << path << ". " << strerror(errno) << "\n";
+      for (size_t moved = 0; moved < i; ++moved) {
+        unlink((_directory + "/" + _files[moved]).c_str());
+      }
+      _tempPaths.erase(_tempPaths.begin(), _tempPaths.begin() + i);
+      fail(500);
+      return false;
+    }
+  }
+  _tempPaths.clear();
+  return true;
+}
+
+/*
+ * Removes the temporary file of an unfinished part.
+ * */
+void MultipartParser::discardPart()
+{
+  if (_fd != -1) {
+    close(_fd);
+    _fd = -1;
+    unlink(_tempPath.c_str());
+  }
+}
+
+/*
+ * Removes the temporary files of the parts completed so far.
+ * */
+void MultipartParser::discardFiles()
+{
+  for (size_t i = 0; i < _tempPaths.size(); ++i) {
+    unlink(_tempPaths[i].c_str());
+  }
+  _tempPaths.clear();
+  _files.clear();
+}
+
+void MultipartParser::fail(int errorStatus)
+{
+  discardPart();
+  discardFiles();
+  _status = MULTIPART_ERROR;
+  _errorStatus = errorStatus;
+  _pending.clear();
+}
+
+MultipartParser::Status MultipartParser::status() const
+{
+  return _status;
+}
+
+/*
+ * HTTP status to answer a failed upload with: 400 for a malformed body, 500 if a file couldn't be written.
+ * */
+int MultipartParser::errorStatus() const
+{
+  return _errorStatus;
+}
+
+/*
+ * Names of the files written to the directory, in the order of the parts.
+ * They are only in place once the status is MULTIPART_DONE.
+ * */
+const std::vector<std::string>& MultipartParser::files() const
+{
+  return _files;
+}
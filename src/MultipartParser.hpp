@@ -0,0 +1,70 @@
+#ifndef MULTIPARTPARSER_HPP
+#define MULTIPARTPARSER_HPP
+
+#include <string>
+#include <vector>
+#include "StringView.hpp"
+
+/*
+ * Incremental multipart/form-data parser (RFC 7578) that streams file parts to disk.
+ * Memory use is bounded by the chunk size and the part header limit, not the upload size.
+ */
+class MultipartParser {
+public:
+  enum Status {
+    MULTIPART_INCOMPLETE,
+    MULTIPART_DONE,       // Closing delimiter seen, every file is in place
+    MULTIPART_ERROR
+  };
+
+  MultipartParser(const std::string& boundary, const std::string& directory);
+  ~MultipartParser();
+
+  static bool boundaryFrom(const StringView& contentType, std::string& boundary);
+
+  void feed(const char *data, size_t length);
+  void finish();
+  Status status() const;
+  int errorStatus() const;
+  const std::vector<std::string>& files() const;
+
+private:
+  enum State {
+    STATE_PREAMBLE,
+    STATE_DELIMITER,      // After a delimiter: "--" closes the body, CRLF starts a part
+    STATE_HEADERS,
+    STATE_BODY,
+    STATE_EPILOGUE
+  };
+
+  static const size_t CHUNK_SIZE = 65536;        // Input is processed in pieces of at most this size
+  static const size_t MAX_PART_HEADERS = 8192;
+
+  std::string _delimiter;      // CRLF "--" boundary
+  std::string _directory;
+  std::string _pending;        // Bytes that may still be the start of a delimiter
+  State _state;
+  Status _status;
+  int _errorStatus;
+  int _fd;                     // Temp file of the current file part, -1 for other parts
+  std::string _tempPath;
+  std::string _fileName;
+  std::vector<std::string> _files;
+  std::vector<std::string> _tempPaths; // Temporary files of the complete parts, renamed to _files at the end
+
+  MultipartParser(const MultipartParser&);
+  MultipartParser& operator=(const MultipartParser&);
+
+  size_t process();
+  bool parsePartHeaders(const StringView& headers);
+  bool startPart();
+  bool writePart(const char *data, size_t length);
+  bool endPart();
+  bool commitFiles();
+  void discardPart();
+  void discardFiles();
+  void fail(int errorStatus);
+  static std::string fileNameFrom(const StringView& disposition);
+};
+
+#endif // MULTIPARTPARSER_HPP
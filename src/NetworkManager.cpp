@@ -8,7 +8,7 @@
  * 3. accepts incoming connections and adds them to the epoll set.
  * 4. provides methods to close the socket and epoll instance.
  * */
-NetworkManager::NetworkManager(int port) : _port(port)
+NetworkManager::NetworkManager(int port, bool reusePort) : _port(port), _reusePort(reusePort)
 {
 }
 
@@ -16,10 +16,23 @@ int NetworkManager::createSocket()
 {
   // Socket is used to listen for incoming connections.
   // AF_INET - IPv4, SOCK_STREAM - TCP
-  int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+  // SOCK_CLOEXEC keeps it out of CGI scripts
+  int serverSocket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
   if (serverSocket == -1)
     throw std::runtime_error("Error: Failed to create socket. " 
                             + std::string(strerror(errno)));
+
+  // SO_REUSEADDR allows restarting while old connections are in TIME_WAIT.
+  // SO_REUSEPORT lets every worker bind its own listening socket to the same port,
+  // the kernel then balances incoming connections between them.
+  int enable = 1;
+  setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  if (_reusePort && setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1)
+  {
+    close(serverSocket);
+    throw std::runtime_error("Error: Failed to set SO_REUSEPORT. " 
+                            + std::string(strerror(errno)));
+  }
   std::cout << "Socket created successfully." << "\n";
   return serverSocket;
 }
@@ -57,10 +70,14 @@ void NetworkManager::listenForConnections(int serverSocket)
   std::cout << "Server is listening on port " << _port << "..." << "\n";
 }
 
-int NetworkManager::setupEpoll(int serverSocket)
+/*
+ * When several processes wait on the same listening socket, EPOLLEXCLUSIVE
+ * wakes up only one of them per incoming connection instead of all of them.
+ * */
+int NetworkManager::setupEpoll(int serverSocket, bool exclusive)
 {
   // Creates an epoll instance
-  int epollFd = epoll_create1(0);
+  int epollFd = epoll_create1(EPOLL_CLOEXEC);
   if (epollFd == -1)
     throw std::runtime_error("Error: Failed to create epoll instance. " 
                             + std::string(strerror(errno)));
@@ -68,6 +85,8 @@ int NetworkManager::setupEpoll(int serverSocket)
   // Add the server socket to the epoll set
   struct epoll_event event;
   event.events = EPOLLIN; // Monitor for incoming data
+  if (exclusive)
+    event.events |= EPOLLEXCLUSIVE;
   event.data.fd = serverSocket;
 
   // epoll_ctl() Add the server socket to the epoll set of monitor for incoming connections (EPOLLIN)
@@ -81,25 +100,27 @@ int NetworkManager::setupEpoll(int serverSocket)
   return epollFd;
 }
 
-Client *NetworkManager::acceptConnection(int serverSocket, int epollFd)
+Client *NetworkManager::acceptConnection(int serverSocket, int epollFd, BufferPool *bufferPool, const Config *config)
 {
   struct sockaddr_in clientAddress;
   socklen_t clientAddressLength = sizeof(clientAddress);
 
-  int clientSocket = accept(serverSocket, (struct sockaddr*)&clientAddress, &clientAddressLength);
+  // The client socket is non-blocking and is not inherited by CGI scripts
+  int clientSocket = accept4(serverSocket, (struct sockaddr*)&clientAddress, &clientAddressLength,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (clientSocket == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return NULL; // Non-blocking listener shared with other workers, nothing left to accept
   if (clientSocket == -1)
   {
     throw std::runtime_error("Error: Failed to accept client connection. " 
                             + std::string(strerror(errno)));
   }
 
-  // Set the client socket to non-blocking mode
-  int flags = fcntl(clientSocket, F_GETFL, 0); //TODO: use alternative functions to fcntl
-  fcntl(clientSocket, F_SETFL, flags | O_NONBLOCK);
-  
   // Add the client socket to the epoll set
   struct epoll_event event;
-  event.events = EPOLLIN | EPOLLET; // Monitor for incoming data (edge-triggered)
+  // Monitor for incoming data and for room in the send buffer (edge-triggered),
+  // EPOLLOUT resumes responses that did not fit in the socket buffer at once
+  event.events = EPOLLIN | EPOLLOUT | EPOLLET;
   event.data.fd = clientSocket;
   if (epoll_ctl(epollFd, EPOLL_CTL_ADD, clientSocket, &event) == -1)
   {
@@ -111,7 +132,7 @@ Client *NetworkManager::acceptConnection(int serverSocket, int epollFd)
             << ":" << ntohs(clientAddress.sin_port) << "\n";
             
   // Create and return a Client object
-  return new Client(clientSocket, clientAddress);
+  return new Client(clientSocket, clientAddress, bufferPool, config);
 }
 
 void NetworkManager::closeSocket(int& socket)
@@ -15,15 +15,16 @@
 class NetworkManager {
 private:
   int _port;
+  bool _reusePort;
 
 public:
-  NetworkManager(int port);
+  NetworkManager(int port, bool reusePort = false);
   
   int createSocket();
   void bindSocket(int serverSocket, sockaddr_in& serverAddress);
   void listenForConnections(int serverSocket);
-  int setupEpoll(int serverSocket);
-  Client *acceptConnection(int serverSocket, int epollFd);
+  int setupEpoll(int serverSocket, bool exclusive = false);
+  Client *acceptConnection(int serverSocket, int epollFd, BufferPool *bufferPool, const Config *config);
   void closeSocket(int& socket);
   void closeEpoll(int& epollFd);
 };
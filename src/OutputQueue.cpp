@@ -0,0 +1,297 @@
+#include "OutputQueue.hpp"
+#include <cstdio>
+
+namespace
+{
+  const int MAX_IOVECS = 64;
+  const size_t FILE_CHUNK_SIZE = 65536;
+}
+
+/*
+ * OutputQueue holds everything that still has to be sent on a connection:
+ * header buffers, memory slices and file segments, in order.
+ * flush() writes as much as the socket accepts, consecutive memory segments
+ * are sent with a single sendmsg() and files go from the page cache to the socket
+ * with sendfile(), without being copied through user space. When the socket is full
+ * the rest stays queued and the Server resumes flushing on the next EPOLLOUT event.
+ * */
+OutputQueue::OutputQueue() : _fileChunkStart(0), _fileChunkEnd(0)
+{
+}
+
+OutputQueue::~OutputQueue()
+{
+  clear();
+}
+
+void OutputQueue::push(const std::string& data)
+{
+  push(data.data(), data.size());
+}
+
+/*
+ * Queues a copy of length bytes at data, for buffers that are reused once this returns.
+ * */
+void OutputQueue::push(const char *data, size_t length)
+{
+  if (length == 0) {
+    return;
+  }
+  Segment segment;
+  segment.type = BUFFER_SEGMENT;
+  segment.data = NULL;
+  segment.shared = NULL;
+  segment.length = length;
+  segment.sent = 0;
+  segment.file = NULL;
+  segment.offset = 0;
+  segment.copy = false;
+  _segments.push_back(segment);
+  _segments.back().buffer.assign(data, length);
+}
+
+/*
+ * Queues a copy of length bytes framed as one chunk of a Transfer-Encoding: chunked body,
+ * so a body can be sent as it is produced without knowing its length.
+ * An empty chunk would end the body, it is skipped (see pushLastChunk).
+ * */
+void OutputQueue::pushChunk(const char *data, size_t length)
+{
+  if (length == 0) {
+    return;
+  }
+  char sizeLine[24];
+  int sizeLength = snprintf(sizeLine, sizeof(sizeLine), "%lx\r\n", static_cast<unsigned long>(length));
+  push(sizeLine, sizeLength);
+  std::string& buffer = _segments.back().buffer;
+  buffer.reserve(sizeLength + length + 2);
+  buffer.append(data, length);
+  buffer.append("\r\n", 2);
+  _segments.back().length = buffer.size();
+}
+
+/*
+ * Ends a chunked body with the zero size chunk and an empty trailer section.
+ * */
+void OutputQueue::pushLastChunk()
+{
+  pushSlice("0\r\n\r\n", 5);
+}
+
+void OutputQueue::pushSlice(const char *data, size_t length)
+{
+  if (length == 0) {
+    return;
+  }
+  Segment segment;
+  segment.type = SLICE_SEGMENT;
+  segment.data = data;
+  segment.shared = NULL;
+  segment.length = length;
+  segment.sent = 0;
+  segment.file = NULL;
+  segment.offset = 0;
+  segment.copy = false;
+  _segments.push_back(segment);
+}
+
+/*
+ * Queues a range of a shared buffer, the queue keeps it alive until the range is sent.
+ * */
+void OutputQueue::pushShared(SharedBuffer *buffer, size_t offset, size_t length)
+{
+  if (length == 0) {
+    return;
+  }
+  pushSlice(buffer->data.data() + offset, length);
+  buffer->retain();
+  _segments.back().shared = buffer;
+}
+
+/*
+ * Queues length bytes of fd starting at offset. The queue takes ownership of fd.
+ * */
+void OutputQueue::pushFile(int fd, off_t offset, size_t length)
+{
+  SharedFile *file = new SharedFile(fd);
+  pushFile(file, offset, length);
+  file->release();
+}
+
+/*
+ * Queues length bytes of a shared file, the queue keeps it open until they are sent.
+ * */
+void OutputQueue::pushFile(SharedFile *file, off_t offset, size_t length)
+{
+  if (length == 0) {
+    return;
+  }
+  file->retain();
+  Segment segment;
+  segment.type = FILE_SEGMENT;
+  segment.data = NULL;
+  segment.shared = NULL;
+  segment.length = length;
+  segment.sent = 0;
+  segment.file = file;
+  segment.offset = offset;
+  segment.copy = false;
+  _segments.push_back(segment);
+}
+
+OutputQueue::FlushResult OutputQueue::flush(int socket)
+{
+  while (!_segments.empty()) {
+    ssize_t written;
+    if (_segments.front().type == FILE_SEGMENT) {
+      written = writeFileSegment(socket, _segments.front());
+    } else {
+      written = writeMemorySegments(socket);
+    }
+
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return FLUSH_AGAIN;
+      }
+      return FLUSH_ERROR;
+    }
+    consume(written);
+  }
+  return FLUSH_DONE;
+}
+
+/*
+ * Headers followed by a file are sent with MSG_MORE, so the kernel holds them back
+ * and they leave in the same TCP segment as the start of the file.
+ * */
+ssize_t OutputQueue::writeMemorySegments(int socket)
+{
+  struct iovec iov[MAX_IOVECS];
+  int count = 0;
+
+  std::deque<Segment>::iterator it = _segments.begin();
+  for (; it != _segments.end() && it->type != FILE_SEGMENT && count < MAX_IOVECS; ++it) {
+    const char *data = (it->type == BUFFER_SEGMENT) ? it->buffer.data() : it->data;
+    iov[count].iov_base = const_cast<char*>(data + it->sent);
+    iov[count].iov_len = it->length - it->sent;
+    ++count;
+  }
+
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = iov;
+  message.msg_iovlen = count;
+  int flags = (it != _segments.end() && it->type == FILE_SEGMENT) ? MSG_MORE : 0;
+  ssize_t written = sendmsg(socket, &message, flags | MSG_NOSIGNAL);
+  if (written == -1 && errno == ENOTSOCK) {
+    return writev(socket, iov, count);
+  }
+  return written;
+}
+
+/*
+ * File segments are sent with sendfile(), which advances through the file from the
+ * segment's offset, so a transfer cut short by EAGAIN resumes where it stopped.
+ * Files sendfile() can't read fall back to copying through a chunk buffer.
+ * */
+ssize_t OutputQueue::writeFileSegment(int socket, Segment& segment)
+{
+  if (segment.copy) {
+    return copyFileSegment(socket, segment);
+  }
+
+  off_t offset = segment.offset + segment.sent;
+  ssize_t written = sendfile(socket, segment.file->fd, &offset, segment.length - segment.sent);
+  if (written == -1 && (errno == EINVAL || errno == ENOSYS) && segment.sent == 0) {
+    segment.copy = true;
+    return copyFileSegment(socket, segment);
+  }
+  if (written == 0) {
+    // The file shrank: the announced length can't be honored
+    errno = EIO;
+    return -1;
+  }
+  return written;
+}
+
+/*
+ * File segments are read in chunks with pread() and written from the chunk buffer.
+ * Bytes of a chunk the socket did not take are sent first on the next call.
+ * */
+ssize_t OutputQueue::copyFileSegment(int socket, Segment& segment)
+{
+  if (_fileChunkStart == _fileChunkEnd) {
+    size_t remaining = segment.length - segment.sent;
+    size_t toRead = remaining < FILE_CHUNK_SIZE ? remaining : FILE_CHUNK_SIZE;
+    _fileChunk.resize(FILE_CHUNK_SIZE);
+
+    ssize_t bytesRead = pread(segment.file->fd, &_fileChunk[0], toRead, segment.offset + segment.sent);
+    if (bytesRead <= 0) {
+      // The file shrank or can't be read: the announced length can't be honored
+      errno = (bytesRead == 0) ? EIO : errno;
+      return -1;
+    }
+    _fileChunkStart = 0;
+    _fileChunkEnd = bytesRead;
+  }
+
+  ssize_t written = write(socket, &_fileChunk[_fileChunkStart], _fileChunkEnd - _fileChunkStart);
+  if (written > 0) {
+    _fileChunkStart += written;
+  }
+  return written;
+}
+
+/*
+ * Drops the bytes that were written from the front of the queue.
+ * */
+void OutputQueue::consume(size_t bytes)
+{
+  while (bytes > 0 && !_segments.empty()) {
+    Segment& front = _segments.front();
+    size_t remaining = front.length - front.sent;
+    if (bytes < remaining) {
+      front.sent += bytes;
+      return;
+    }
+    bytes -= remaining;
+    popFront();
+  }
+}
+
+void OutputQueue::popFront()
+{
+  if (_segments.front().shared) {
+    _segments.front().shared->release();
+  }
+  if (_segments.front().type == FILE_SEGMENT) {
+    _segments.front().file->release();
+    _fileChunkStart = 0;
+    _fileChunkEnd = 0;
+  }
+  _segments.pop_front();
+}
+
+void OutputQueue::clear()
+{
+  while (!_segments.empty()) {
+    popFront();
+  }
+}
+
+bool OutputQueue::empty() const
+{
+  return _segments.empty();
+}
+
+size_t OutputQueue::pendingBytes() const
+{
+  size_t total = 0;
+  for (std::deque<Segment>::const_iterator it = _segments.begin(); it != _segments.end(); ++it) {
+    total += it->length - it->sent;
+  }
+  return total;
+}
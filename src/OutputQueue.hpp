@@ -0,0 +1,75 @@
+#ifndef OUTPUTQUEUE_HPP
+#define OUTPUTQUEUE_HPP
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <cstring>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include "SharedFile.hpp"
+#include "SharedBuffer.hpp"
+
+class OutputQueue {
+public:
+  enum FlushResult {
+    FLUSH_DONE,   // Everything was written
+    FLUSH_AGAIN,  // The socket is full, wait for EPOLLOUT
+    FLUSH_ERROR   // The connection is broken
+  };
+
+  OutputQueue();
+  ~OutputQueue();
+
+  void push(const std::string& data);
+  void push(const char *data, size_t length);
+  void pushChunk(const char *data, size_t length);
+  void pushLastChunk();
+  void pushSlice(const char *data, size_t length);
+  void pushShared(SharedBuffer *buffer, size_t offset, size_t length);
+  void pushFile(int fd, off_t offset, size_t length);
+  void pushFile(SharedFile *file, off_t offset, size_t length);
+  FlushResult flush(int socket);
+  void clear();
+  bool empty() const;
+  size_t pendingBytes() const;
+
+private:
+  enum SegmentType {
+    BUFFER_SEGMENT, // Owned copy of generated data (headers, small bodies)
+    SLICE_SEGMENT,  // Memory owned by someone else that outlives the queue entry, or a shared buffer
+    FILE_SEGMENT    // Range of an open file, the queue holds a reference to it
+  };
+
+  struct Segment {
+    SegmentType type;
+    std::string buffer;
+    const char *data;
+    SharedBuffer *shared; // Reference held by a slice of a shared buffer
+    size_t length;
+    size_t sent;
+    SharedFile *file;
+    off_t offset;
+    bool copy; // sendfile() is not supported for this file, send it through _fileChunk
+  };
+
+  std::deque<Segment> _segments;
+  std::vector<char> _fileChunk;
+  size_t _fileChunkStart;
+  size_t _fileChunkEnd;
+
+  OutputQueue(const OutputQueue&);
+  OutputQueue& operator=(const OutputQueue&);
+
+  ssize_t writeMemorySegments(int socket);
+  ssize_t writeFileSegment(int socket, Segment& segment);
+  ssize_t copyFileSegment(int socket, Segment& segment);
+  void consume(size_t bytes);
+  void popFront();
+};
+
+#endif // OUTPUTQUEUE_HPP
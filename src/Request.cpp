@@ -1,66 +1,260 @@
 #include "Request.hpp"
-#include <sstream>
 #include <algorithm>
+#include <cstring>
 #include <iostream>
 
 /*
   * Request class represents an HTTP request.
-  * It receives a raw request string (for example "GET /index.html HTTP/1.1")
-  * and parses it into the HTTP method, URL, headers, and body.
+  * The request line and headers are not copied: the getters return views into the receive buffer
+  * of the Client, which stays untouched until the response is queued, and headers are looked up
+  * in the table the HttpParser filled while parsing.
+  * A Request can also be built from a raw request string (for example "GET /index.html HTTP/1.1"),
+  * it then keeps its own copy of the string and its own parser.
  */
-Request::Request() {}
+Request::Request() : _head(NULL), _parser(NULL), _ownedParser(NULL), _upload(NULL)
+{
+}
 
-Request::Request(const std::string &rawRequest)
+Request::Request(const std::string &rawRequest) : _head(NULL), _parser(NULL), _ownedParser(NULL), _upload(NULL)
 {
   parseRequest(rawRequest);
 }
 
-void Request::parseRequest(const std::string &rawRequest)
+Request::Request(const char *head, const HttpParser &parser)
+  : _head(head), _parser(&parser), _ownedParser(NULL), _upload(NULL)
+{
+}
+
+Request::Request(const Request &other)
+  : _storage(other._storage),
+    _head(other._head),
+    _parser(other._parser),
+    _ownedParser(NULL),
+    _body(other._body),
+    _upload(other._upload),
+    _remoteAddress(other._remoteAddress)
 {
-  std::istringstream requestStream(rawRequest);
-  std::string line;
-
-  // Parse the request line (for example "GET /index.html HTTP/1.1")
-  std::getline(requestStream, line);
-  std::istringstream requestLineStream(line);
-  requestLineStream >> _method >> _url;
-
-  // Parse headers (for example "Host: localhost::8080")
-  while (std::getline(requestStream, line) && line != "\r") // Why "\r"?
-  {
-    size_t colonPos = line.find(':');
-    if (colonPos != std::string::npos)
-    {
-      std::string key = line.substr(0, colonPos);
-      std::string value = line.substr(colonPos + 2); // Skip ": " after the colon
-      _headers[key] = value;
+  if (other._ownedParser) {
+    _ownedParser = new HttpParser(*other._ownedParser);
+    _parser = _ownedParser;
+    _head = _storage.data();
+  }
+}
+
+Request &Request::operator=(const Request &other)
+{
+  if (this != &other) {
+    Request copy(other);
+    std::swap(_storage, copy._storage);
+    std::swap(_head, copy._head);
+    std::swap(_parser, copy._parser);
+    std::swap(_ownedParser, copy._ownedParser);
+    std::swap(_body, copy._body);
+    std::swap(_upload, copy._upload);
+    std::swap(_remoteAddress, copy._remoteAddress);
+    if (_ownedParser) {
+      _head = _storage.data();
     }
   }
+  return *this;
+}
+
+Request::~Request()
+{
+  delete _ownedParser;
+}
+
+void Request::parseRequest(const std::string &rawRequest)
+{
+  _storage = rawRequest;
+  _head = _storage.data();
+
+  _ownedParser = new HttpParser(_storage.size() + 1);
+  _ownedParser->parse(_storage.data(), _storage.size());
+  _ownedParser->normalizeUrl(&_storage[0]);
+  _parser = _ownedParser;
+
+  // Everything after the head is the body
+  if (isValid()) {
+    _body = RequestBody(_storage.substr(_parser->headLength()));
+  }
+}
+
+StringView Request::slice(const HttpParser::Slice &slice) const
+{
+  return StringView(_head + slice.offset, slice.length);
+}
+
+bool Request::isValid() const
+{
+  return _parser != NULL && _parser->status() == HttpParser::PARSE_DONE;
+}
+
+StringView Request::getMethod() const
+{
+  return isValid() ? slice(_parser->method()) : StringView();
+}
+
+StringView Request::getUrl() const
+{
+  return isValid() ? slice(_parser->url()) : StringView();
+}
+
+/*
+ * The URL without the query string.
+ */
+StringView Request::getPath() const
+{
+  StringView url = getUrl();
+  const char *query = static_cast<const char*>(memchr(url.data, '?', url.length));
+  return StringView(url.data, query != NULL ? query - url.data : url.length);
+}
+
+StringView Request::getVersion() const
+{
+  return isValid() ? slice(_parser->version()) : StringView();
+}
+
+/*
+ * Well-known headers are found in constant time, the first one with the name wins.
+ * Returns an empty view if the header is not present.
+ */
+StringView Request::getHeader(HeaderId id) const
+{
+  if (!isValid()) {
+    return StringView();
+  }
+  int index = _parser->headerIndex(id);
+  if (index < 0) {
+    return StringView();
+  }
+  return slice(_parser->header(index).value);
+}
 
-  // Parse the body (if any)
-  std::getline(requestStream, _body, '\0');
+/*
+ * Header names are case-insensitive, other names are compared one header at a time.
+ */
+StringView Request::getHeader(const StringView &key) const
+{
+  HeaderId id = HttpParser::headerId(key);
+  if (id != HEADER_OTHER || !isValid()) {
+    return getHeader(id);
+  }
+  for (size_t i = 0; i < _parser->headerCount(); ++i) {
+    const HttpParser::HeaderField &field = _parser->header(i);
+    if (field.id == HEADER_OTHER && slice(field.name).equalsIgnoreCase(key)) {
+      return slice(field.value);
+    }
+  }
+  return StringView();
 }
 
-std::string Request::getMethod() const
+/*
+ * Headers in the order they were received, for passing them all on (CGI HTTP_* variables).
+ */
+size_t Request::getHeaderCount() const
 {
-  return _method;
+  return isValid() ? _parser->headerCount() : 0;
 }
 
-std::string Request::getUrl() const
+StringView Request::getHeaderName(size_t index) const
 {
-  return _url;
+  return slice(_parser->header(index).name);
 }
 
-std::string Request::getHeader(const std::string &key) const
+StringView Request::getHeaderValue(size_t index) const
 {
-  std::map<std::string, std::string>::const_iterator it = _headers.find(key);
-  // If the key is not found, find() returns _headers.end(),
-  // which is a special iterator representing the "end" of the map
-  return (it != _headers.end()) ? it->second : "";
+  return slice(_parser->header(index).value);
 }
 
-std::string Request::getBody() const 
+const RequestBody &Request::getBody() const 
 {
   return _body;
 }
 
+void Request::setBody(const RequestBody &body)
+{
+  _body = body;
+}
+
+/*
+ * Multipart uploads are parsed while the body arrives, the Request then has no body
+ * but the parser with the result.
+ * */
+const MultipartParser *Request::getUpload() const
+{
+  return _upload;
+}
+
+void Request::setUpload(const MultipartParser *upload)
+{
+  _upload = upload;
+}
+
+StringView Request::getRemoteAddress() const
+{
+  return _remoteAddress;
+}
+
+void Request::setRemoteAddress(const StringView &address)
+{
+  _remoteAddress = address;
+}
+
+/*
+ * HTTP/1.1 connections are persistent unless the client sends "Connection: close",
+ * HTTP/1.0 connections are closed unless the client asks for "Connection: keep-alive".
+ */
+bool Request::isKeepAlive() const
+{
+  StringView connection = getHeader(HEADER_CONNECTION);
+  StringView version = getVersion();
+
+  if (connection.hasToken("close"))
+    return false;
+  if (version == "HTTP/1.0")
+    return connection.hasToken("keep-alive");
+  return version == "HTTP/1.1";
+}
+
+/*
+ * True if Accept-Encoding lists coding without "q=0", or lists "*" without "q=0" and not
+ * coding itself: an explicit entry overrides the wildcard wherever it stands (RFC 9110
+ * section 12.5.3), "*, gzip;q=0" refuses gzip and "*;q=0, gzip" accepts it.
+ */
+bool Request::acceptsEncoding(const StringView &coding) const
+{
+  StringView accept = getHeader(HEADER_ACCEPT_ENCODING);
+  int explicitWeight = -1; // -1: not listed, 0: refused, 1: accepted
+  int wildcardWeight = -1;
+  size_t pos = 0;
+  while (pos < accept.length) {
+    size_t end = pos;
+    while (end < accept.length && accept.data[end] != ',')
+      ++end;
+    StringView item(accept.data + pos, end - pos);
+    pos = end + 1;
+
+    size_t semicolon = 0;
+    while (semicolon < item.length && item.data[semicolon] != ';')
+      ++semicolon;
+    StringView token = StringView(item.data, semicolon).trim();
+    int *weight = token.equalsIgnoreCase(coding) ? &explicitWeight : token == "*" ? &wildcardWeight : NULL;
+    if (weight == NULL)
+      continue;
+
+    // A weight of 0 means "not acceptable", any other weight accepts the coding
+    StringView params(item.data + semicolon, item.length - semicolon);
+    size_t q = 0;
+    while (q + 1 < params.length && !((params.data[q] == 'q' || params.data[q] == 'Q') && params.data[q + 1] == '='))
+      ++q;
+    *weight = 0;
+    if (q + 1 >= params.length)
+      *weight = 1;
+    for (size_t i = q + 2; i < params.length; ++i) {
+      if (params.data[i] >= '1' && params.data[i] <= '9')
+        *weight = 1;
+    }
+  }
+  return explicitWeight != -1 ? explicitWeight == 1 : wildcardWeight == 1;
+}
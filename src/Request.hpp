@@ -2,24 +2,52 @@
 #define REQUEST_HPP
 
 #include <string>
-#include <map>
+#include "HttpParser.hpp"
+#include "StringView.hpp"
+#include "RequestBody.hpp"
+
+class MultipartParser;
 
 class Request
 {
   public:
     Request();
     Request(const std::string &rawRequest);
-    std::string getMethod() const;
-    std::string getUrl() const;
-    std::string getHeader(const std::string &key) const;
-    std::string getBody() const;
+    Request(const char *head, const HttpParser &parser);
+    Request(const Request &other);
+    Request &operator=(const Request &other);
+    ~Request();
+
+    bool isValid() const;
+    StringView getMethod() const;
+    StringView getUrl() const;
+    StringView getPath() const;
+    StringView getVersion() const;
+    StringView getHeader(HeaderId id) const;
+    StringView getHeader(const StringView &key) const;
+    size_t getHeaderCount() const;
+    StringView getHeaderName(size_t index) const;
+    StringView getHeaderValue(size_t index) const;
+    const RequestBody &getBody() const;
+    void setBody(const RequestBody &body);
+    const MultipartParser *getUpload() const;
+    void setUpload(const MultipartParser *upload);
+    StringView getRemoteAddress() const;
+    void setRemoteAddress(const StringView &address);
+    bool isKeepAlive() const;
+    bool acceptsEncoding(const StringView &coding) const;
   
   private:
     void parseRequest(const std::string &rawRequest);
-    std::string _method;
-    std::string _url;
-    std::map<std::string, std::string> _headers;
-    std::string _body;
+    StringView slice(const HttpParser::Slice &slice) const;
+
+    std::string _storage;        // Owned copy of the request, only when built from a string
+    const char *_head;           // First byte of the request head
+    const HttpParser *_parser;   // Header table, owned by the Client or by _ownedParser
+    HttpParser *_ownedParser;    // Only when built from a string
+    RequestBody _body;
+    const MultipartParser *_upload; // Body already parsed while it arrived, owned by the Client
+    StringView _remoteAddress;   // Peer IP address as text, owned by the Client
 };
 
 #endif // REQUEST_HPP
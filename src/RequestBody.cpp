@@ -0,0 +1,220 @@
+#include "RequestBody.hpp"
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+
+/*
+ * RequestBody keeps small bodies in memory and moves larger ones to a temporary file once
+ * they grow past the memory limit, so concurrent large requests don't grow the worker's RSS.
+ * The file is created with O_TMPFILE: it has no name and disappears with its last descriptor.
+ * Handlers read either kind with read(), or pass file() to sendfile(), splice() or a child process.
+ * */
+RequestBody::RequestBody() : _file(NULL), _size(0), _memoryLimit(0)
+{
+}
+
+RequestBody::RequestBody(const std::string& data)
+  : _data(data), _file(NULL), _size(data.size()), _memoryLimit(0)
+{
+}
+
+RequestBody::RequestBody(const RequestBody& other)
+  : _data(other._data),
+    _file(other._file),
+    _size(other._size),
+    _memoryLimit(other._memoryLimit),
+    _directory(other._directory)
+{
+  if (_file != NULL) {
+    _file->retain();
+  }
+}
+
+RequestBody& RequestBody::operator=(const RequestBody& other)
+{
+  if (this != &other) {
+    if (other._file != NULL) {
+      other._file->retain();
+    }
+    if (_file != NULL) {
+      _file->release();
+    }
+    _data = other._data;
+    _file = other._file;
+    _size = other._size;
+    _memoryLimit = other._memoryLimit;
+    _directory = other._directory;
+  }
+  return *this;
+}
+
+RequestBody::~RequestBody()
+{
+  if (_file != NULL) {
+    _file->release();
+  }
+}
+
+/*
+ * Bodies larger than memoryLimit bytes go to a temporary file in directory.
+ * */
+void RequestBody::spoolAbove(size_t memoryLimit, const std::string& directory)
+{
+  _memoryLimit = memoryLimit;
+  _directory = directory;
+}
+
+/*
+ * Adds length bytes at the end of the body. Returns false if the temporary file can't be written.
+ * */
+bool RequestBody::append(const char *data, size_t length)
+{
+  if (_file == NULL && _memoryLimit > 0 && _size + length > _memoryLimit && !spool()) {
+    return false;
+  }
+  if (_file != NULL) {
+    if (!writeAll(_file->fd, data, length)) {
+      std::cerr << "Error: Failed to write request body to " << _directory << ". " << strerror(errno) << "\n";
+      return false;
+    }
+  } else {
+    _data.append(data, length);
+  }
+  _size += length;
+  return true;
+}
+
+/*
+ * Copies up to length bytes from offset into buffer, returns the number of bytes copied.
+ * */
+size_t RequestBody::read(size_t offset, char *buffer, size_t length) const
+{
+  if (offset >= _size) {
+    return 0;
+  }
+  if (length > _size - offset) {
+    length = _size - offset;
+  }
+  if (_file == NULL) {
+    memcpy(buffer, _data.data() + offset, length);
+    return length;
+  }
+  size_t total = 0;
+  while (total < length) {
+    ssize_t bytesRead = pread(_file->fd, buffer + total, length - total, offset + total);
+    if (bytesRead == -1 && errno == EINTR)
+      continue;
+    if (bytesRead <= 0)
+      break;
+    total += bytesRead;
+  }
+  return total;
+}
+
+/*
+ * The whole body as a string, for handlers that need it in one piece.
+ * */
+std::string RequestBody::str() const
+{
+  if (_file == NULL) {
+    return _data;
+  }
+  std::string body(_size, '\0');
+  body.resize(read(0, &body[0], _size));
+  return body;
+}
+
+size_t RequestBody::size() const
+{
+  return _size;
+}
+
+bool RequestBody::empty() const
+{
+  return _size == 0;
+}
+
+bool RequestBody::inMemory() const
+{
+  return _file == NULL;
+}
+
+/*
+ * The bytes of a body kept in memory, empty for a spooled body.
+ * */
+const std::string& RequestBody::data() const
+{
+  return _data;
+}
+
+/*
+ * The temporary file of a spooled body, NULL for a body in memory.
+ * */
+SharedFile *RequestBody::file() const
+{
+  return _file;
+}
+
+void RequestBody::clear()
+{
+  if (_file != NULL) {
+    _file->release();
+    _file = NULL;
+  }
+  std::string().swap(_data);
+  _size = 0;
+}
+
+/*
+ * Moves the bytes received so far to a new temporary file.
+ * */
+bool RequestBody::spool()
+{
+  int fd = createTempFile(_directory);
+  if (fd == -1) {
+    std::cerr << "Error: Failed to create a temporary file in " << _directory << ". " << strerror(errno) << "\n";
+    return false;
+  }
+  if (!writeAll(fd, _data.data(), _data.size())) {
+    std::cerr << "Error: Failed to write request body to " << _directory << ". " << strerror(errno) << "\n";
+    close(fd);
+    return false;
+  }
+  _file = new SharedFile(fd);
+  std::string().swap(_data);
+  return true;
+}
+
+/*
+ * Opens an anonymous file in directory. Filesystems without O_TMPFILE get a file
+ * from mkostemp() that is unlinked right away.
+ * */
+int RequestBody::createTempFile(const std::string& directory)
+{
+  int fd = open(directory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (fd != -1 || (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL)) {
+    return fd;
+  }
+  std::string path = directory + "/.body-XXXXXX";
+  fd = mkostemp(&path[0], O_CLOEXEC);
+  if (fd != -1) {
+    unlink(path.c_str());
+  }
+  return fd;
+}
+
+bool RequestBody::writeAll(int fd, const char *data, size_t length)
+{
+  while (length > 0) {
+    ssize_t written = write(fd, data, length);
+    if (written == -1 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    data += written;
+    length -= written;
+  }
+  return true;
+}
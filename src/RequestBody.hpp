@@ -0,0 +1,43 @@
+#ifndef REQUESTBODY_HPP
+#define REQUESTBODY_HPP
+
+#include <string>
+#include <sys/types.h>
+#include "SharedFile.hpp"
+
+/*
+ * Body of a request: in memory up to a limit, in an unlinked temporary file beyond it.
+ * Copies share the file. Not thread-safe, like SharedFile.
+ */
+class RequestBody {
+public:
+  RequestBody();
+  explicit RequestBody(const std::string& data);
+  RequestBody(const RequestBody& other);
+  RequestBody& operator=(const RequestBody& other);
+  ~RequestBody();
+
+  void spoolAbove(size_t memoryLimit, const std::string& directory);
+  bool append(const char *data, size_t length);
+  size_t read(size_t offset, char *buffer, size_t length) const;
+  std::string str() const;
+  size_t size() const;
+  bool empty() const;
+  bool inMemory() const;
+  const std::string& data() const;
+  SharedFile *file() const;
+  void clear();
+
+private:
+  std::string _data;       // Whole body while it fits in memory
+  SharedFile *_file;       // Spooled body, NULL while in memory
+  size_t _size;
+  size_t _memoryLimit;     // 0 keeps everything in memory
+  std::string _directory;  // Where temporary files are created
+
+  bool spool();
+  static int createTempFile(const std::string& directory);
+  static bool writeAll(int fd, const char *data, size_t length);
+};
+
+#endif // REQUESTBODY_HPP
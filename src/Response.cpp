@@ -1,237 +1,860 @@
 #include "Response.hpp"
 #include "CGI.hpp"
+#include "FastCgiRequest.hpp"
+#include "MultipartParser.hpp"
 
 /*
-* Generates an HTTP response based on the request and sends it to the client.
+* Generates an HTTP response based on the request and queues it on the client's OutputQueue.
 * The response may be a static file, a CGI script, or an error message.
+* Nothing is written here: the Server flushes the queue when the socket is writable.
  * */
-Response::Response(const Config& config) : _config(config)
+Response::Response(const Config& config, OutputQueue& output, ServerContext& context)
+  : _config(config), _output(output), _context(context), _keepAlive(false), _cgi(NULL),
+    _fastcgi(NULL)
 {
 }
 
-void Response::processRequest(const Request& request, int clientSocket)
+Response::~Response()
 {
-  std::string method = request.getMethod();
-  std::string url = request.getUrl();
-  
-  if (method == "GET") {
-    if (url == "/")
-      serveStaticFile(_config.getDocumentRoot() + "/index.html", clientSocket);
-    else if (url.find("/cgi-bin/") == 0)
-    {
-      // Execute a CGI script
-      std::string scriptPath = _config.getDocumentRoot() + url;
-      std::string queryString = request.getHeader("Query-String");
-      
-      CGI cgi(_config);
-      cgi.executeScript(scriptPath, queryString, clientSocket);
-    } else {
-      // Serve a static file
-      serveStaticFile(_config.getDocumentRoot() + url, clientSocket);
-    }
-  } else if (method == "POST") {
-    if (url == "/upload") {
-      // Handle file upload
-      handleFileUpload(request.getBody(), clientSocket);
+  delete _cgi;
+  delete _fastcgi;
+}
+
+/*
+ * Persistent connections need every response to be framed with a Content-Length,
+ * the Connection header tells the client whether the server keeps the socket open.
+ * */
+void Response::setKeepAlive(bool keepAlive)
+{
+  _keepAlive = keepAlive;
+}
+
+bool Response::keepAlive() const
+{
+  return _keepAlive;
+}
+
+const char *Response::connectionHeader() const
+{
+  return _keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+}
+
+/*
+ * Answers request with the handler of its route (see Config::getRoute()). A method the
+ * route does not allow gets 405 with the allowed ones in the Allow header.
+ * */
+void Response::processRequest(const Request& request)
+{
+  StringView method = request.getMethod();
+  StringView path = request.getPath();
+  const Route *route = _config.getRoute(path);
+  if (route == NULL) {
+    sendErrorResponse(404, "Not Found");
+    return;
+  }
+  if (!route->allowsMethod(method)) {
+    sendErrorResponse(405, "Method Not Allowed", "Allow: " + route->allowHeader() + "\r\n");
+    return;
+  }
+
+  switch (route->handler) {
+    case ROUTE_FASTCGI:
+      executeFastCgi(request, *route);
+      break;
+    case ROUTE_CGI:
+      executeCgi(request, *route);
+      break;
+    case ROUTE_UPLOAD:
+      handleFileUpload(request, *route);
+      break;
+    case ROUTE_REDIRECT:
+      sendRedirect(request, *route);
+      break;
+    case ROUTE_STATIC:
+      if (method == "DELETE") {
+        handleDeleteResponse(route->filePath(_config.getDocumentRoot(), path));
+      } else if (!path.empty() && path.data[path.length - 1] == '/') {
+        // A directory is answered with its index.html
+        std::string index = path.str() + "index.html";
+        serveStaticFile(request, index, route->filePath(_config.getDocumentRoot(), StringView(index)),
+                        route->destination.empty());
+      } else {
+        serveStaticFile(request, path, route->filePath(_config.getDocumentRoot(), path),
+                        route->destination.empty());
+      }
+      break;
+  }
+}
+
+/*
+ * 301 to the destination of a redirect route, followed by what the path has below the
+ * route and the query string of the request, if any.
+ * */
+void Response::sendRedirect(const Request& request, const Route& route)
+{
+  StringView url = request.getUrl();
+  StringView path = request.getPath();
+  StringView query(url.data + path.length, url.length - path.length);
+  HeaderBuilder& head = _context.headers;
+  head.status(301);
+  head.header("Location", route.destination + route.rest(path) + query);
+  head.header("Content-Length", static_cast<off_t>(0));
+  sendHead();
+}
+
+/*
+ * Removes the file with unlink(), which does not block the event loop on anything
+ * but the filesystem. Directories are not deleted (400), a missing file is 404 and
+ * one the server may not remove is 403.
+ * */
+void Response::handleDeleteResponse(const std::string& filePath)
+{
+  int result = unlink(filePath.c_str());
+  int error = errno;
+  _context.fileCache.invalidate(filePath);
+  if (result == -1) {
+    if (error == ENOENT || error == ENOTDIR) {
+      sendErrorResponse(404, "Not Found");
+    } else if (error == EISDIR || error == EPERM) {
+      // Linux answers EISDIR for a directory, POSIX allows EPERM
+      struct stat fileStat;
+      if (stat(filePath.c_str(), &fileStat) == 0 && S_ISDIR(fileStat.st_mode)) {
+        sendErrorResponse(400, "Bad Request");
+      } else {
+        sendErrorResponse(403, "Forbidden");
+      }
+    } else if (error == EACCES || error == EROFS || error == EBUSY) {
+      sendErrorResponse(403, "Forbidden");
     } else {
-      // Unsupported POST request
-      sendErrorResponse(405, "Method Not Allowed", clientSocket);
+      sendErrorResponse(500, "Internal Server Error");
     }
-  } else if (method == "DELETE") {
-    handleDeleteResponse(_config.getDocumentRoot() + url, clientSocket);
-  } else {
-    // Unsupported HTTP method
-    sendErrorResponse(405, "Method Not Allowed", clientSocket);
+    return;
   }
+
+  static const char body[] = "Resource successfully deleted\r\n";
+  HeaderBuilder& head = _context.headers;
+  head.status(200);
+  head.header("Content-Type", Utils::getMimeType(filePath));
+  head.header("Content-Length", static_cast<off_t>(sizeof(body) - 1));
+  sendHead();
+  _output.pushSlice(body, sizeof(body) - 1);
 }
 
-void Response::handleDeleteResponse(const std::string& filePath, int clientSocket)
+/*
+ * Starts a CGI script. If it is still running when this returns, the Server takes it
+ * with releaseCgi() and finishes the response as the script's output arrives.
+ * The script is the first regular file along the path below the route, what follows it
+ * is passed on as PATH_INFO: /cgi-bin/app.py/users/7 runs app.py with PATH_INFO=/users/7.
+ * */
+void Response::executeCgi(const Request& request, const Route& route)
 {
-  // Check if the file exists and is accessible
-  if (access(filePath.c_str(), F_OK) != 0) {
-    sendErrorResponse(404, "Not Found", clientSocket);
+  std::string path = request.getPath().str();
+  std::string scriptPath;
+  size_t scriptEnd;
+  if (!findCgiScript(route, path, scriptPath, scriptEnd)) {
+    sendErrorResponse(404, "Not Found");
     return;
   }
 
-  // Check if the file is a regular file
-  struct stat fileStat;
-  if (stat(filePath.c_str(), &fileStat) != 0) {
-    sendErrorResponse(500, "Internal Server Error", clientSocket);
+  _cgi = new CGI(_config, _output, _context);
+  _cgi->setKeepAlive(_keepAlive);
+  _cgi->setChunked(request.getVersion() == "HTTP/1.1");
+  _cgi->executeScript(scriptPath, path.substr(0, scriptEnd), path.substr(scriptEnd), request,
+                      request.getMethod() == "GET" ? _config.getCgiCacheRoute(StringView(path)) : NULL);
+  _keepAlive = _cgi->keepAlive();
+  if (_cgi->done()) {
+    delete _cgi;
+    _cgi = NULL;
+  }
+}
+
+/*
+ * Finds the script of path, looking at one segment after the other below the route.
+ * scriptEnd is where the script's part of path ends. Returns false if no regular
+ * file is found.
+ * */
+bool Response::findCgiScript(const Route& route, const std::string& path, std::string& scriptPath,
+                             size_t& scriptEnd) const
+{
+  size_t start = route.base().length;
+  for (size_t end = start; end <= path.size(); ++end) {
+    if ((end < path.size() && path[end] != '/') || (end == start && route.isPrefix())) {
+      continue;
+    }
+    std::string file = route.filePath(_config.getDocumentRoot(), StringView(path.data(), end));
+    struct stat info;
+    if (stat(file.c_str(), &info) == -1) {
+      return false;
+    }
+    if (S_ISREG(info.st_mode)) {
+      scriptPath = file;
+      scriptEnd = end;
+      return true;
+    }
+    if (!S_ISDIR(info.st_mode)) {
+      return false;
+    }
+  }
+  return false;
+}
+
+/*
+ * Hands the running CGI script over to the caller, NULL if the response is complete.
+ * */
+CGI *Response::releaseCgi()
+{
+  CGI *cgi = _cgi;
+  _cgi = NULL;
+  return cgi;
+}
+
+/*
+ * Passes the request to the FastCGI application of route. Like a CGI script, the Server
+ * takes it with releaseFastCgi() and finishes the response as the output arrives.
+ * */
+void Response::executeFastCgi(const Request& request, const Route& route)
+{
+  _fastcgi = new FastCgiRequest(_config, _output, _context);
+  _fastcgi->setKeepAlive(_keepAlive);
+  _fastcgi->setChunked(request.getVersion() == "HTTP/1.1");
+  _fastcgi->start(route, request);
+  _keepAlive = _fastcgi->keepAlive();
+  if (_fastcgi->done()) {
+    delete _fastcgi;
+    _fastcgi = NULL;
+  }
+}
+
+FastCgiRequest *Response::releaseFastCgi()
+{
+  FastCgiRequest *request = _fastcgi;
+  _fastcgi = NULL;
+  return request;
+}
+
+/*
+ * Sends the file at filePath, path is the URL path of it. Files of the document root
+ * (packed true) come from the asset pack when one is loaded and has the path, from
+ * disk otherwise. Clients that accept it get a precompressed sidecar (file.br, then
+ * file.gz) when one is at least as new as the file, text files are gzipped on the fly
+ * otherwise.
+ * */
+void Response::serveStaticFile(const Request& request, const StringView& path, const std::string& filePath,
+                               bool packed)
+{
+  if (packed && servePackedFile(request, path)) {
     return;
   }
 
-  // Don't allow deleting directories
-  if (!S_ISREG(fileStat.st_mode)) {
-    sendErrorResponse(400, "Bad Request", clientSocket);
+  // The file stays open in the cache, the OutputQueue sends it from the shared descriptor
+  const FileCache::Entry& file = _context.fileCache.lookup(filePath);
+  if (!file.regular) {
+    sendErrorResponse(404, "Not Found");
     return;
   }
+  Representation representation;
+  representation.file = file.file;
+  representation.buffer = NULL;
+  representation.offset = 0;
+  representation.size = file.size;
+  representation.mtime = file.mtime;
+  representation.mimeType = file.mimeType;
+  representation.etag = file.etag;
+  representation.lastModified = file.lastModified;
+
+  const FileCache::Entry& brotli = _context.fileCache.lookup(filePath + ".br");
+  const FileCache::Entry& gzipped = _context.fileCache.lookup(filePath + ".gz");
+  bool hasBrotli = brotli.regular && brotli.mtime >= file.mtime;
+  bool hasGzip = gzipped.regular && gzipped.mtime >= file.mtime;
+  bool compressible = _config.getGzip() && CompressionCache::compressible(file.mimeType)
+                      && file.size >= static_cast<off_t>(_config.getGzipMinLength())
+                      && file.size <= MAX_GZIP_SIZE;
+  if (hasBrotli || hasGzip || compressible) {
+    // Caches must not hand the identity response to clients that asked for another coding
+    representation.extraHeaders = "Vary: Accept-Encoding\r\n";
+  }
 
-  // Fork a child process
-  pid_t pid = fork();
-  if (pid == -1) {
-    sendErrorResponse(500, "Internal Server Error", clientSocket);
+  if ((hasBrotli && request.acceptsEncoding("br")) || (hasGzip && request.acceptsEncoding("gzip"))) {
+    bool useBrotli = hasBrotli && request.acceptsEncoding("br");
+    const FileCache::Entry& sidecar = useBrotli ? brotli : gzipped;
+    std::string etag = variantEtag(sidecar.etag, useBrotli ? "br" : "gzip");
+    representation.file = sidecar.file;
+    representation.size = sidecar.size;
+    representation.etag = etag;
+    representation.extraHeaders = useBrotli ? "Content-Encoding: br\r\n" : "Content-Encoding: gzip\r\n";
+    representation.extraHeaders += "Vary: Accept-Encoding\r\n";
+    sendRepresentation(request, representation);
     return;
   }
+  if (compressible && request.acceptsEncoding("gzip")) {
+    SharedBuffer *compressed = compressFile(file);
+    if (compressed != NULL && compressed->data.size() < static_cast<size_t>(file.size)) {
+      std::string etag = variantEtag(file.etag, "gzip");
+      representation.file = NULL;
+      representation.buffer = compressed;
+      representation.size = compressed->data.size();
+      representation.etag = etag;
+      representation.extraHeaders = "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n";
+      sendRepresentation(request, representation);
+      compressed->release();
+      return;
+    }
+    if (compressed != NULL) {
+      compressed->release();
+    }
+  }
+
+  // Small hot files are answered from memory, only the Connection header is added
+  if (request.getHeader(HEADER_RANGE).empty() && checkPreconditions(request, representation) == 0) {
+    const ResponseCache::Entry *cached = _context.responseCache.lookup(file);
+    if (cached == NULL && _context.responseCache.admits(file)) {
+      cached = cacheStaticFile(file, representation);
+    }
+    if (cached != NULL) {
+      SharedBuffer *response = cached->response;
+      _output.pushShared(response, 0, cached->headLength);
+      HeaderBuilder& head = _context.headers;
+      head.clear();
+      head.date();
+      head.raw(connectionHeader());
+      _output.push(head.data(), head.size());
+      _output.pushShared(response, cached->headLength, response->data.size() - cached->headLength);
+      return;
+    }
+  }
+  sendRepresentation(request, representation);
+}
+
+/*
+ * Returns the gzip copy of file from the CompressionCache, compressing it on a miss.
+ * The caller releases the buffer. NULL if the file can't be read.
+ * */
+SharedBuffer *Response::compressFile(const FileCache::Entry& file)
+{
+  SharedBuffer *compressed = _context.compressionCache.lookup(file);
+  if (compressed != NULL) {
+    compressed->retain();
+    return compressed;
+  }
+  std::string body;
+  std::string data;
+  if (!readFile(file, body) || !CompressionCache::gzip(body, _context.compressionCache.level(), data)) {
+    return NULL;
+  }
+  return _context.compressionCache.insert(file, data);
+}
 
-  if (pid == 0) {
-    // Child process
-    char* args[] = {const_cast<char*>("/bin/rm"), const_cast<char*>(filePath.c_str()), NULL};
-    char *envp[] = {NULL};
-    
-    execve("/bin/rm", args, envp);
+/*
+ * A content-coded variant is a different representation and needs its own strong ETag:
+ * the coding is appended inside the quotes.
+ * */
+std::string Response::variantEtag(const StringView& etag, const char *coding)
+{
+  std::string variant = etag.str();
+  if (variant.size() >= 2) {
+    variant.insert(variant.size() - 1, std::string("-") + coding);
+  }
+  return variant;
+}
 
-    // If execvp fails
-    std::cerr << "Error: Failed to execute 'rm' command. " << strerror(errno) << "\n";
-    exit(1);
+/*
+ * Sends a file from the asset pack, its precompressed variant if the client accepts gzip.
+ * Returns false if the pack doesn't have the path.
+ * */
+bool Response::servePackedFile(const Request& request, const StringView& path)
+{
+  const AssetPack::Entry *entry = _context.assetPack.find(path);
+  if (entry == NULL) {
+    return false;
   }
-  
-  // Parent process
-  int status;
-  waitpid(pid, &status, 0);
+  bool gzip = entry->gzipLength > 0 && request.acceptsEncoding("gzip");
 
-  if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-    // Determine MIME type based on file extension
-    std::string mimeType = getMimeType(filePath);
-  
-    // Success - send 200 OK Response
-    std::ostringstream response;
-    response << "HTTP/1.1 200 OK\r\n";
-    response << "Content-Type: " << mimeType << "\r\n";
-    response << "Connection: close\r\n";
-    response << "\r\n";
-    response << "Resource successfully deleted\r\n"; 
+  // The gzip variant is a different representation, it needs its own strong ETag
+  StringView packedEtag = _context.assetPack.string(entry->etagOffset, entry->etagLength);
+  std::string etag = gzip ? variantEtag(packedEtag, "gzip") : packedEtag.str();
+  std::string lastModified = Utils::httpDate(entry->mtime);
 
-    write(clientSocket, response.str().c_str(), response.str().size());
-  }  else {
-    // Error - send 500 Internal Server Error Response
-    sendErrorResponse(500, "Internal Server Error", clientSocket);
+  Representation representation;
+  representation.file = _context.assetPack.file();
+  representation.buffer = NULL;
+  representation.offset = gzip ? entry->gzipOffset : entry->offset;
+  representation.size = gzip ? entry->gzipLength : entry->length;
+  representation.mtime = entry->mtime;
+  representation.mimeType = _context.assetPack.string(entry->mimeOffset, entry->mimeLength);
+  representation.etag = etag;
+  representation.lastModified = lastModified;
+  if (gzip) {
+    representation.extraHeaders = "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n";
+  } else if (entry->gzipLength > 0) {
+    representation.extraHeaders = "Vary: Accept-Encoding\r\n";
   }
+  sendRepresentation(request, representation);
+  return true;
 }
 
-void Response::serveStaticFile(const std::string& filePath, int clientSocket)
+/*
+ * Sends a static representation after the conditional headers are checked:
+ * the requested ranges when Range applies, all of it otherwise.
+ * File bytes go out with sendfile() from the representation's offset in its file.
+ * */
+void Response::sendRepresentation(const Request& request, const Representation& representation)
 {
-  // Open the file in binary mode which is necessary for non-text files
-  std::ifstream file(filePath.c_str(), std::ios::binary);
-  if (!file) {
-    sendErrorResponse(404, "Not Found", clientSocket);
+  int precondition = checkPreconditions(request, representation);
+  if (precondition != 0) {
+    sendNotModified(precondition, representation);
     return;
   }
 
-  // Determine MIME type based on file extension
-  std::string mimeType = getMimeType(filePath);
-
-  std::ostringstream response;
-  response << "HTTP/1.1 200 OK\r\n";
-  response << "Content-Type: " << mimeType << "\r\n";
-  
-  // Get file size
-  file.seekg(0, std::ios::end);
-  size_t fileSize = file.tellg();
-  file.seekg(0, std::ios::beg);
-  
-  response << "Content-Length: " << fileSize << "\r\n";
-  response << "Connection: close\r\n";
-  response << "\r\n";
-  
-  // Write headers
-  write(clientSocket, response.str().c_str(), response.str().size());
-  
-  // Write file content
-  char buffer[4096];
-  while (file.read(buffer, sizeof(buffer)).gcount() > 0) {
-    write(clientSocket, buffer, file.gcount());
-  }
-}
-
-void Response::handleFileUpload(const std::string& body, int clientSocket)
-{
-  // Extract the file name and content from the body
-  size_t filenameStart = body.find("filename=\"");
-  if (filenameStart == std::string::npos) {
-    std::cerr << "Error: 'filename' not found in request body." << "\n";
-    sendErrorResponse(400, "Bad Request", clientSocket);
+  std::vector<ByteRange> ranges;
+  RangeResult result = RANGE_IGNORED;
+  StringView range = request.getHeader(HEADER_RANGE);
+  if (!range.empty() && ifRangeMatches(request, representation)) {
+    result = parseRanges(range, representation.size, ranges);
+  }
+
+  if (result == RANGE_UNSATISFIABLE) {
+    HeaderBuilder& head = _context.headers;
+    head.status(416);
+    head.contentRange(-1, -1, representation.size);
+    head.header("Content-Length", static_cast<off_t>(0));
+    sendHead();
+    return;
+  }
+  if (result == RANGE_SATISFIABLE) {
+    sendRanges(representation, ranges);
     return;
   }
-  filenameStart += 10; // Skip "filename=\""
-  size_t filenameEnd = body.find("\"", filenameStart);
-  std::string filename = body.substr(filenameStart, filenameEnd - filenameStart);
 
-  size_t fileContentStart = body.find("\r\n\r\n", filenameEnd);
-  if (fileContentStart == std::string::npos) {
-    std::cerr << "Error: File content not found in request body." << "\n";
-    sendErrorResponse(400, "Bad Request", clientSocket);
+  representationHead(representation);
+  sendHead();
+  pushBody(representation, 0, representation.size);
+}
+
+/*
+ * Completes the head in the HeaderBuilder with Date and Connection and queues it.
+ * */
+void Response::sendHead()
+{
+  HeaderBuilder& head = _context.headers;
+  head.date();
+  head.raw(connectionHeader());
+  head.end();
+  _output.push(head.data(), head.size());
+}
+
+/*
+ * Queues length bytes of the representation from offset, out of its buffer or its file.
+ * */
+void Response::pushBody(const Representation& representation, off_t offset, off_t length)
+{
+  if (representation.buffer != NULL) {
+    _output.pushShared(representation.buffer, offset, length);
+  } else {
+    _output.pushFile(representation.file, representation.offset + offset, length);
+  }
+}
+
+/*
+ * Starts the head of a full static response in the HeaderBuilder, without Date and Connection.
+ * */
+void Response::representationHead(const Representation& representation)
+{
+  HeaderBuilder& head = _context.headers;
+  head.status(200);
+  head.header("Content-Type", representation.mimeType);
+  head.header("Content-Length", representation.size);
+  head.header("ETag", representation.etag);
+  head.header("Last-Modified", representation.lastModified);
+  head.raw("Accept-Ranges: bytes\r\n");
+  head.raw(representation.extraHeaders);
+}
+
+/*
+ * A single range is sent as 206 with Content-Range, several as multipart/byteranges
+ * where each part has its own Content-Range and is sent straight from the body.
+ * */
+void Response::sendRanges(const Representation& representation, const std::vector<ByteRange>& ranges)
+{
+  HeaderBuilder& head = _context.headers;
+  head.status(206);
+  head.header("ETag", representation.etag);
+  head.header("Last-Modified", representation.lastModified);
+  head.raw("Accept-Ranges: bytes\r\n");
+  head.raw(representation.extraHeaders);
+
+  if (ranges.size() == 1) {
+    const ByteRange& range = ranges[0];
+    head.header("Content-Type", representation.mimeType);
+    head.contentRange(range.first, range.last, representation.size);
+    head.header("Content-Length", range.last - range.first + 1);
+    sendHead();
+    pushBody(representation, range.first, range.last - range.first + 1);
     return;
   }
-  fileContentStart += 4; // Skip "\r\n\r\n"
-  
-  // Find the boundary to properly extract the file content
-  size_t boundaryStart = body.find("--", fileContentStart);
-  std::string fileContent;
-  if (boundaryStart != std::string::npos) {
-    fileContent = body.substr(fileContentStart, boundaryStart - fileContentStart - 2); // -2 for \r\n before boundary
+
+  std::ostringstream boundary;
+  boundary << "webserv" << std::hex << time(NULL) << "x" << ++_context.rangeBoundaries;
+
+  std::vector<std::string> partHeads;
+  off_t length = 0;
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    std::ostringstream part;
+    part << "\r\n--" << boundary.str() << "\r\n";
+    part << "Content-Type: " << representation.mimeType << "\r\n";
+    part << "Content-Range: bytes " << ranges[i].first << "-" << ranges[i].last << "/" << representation.size << "\r\n";
+    part << "\r\n";
+    partHeads.push_back(part.str());
+    length += partHeads.back().size() + (ranges[i].last - ranges[i].first + 1);
+  }
+  std::string closing = "\r\n--" + boundary.str() + "--\r\n";
+  length += closing.size();
+
+  head.header("Content-Type", "multipart/byteranges; boundary=" + boundary.str());
+  head.header("Content-Length", length);
+  sendHead();
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    _output.push(partHeads[i]);
+    pushBody(representation, ranges[i].first, ranges[i].last - ranges[i].first + 1);
+  }
+  _output.push(closing);
+}
+
+/*
+ * If-Range makes a Range request conditional: the ranges are only sent if the
+ * representation is unchanged, otherwise the whole file is. An entity tag must match
+ * strongly, a date must equal Last-Modified exactly.
+ * */
+bool Response::ifRangeMatches(const Request& request, const Representation& representation)
+{
+  StringView ifRange = request.getHeader(HEADER_IF_RANGE).trim();
+  if (ifRange.empty()) {
+    return true;
+  }
+  if (ifRange.startsWith("\"") || ifRange.startsWith("W/")) {
+    return matchesEtag(ifRange, representation.etag, false);
+  }
+  time_t date;
+  return Utils::parseHttpDate(ifRange.str(), date) && date == representation.mtime;
+}
+
+/*
+ * Parses "bytes=0-99, 200-, -500" into ranges clamped to the representation size,
+ * sorted, with overlapping and adjacent ranges merged (RFC 9110 section 14.2).
+ * Malformed headers, other units and too many ranges are ignored: the whole file is sent.
+ * */
+Response::RangeResult Response::parseRanges(const StringView& header, off_t size, std::vector<ByteRange>& ranges)
+{
+  static const size_t MAX_RANGES = 64;
+  const off_t maxOffset = static_cast<off_t>((~static_cast<unsigned long long>(0)) >> 1);
+
+  if (!header.startsWith("bytes=")) {
+    return RANGE_IGNORED;
+  }
+  const char *position = header.data + 6;
+  const char *end = header.data + header.length;
+  bool sawRange = false;
+
+  while (position < end) {
+    while (position < end && (*position == ' ' || *position == '\t' || *position == ','))
+      ++position;
+    if (position == end)
+      break;
+
+    // first-pos "-" [ last-pos ]  or  "-" suffix-length
+    off_t numbers[2] = { -1, -1 };
+    for (int i = 0; i < 2; ++i) {
+      if (i == 1) {
+        if (position == end || *position != '-')
+          return RANGE_IGNORED;
+        ++position;
+      }
+      if (position < end && *position >= '0' && *position <= '9') {
+        numbers[i] = 0;
+        while (position < end && *position >= '0' && *position <= '9') {
+          off_t digit = *position - '0';
+          numbers[i] = (numbers[i] > (maxOffset - digit) / 10) ? maxOffset : numbers[i] * 10 + digit;
+          ++position;
+        }
+      }
+    }
+    while (position < end && (*position == ' ' || *position == '\t'))
+      ++position;
+    if (position < end && *position != ',')
+      return RANGE_IGNORED;
+
+    off_t first = numbers[0];
+    off_t last = numbers[1];
+    if (first == -1 && last == -1)
+      return RANGE_IGNORED;
+    if (first != -1 && last != -1 && last < first)
+      return RANGE_IGNORED;
+    sawRange = true;
+
+    ByteRange range;
+    if (first == -1) {
+      // Suffix range: the last N bytes
+      if (last == 0 || size == 0)
+        continue;
+      range.first = last >= size ? 0 : size - last;
+      range.last = size - 1;
+    } else {
+      if (first >= size)
+        continue;
+      range.first = first;
+      range.last = (last == -1 || last >= size) ? size - 1 : last;
+    }
+    ranges.push_back(range);
+  }
+
+  if (!sawRange) {
+    return RANGE_IGNORED;
+  }
+  if (ranges.empty()) {
+    return RANGE_UNSATISFIABLE;
+  }
+
+  std::sort(ranges.begin(), ranges.end());
+  std::vector<ByteRange> merged;
+  merged.push_back(ranges[0]);
+  for (size_t i = 1; i < ranges.size(); ++i) {
+    if (ranges[i].first <= merged.back().last + 1) {
+      merged.back().last = std::max(merged.back().last, ranges[i].last);
+    } else {
+      merged.push_back(ranges[i]);
+    }
+  }
+  ranges.swap(merged);
+  return ranges.size() > MAX_RANGES ? RANGE_IGNORED : RANGE_SATISFIABLE;
+}
+
+/*
+ * Evaluates the conditional request headers against the current representation
+ * in the order of RFC 9110 section 13.2.2. Returns 0 to send the file,
+ * 412 (Precondition Failed) or 304 (Not Modified) to send only the headers.
+ * If-Unmodified-Since and If-Modified-Since are ignored when the matching ETag header is present.
+ * */
+int Response::checkPreconditions(const Request& request, const Representation& representation)
+{
+  const StringView& etag = representation.etag;
+  time_t mtime = representation.mtime;
+  StringView ifMatch = request.getHeader(HEADER_IF_MATCH);
+  if (!ifMatch.empty()) {
+    if (!matchesEtag(ifMatch, etag, false))
+      return 412;
+  } else {
+    StringView ifUnmodifiedSince = request.getHeader(HEADER_IF_UNMODIFIED_SINCE);
+    time_t since;
+    if (!ifUnmodifiedSince.empty() && Utils::parseHttpDate(ifUnmodifiedSince.str(), since) && mtime > since)
+      return 412;
+  }
+
+  StringView ifNoneMatch = request.getHeader(HEADER_IF_NONE_MATCH);
+  if (!ifNoneMatch.empty()) {
+    if (matchesEtag(ifNoneMatch, etag, true))
+      return 304;
+  } else {
+    StringView ifModifiedSince = request.getHeader(HEADER_IF_MODIFIED_SINCE);
+    time_t since;
+    if (!ifModifiedSince.empty() && Utils::parseHttpDate(ifModifiedSince.str(), since) && mtime <= since)
+      return 304;
+  }
+  return 0;
+}
+
+/*
+ * True if the If-Match / If-None-Match list contains etag or is "*".
+ * Weak comparison ignores the W/ prefix, strong comparison never matches a weak tag.
+ * */
+bool Response::matchesEtag(const StringView& header, const StringView& etag, bool weak)
+{
+  StringView list = header.trim();
+  if (list == "*") {
+    return true;
+  }
+  size_t pos = 0;
+  while (pos < list.length) {
+    while (pos < list.length && (list.data[pos] == ' ' || list.data[pos] == '\t' || list.data[pos] == ','))
+      ++pos;
+    bool isWeak = false;
+    if (pos + 1 < list.length && list.data[pos] == 'W' && list.data[pos + 1] == '/') {
+      isWeak = true;
+      pos += 2;
+    }
+    if (pos >= list.length || list.data[pos] != '"')
+      return false; // Malformed list
+    size_t end = pos + 1;
+    while (end < list.length && list.data[end] != '"')
+      ++end;
+    if (end == list.length)
+      return false;
+    StringView tag(list.data + pos, end - pos + 1);
+    if ((weak || !isWeak) && tag == etag)
+      return true;
+    pos = end + 1;
+  }
+  return false;
+}
+
+/*
+ * Header-only answer to a conditional request: 304 carries the validators
+ * so the client can refresh its cached copy, and the Vary of the 200 it stands
+ * for (RFC 9110 section 15.4.5). 412 has an empty body.
+ * */
+void Response::sendNotModified(int statusCode, const Representation& representation)
+{
+  HeaderBuilder& head = _context.headers;
+  head.status(statusCode);
+  if (statusCode == 304) {
+    head.header("ETag", representation.etag);
+    head.header("Last-Modified", representation.lastModified);
+    size_t vary = representation.extraHeaders.find("Vary:");
+    if (vary != std::string::npos) {
+      size_t end = representation.extraHeaders.find("\r\n", vary);
+      head.raw(representation.extraHeaders.substr(vary, end + 2 - vary));
+    }
   } else {
-    fileContent = body.substr(fileContentStart);
+    head.header("Content-Length", static_cast<off_t>(0));
+  }
+  sendHead();
+}
+
+/*
+ * Reads the whole file and stores its response, NULL if it can't be read as announced.
+ * */
+const ResponseCache::Entry *Response::cacheStaticFile(const FileCache::Entry& file, const Representation& representation)
+{
+  std::string body;
+  if (!readFile(file, body)) {
+    return NULL;
+  }
+  representationHead(representation);
+  return _context.responseCache.insert(file, _context.headers.str(), body);
+}
+
+/*
+ * Reads the whole cached file into body, false if it is shorter than announced.
+ * */
+bool Response::readFile(const FileCache::Entry& file, std::string& body)
+{
+  body.assign(file.size, '\0');
+  size_t total = 0;
+  while (total < body.size()) {
+    ssize_t bytesRead = pread(file.file->fd, &body[total], body.size() - total, total);
+    if (bytesRead <= 0) {
+      return false;
+    }
+    total += bytesRead;
+  }
+  return true;
+}
+
+/*
+ * True if the body of request is parsed while it arrives instead of being buffered:
+ * multipart/form-data posted to an upload route. route is the route of the request.
+ * */
+bool Response::streamsBody(const Request& request, const Route *route)
+{
+  std::string boundary;
+  return route != NULL && route->handler == ROUTE_UPLOAD && request.getMethod() == "POST"
+         && route->allowsMethod(request.getMethod())
+         && MultipartParser::boundaryFrom(request.getHeader(HEADER_CONTENT_TYPE), boundary);
+}
+
+/*
+ * Saves the files of a multipart/form-data body in the upload directory of route. Bodies
+ * the Client streamed are already on disk, a buffered body is parsed here in one pass.
+ * */
+void Response::handleFileUpload(const Request& request, const Route& route)
+{
+  const std::string& uploadsDir = _config.getUploadsDir(route);
+  const MultipartParser *upload = request.getUpload();
+  MultipartParser *buffered = NULL;
+  if (upload == NULL) {
+    std::string boundary;
+    if (!MultipartParser::boundaryFrom(request.getHeader(HEADER_CONTENT_TYPE), boundary)) {
+      std::cerr << "Error: Upload is not multipart/form-data." << "\n";
+      sendErrorResponse(400, "Bad Request");
+      return;
+    }
+    buffered = new MultipartParser(boundary, uploadsDir);
+    // A spooled body is read back in pieces instead of being loaded whole
+    const RequestBody& body = request.getBody();
+    std::vector<char> chunk(64 * 1024);
+    size_t offset = 0;
+    while (offset < body.size()) {
+      size_t length = body.read(offset, &chunk[0], chunk.size());
+      if (length == 0) {
+        break;
+      }
+      buffered->feed(&chunk[0], length);
+      offset += length;
+    }
+    buffered->finish();
+    upload = buffered;
   }
 
-  // Save the file to the uploads directory
-  std::string filePath = _config.getUploadsDir() + "/" + filename;
-  
-  std::ofstream file(filePath.c_str(), std::ios::binary);
-  if (!file) {
-    std::cerr << "Error: Failed to open file for writing: " << filePath << "\n";
-    sendErrorResponse(500, "Internal Server Error", clientSocket);
+  const std::vector<std::string>& files = upload->files();
+  for (size_t i = 0; i < files.size(); ++i) {
+    _context.fileCache.invalidate(uploadsDir + "/" + files[i]);
+  }
+  int error = upload->status() == MultipartParser::MULTIPART_ERROR ? upload->errorStatus() : 0;
+  if (error == 0 && files.empty()) {
+    std::cerr << "Error: No file in upload request body." << "\n";
+    error = 400;
+  }
+  delete buffered;
+  if (error != 0) {
+    sendErrorResponse(error);
     return;
   }
-  file.write(fileContent.c_str(), fileContent.size());
-  file.close();
 
   // Send a success response
-  std::ostringstream response;
-  response << "HTTP/1.1 200 OK\r\n";
-  response << "Content-Type: text/html\r\n";
-  response << "\r\n";
-  response << "<html><body><h1>File uploaded successfully!</h1></body></html>";
-
-  write(clientSocket, response.str().c_str(), response.str().size());
-}
-
-void Response::sendErrorResponse(int statusCode, const std::string& statusMessage, int clientSocket)
-{
-  std::ostringstream response;
-  response << "HTTP/1.1 " << statusCode << " " << statusMessage << "\r\n";
-  response << "Content-Type: text/html\r\n";
-  response << "Connection: close\r\n";
-  response << "\r\n";
-  response << "<html><body><h1>" << statusCode << " " << statusMessage << "</h1></body></html>";
-  
-  write(clientSocket, response.str().c_str(), response.str().size());
-}
-
-std::string Response::getMimeType(const std::string& filePath)
-{
-  // Extract the file extension
-  size_t dotPos = filePath.find_last_of('.');
-  if (dotPos == std::string::npos) {
-    return "application/octet-stream"; // Default MIME type
-  }
-  
-  std::string extension = filePath.substr(dotPos + 1);
-  
-  // Convert to lowercase for case-insensitive comparison
-  std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
-  
-  // Map common extensions to MIME types
-  if (extension == "html" || extension == "htm") return "text/html";
-  if (extension == "css") return "text/css";
-  if (extension == "js") return "application/javascript";
-  if (extension == "json") return "application/json";
-  if (extension == "txt") return "text/plain";
-  if (extension == "jpg" || extension == "jpeg") return "image/jpeg";
-  if (extension == "png") return "image/png";
-  if (extension == "gif") return "image/gif";
-  if (extension == "svg") return "image/svg+xml";
-  if (extension == "pdf") return "application/pdf";
-  
-  // Default MIME type
-  return "application/octet-stream";
+  static const char responseBody[] = "<html><body><h1>File uploaded successfully!</h1></body></html>";
+  HeaderBuilder& head = _context.headers;
+  head.status(200);
+  head.header("Content-Type", "text/html");
+  head.header("Content-Length", static_cast<off_t>(sizeof(responseBody) - 1));
+  sendHead();
+  _output.pushSlice(responseBody, sizeof(responseBody) - 1);
+}
+
+/*
+ * Sends the error_page configured for statusCode from memory, a generated page otherwise.
+ * */
+void Response::sendErrorResponse(int statusCode, const std::string& statusMessage)
+{
+  sendErrorResponse(statusCode, statusMessage, "");
+}
+
+/*
+ * extraHeaders are CRLF terminated header lines sent with the error, like Allow with 405.
+ * */
+void Response::sendErrorResponse(int statusCode, const std::string& statusMessage, const std::string& extraHeaders)
+{
+  HeaderBuilder& head = _context.headers;
+  const ErrorPage *page = _config.getErrorPage(statusCode);
+  if (page != NULL) {
+    head.status(statusCode);
+    head.raw(extraHeaders);
+    head.header("Content-Type", Utils::getMimeType(page->path));
+    head.header("Content-Length", static_cast<off_t>(page->body.size()));
+    sendHead();
+    _output.pushSlice(page->body.data(), page->body.size());
+    return;
+  }
+
+  char code[16];
+  snprintf(code, sizeof(code), "%d ", statusCode);
+  std::string body = "<html><body><h1>" + (code + statusMessage) + "</h1></body></html>";
+  head.status(statusCode);
+  head.raw(extraHeaders);
+  head.header("Content-Type", "text/html");
+  head.header("Content-Length", static_cast<off_t>(body.size()));
+  sendHead();
+  _output.push(body);
+}
+
+void Response::sendErrorResponse(int statusCode)
+{
+  sendErrorResponse(statusCode, HeaderBuilder::reasonPhrase(statusCode).str());
 }
@@ -5,27 +5,99 @@
 #include <sstream>
 #include <fstream>
 #include <string>
+#include <vector>
 #include <algorithm>
 #include <cctype>
+#include <cstdio>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include "Config.hpp"
 #include "Request.hpp"
+#include "OutputQueue.hpp"
+#include "ServerContext.hpp"
+#include "HeaderBuilder.hpp"
+#include "Utils.hpp"
+
+class CGI;
+class FastCgiRequest;
 
 class Response {
 private:
+  // A static file as it is sent: a range of an open file or a buffer, and its metadata
+  struct Representation {
+    SharedFile *file;
+    SharedBuffer *buffer; // Compressed on the fly, NULL when the bytes come from file
+    off_t offset;         // Of the representation in file, non-zero inside the asset pack
+    off_t size;
+    time_t mtime;
+    StringView mimeType;
+    StringView etag;
+    StringView lastModified;
+    std::string extraHeaders; // Content-Encoding, Vary
+  };
+
+  struct ByteRange {
+    off_t first;
+    off_t last;           // Inclusive
+    bool operator<(const ByteRange& other) const { return first < other.first; }
+  };
+
+  enum RangeResult {
+    RANGE_IGNORED,        // No usable Range header: send the whole file
+    RANGE_SATISFIABLE,
+    RANGE_UNSATISFIABLE   // 416
+  };
+
+  static const off_t MAX_GZIP_SIZE = 1024 * 1024; // Larger files are not compressed on the fly
+
   const Config& _config;
+  OutputQueue& _output;
+  ServerContext& _context;
+  bool _keepAlive;
+  CGI *_cgi; // Script still running when processRequest() returns
+  FastCgiRequest *_fastcgi; // Or FastCGI request still waiting for the application
   
-  std::string getMimeType(const std::string& filePath);
+  const char *connectionHeader() const;
+  const ResponseCache::Entry *cacheStaticFile(const FileCache::Entry& file, const Representation& representation);
+  static bool readFile(const FileCache::Entry& file, std::string& body);
+  SharedBuffer *compressFile(const FileCache::Entry& file);
+  static std::string variantEtag(const StringView& etag, const char *coding);
+  bool servePackedFile(const Request& request, const StringView& path);
+  void sendRepresentation(const Request& request, const Representation& representation);
+  void pushBody(const Representation& representation, off_t offset, off_t length);
+  void representationHead(const Representation& representation);
+  void sendHead();
+  void sendRanges(const Representation& representation, const std::vector<ByteRange>& ranges);
+  static bool ifRangeMatches(const Request& request, const Representation& representation);
+  static RangeResult parseRanges(const StringView& header, off_t size, std::vector<ByteRange>& ranges);
+  static int checkPreconditions(const Request& request, const Representation& representation);
+  static bool matchesEtag(const StringView& header, const StringView& etag, bool weak);
+  void sendNotModified(int statusCode, const Representation& representation);
+  void executeCgi(const Request& request, const Route& route);
+  bool findCgiScript(const Route& route, const std::string& path, std::string& scriptPath, size_t& scriptEnd) const;
+  void sendRedirect(const Request& request, const Route& route);
+  void executeFastCgi(const Request& request, const Route& route);
+
+  Response(const Response&);
+  Response& operator=(const Response&);
 
 public:
-  Response(const Config& config);
+  Response(const Config& config, OutputQueue& output, ServerContext& context);
+  ~Response();
   
-  void processRequest(const Request& request, int clientSocket);
-  void serveStaticFile(const std::string& filePath, int clientSocket);
-  void handleFileUpload(const std::string& body, int clientSocket);
-  void sendErrorResponse(int statusCode, const std::string& statusMessage, int clientSocket);
-  void handleDeleteResponse(const std::string& filePath, int clientSocket);
+  void setKeepAlive(bool keepAlive);
+  bool keepAlive() const;
+  void processRequest(const Request& request);
+  CGI *releaseCgi();
+  FastCgiRequest *releaseFastCgi();
+  void serveStaticFile(const Request& request, const StringView& path, const std::string& filePath, bool packed);
+  static bool streamsBody(const Request& request, const Route *route);
+  void handleFileUpload(const Request& request, const Route& route);
+  void sendErrorResponse(int statusCode, const std::string& statusMessage);
+  void sendErrorResponse(int statusCode, const std::string& statusMessage, const std::string& extraHeaders);
+  void sendErrorResponse(int statusCode);
+  void handleDeleteResponse(const std::string& filePath);
 };
 
 #endif // RESPONSE_HPP
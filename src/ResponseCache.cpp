@@ -0,0 +1,97 @@
+#include "ResponseCache.hpp"
+
+/*
+ * ResponseCache stores the serialized response for hot static files: status line,
+ * headers and body in one buffer, so a hit is queued without touching the filesystem
+ * or formatting anything. Only the Connection header is added per request.
+ * Files larger than maxFileSize are not admitted, the responses held never exceed budget bytes
+ * and the least recently used one is dropped first; a budget of 0 disables the cache.
+ * An entry is tied to the FileCache entry it was built from: when the file changes, the
+ * FileCache reloads it under a new generation and the stale response is dropped on its next lookup.
+ * Buffers are refcounted, responses still being sent survive eviction.
+ * */
+ResponseCache::ResponseCache(size_t budget, size_t maxFileSize)
+  : _budget(budget), _maxFileSize(maxFileSize), _used(0), _hits(0), _misses(0)
+{
+}
+
+ResponseCache::~ResponseCache()
+{
+  while (!_entries.empty()) {
+    erase(_entries.begin());
+  }
+}
+
+bool ResponseCache::admits(const FileCache::Entry& file) const
+{
+  return _budget > 0 && file.regular && static_cast<size_t>(file.size) <= _maxFileSize;
+}
+
+/*
+ * Returns the cached response for file, NULL on a miss.
+ * The pointer stays valid until the next call on the cache.
+ * */
+const ResponseCache::Entry *ResponseCache::lookup(const FileCache::Entry& file)
+{
+  if (!admits(file)) {
+    return NULL;
+  }
+  EntryMap::iterator it = _entries.find(file.path);
+  if (it != _entries.end()) {
+    if (it->second.generation == file.generation) {
+      ++_hits;
+      _lru.splice(_lru.begin(), _lru, it->second.lru);
+      return &it->second;
+    }
+    erase(it);
+  }
+  ++_misses;
+  return NULL;
+}
+
+/*
+ * Stores the response for file, evicting older ones to stay within the budget.
+ * head ends before the empty line that separates it from the body.
+ * */
+const ResponseCache::Entry *ResponseCache::insert(const FileCache::Entry& file, const std::string& head,
+                                                  const std::string& body)
+{
+  size_t size = head.size() + 2 + body.size();
+  if (!admits(file) || size > _budget) {
+    return NULL;
+  }
+  EntryMap::iterator existing = _entries.find(file.path);
+  if (existing != _entries.end()) {
+    erase(existing);
+  }
+  while (_used + size > _budget) {
+    erase(_entries.find(_lru.back()));
+  }
+
+  Entry& entry = _entries[file.path];
+  entry.response = new SharedBuffer(head + "\r\n" + body);
+  entry.headLength = head.size();
+  entry.generation = file.generation;
+  _lru.push_front(file.path);
+  entry.lru = _lru.begin();
+  _used += size;
+  return &entry;
+}
+
+void ResponseCache::erase(EntryMap::iterator it)
+{
+  _used -= it->second.response->data.size();
+  it->second.response->release();
+  _lru.erase(it->second.lru);
+  _entries.erase(it);
+}
+
+unsigned long ResponseCache::hits() const
+{
+  return _hits;
+}
+
+unsigned long ResponseCache::misses() const
+{
+  return _misses;
+}
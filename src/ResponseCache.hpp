@@ -0,0 +1,48 @@
+#ifndef RESPONSECACHE_HPP
+#define RESPONSECACHE_HPP
+
+#include <string>
+#include <map>
+#include <list>
+#include "FileCache.hpp"
+#include "SharedBuffer.hpp"
+
+/*
+ * Complete 200 responses for small static files, kept in memory within a byte budget.
+ */
+class ResponseCache {
+public:
+  struct Entry {
+    SharedBuffer *response;   // Status line and headers, then the body
+    size_t headLength;        // Bytes before the empty line ending the headers
+    unsigned long generation; // FileCache generation the response was built from
+    std::list<std::string>::iterator lru;
+  };
+
+  ResponseCache(size_t budget, size_t maxFileSize);
+  ~ResponseCache();
+
+  bool admits(const FileCache::Entry& file) const;
+  const Entry *lookup(const FileCache::Entry& file);
+  const Entry *insert(const FileCache::Entry& file, const std::string& head, const std::string& body);
+  unsigned long hits() const;
+  unsigned long misses() const;
+
+private:
+  typedef std::map<std::string, Entry> EntryMap;
+
+  size_t _budget;
+  size_t _maxFileSize;
+  size_t _used;
+  EntryMap _entries;
+  std::list<std::string> _lru; // Most recently used first
+  unsigned long _hits;
+  unsigned long _misses;
+
+  ResponseCache(const ResponseCache&);
+  ResponseCache& operator=(const ResponseCache&);
+
+  void erase(EntryMap::iterator it);
+};
+
+#endif // RESPONSECACHE_HPP
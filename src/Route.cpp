@@ -0,0 +1,100 @@
+#include "Route.hpp"
+#include <sstream>
+
+namespace
+{
+  const char *const METHOD_NAMES[] = { "GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS", "PATCH" };
+  const size_t METHOD_COUNT = sizeof(METHOD_NAMES) / sizeof(METHOD_NAMES[0]);
+}
+
+bool Route::isPrefix() const
+{
+  return !path.empty() && path[path.size() - 1] == '*';
+}
+
+/*
+ * The path without the '*' of a prefix route.
+ * */
+StringView Route::base() const
+{
+  return StringView(path.data(), isPrefix() ? path.size() - 1 : path.size());
+}
+
+/*
+ * What follows the route's base in requestPath, which the route matched:
+ * "img/logo.png" for "/static/img/logo.png" and "/static/ *", empty for an exact route.
+ * */
+StringView Route::rest(const StringView& requestPath) const
+{
+  size_t length = base().length;
+  return StringView(requestPath.data + length, requestPath.length - length);
+}
+
+/*
+ * File or directory of requestPath: destination takes the place of the route's base,
+ * "/files/a.txt" is "/srv/files/a.txt" for "/files/ *" and "/srv/files". Without a
+ * destination it is found in documentRoot.
+ * */
+std::string Route::filePath(const std::string& documentRoot, const StringView& requestPath) const
+{
+  if (destination.empty()) {
+    return documentRoot + requestPath;
+  }
+  StringView below = rest(requestPath);
+  std::string file = destination;
+  if (!below.empty() && below.data[0] != '/' && file[file.size() - 1] != '/') {
+    file += '/';
+  }
+  file.append(below.data, below.length);
+  return file;
+}
+
+bool Route::allowsMethod(const StringView& method) const
+{
+  return (methods & methodBit(method)) != 0;
+}
+
+/*
+ * Value of the Allow header sent with 405, for example "GET, POST".
+ * */
+std::string Route::allowHeader() const
+{
+  std::string allow;
+  for (size_t i = 0; i < METHOD_COUNT; ++i) {
+    if (methods & (1u << i)) {
+      if (!allow.empty()) {
+        allow += ", ";
+      }
+      allow += METHOD_NAMES[i];
+    }
+  }
+  return allow;
+}
+
+/*
+ * The RouteMethod bit of method, 0 for methods the server does not know.
+ * */
+unsigned Route::methodBit(const StringView& method)
+{
+  for (size_t i = 0; i < METHOD_COUNT; ++i) {
+    if (method == METHOD_NAMES[i]) {
+      return 1u << i;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Parses a comma-separated list like "GET,POST", "ALL" allows every method.
+ * */
+unsigned Route::parseMethods(const std::string& list)
+{
+  unsigned methods = 0;
+  std::istringstream stream(list);
+  std::string method;
+  while (std::getline(stream, method, ',')) {
+    StringView name = StringView(method).trim();
+    methods |= (name == "ALL") ? static_cast<unsigned>(METHOD_ALL) : methodBit(name);
+  }
+  return methods;
+}
@@ -3,21 +3,48 @@
 
 #include <string>
 #include <vector>
+#include "StringView.hpp"
+
+// What answers the requests of a route
+enum RouteHandler {
+  ROUTE_STATIC,   // Files below destination (or the document root), DELETE removes them
+  ROUTE_UPLOAD,   // multipart/form-data bodies saved in destination (or uploads_dir)
+  ROUTE_CGI,      // Scripts below destination (or the document root)
+  ROUTE_REDIRECT, // 301 to destination
+  ROUTE_FASTCGI   // The application at fastcgiPass
+};
+
+// Allowed methods of a route as a bitmask
+enum RouteMethod {
+  METHOD_GET = 1 << 0,
+  METHOD_HEAD = 1 << 1,
+  METHOD_POST = 1 << 2,
+  METHOD_PUT = 1 << 3,
+  METHOD_DELETE = 1 << 4,
+  METHOD_OPTIONS = 1 << 5,
+  METHOD_PATCH = 1 << 6,
+  METHOD_ALL = (1 << 7) - 1
+};
 
 struct Route {
-  std::string path;
+  std::string path;         // Ends with '*' for a prefix route
   std::string destination;
-  std::vector<std::string> allowedMethods;
-  
-  bool allowsMethod(const std::string& method) const {
-    for (std::vector<std::string>::const_iterator it = allowedMethods.begin(); 
-         it != allowedMethods.end(); ++it) {
-      if (*it == method || *it == "ALL") {
-        return true;
-      }
-    }
-    return false;
-  }
+  unsigned methods;         // RouteMethod bits
+  RouteHandler handler;
+  std::string fastcgiPass;  // Address of the FastCGI application, empty for other routes
+  int cacheValid;           // cgi_cache: seconds output without Cache-Control or Expires is kept
+  std::vector<std::string> cacheKeyHeaders; // cgi_cache: request headers the output varies on
+
+  Route() : methods(METHOD_GET), handler(ROUTE_STATIC), cacheValid(0) {}
+
+  bool isPrefix() const;
+  StringView base() const;
+  StringView rest(const StringView& requestPath) const;
+  std::string filePath(const std::string& documentRoot, const StringView& requestPath) const;
+  bool allowsMethod(const StringView& method) const;
+  std::string allowHeader() const;
+  static unsigned methodBit(const StringView& method);
+  static unsigned parseMethods(const std::string& list);
 };
 
 #endif // ROUTE_HPP
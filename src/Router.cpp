@@ -0,0 +1,121 @@
+#include "Router.hpp"
+#include <cstring>
+
+/*
+ * An exact route ("/upload") matches its path only, a prefix route ("/static/ *") every path
+ * starting with its base. When several match, an exact route wins, then the prefix route
+ * with the longest base. Adding a route with the same path again replaces it.
+ * */
+Router::Router()
+{
+  newNode("");
+}
+
+void Router::add(const Route& route)
+{
+  int node = insert(route.base());
+  int& slot = route.isPrefix() ? _nodes[node].prefix : _nodes[node].exact;
+  if (slot != -1) {
+    _routes[slot] = route;
+    return;
+  }
+  slot = static_cast<int>(_routes.size());
+  _routes.push_back(route);
+}
+
+/*
+ * Returns the route of path (without the query string), NULL if none matches.
+ * The path is walked once, remembering the last prefix route passed on the way.
+ * */
+const Route *Router::find(const StringView& path) const
+{
+  int node = 0;
+  size_t pos = 0;
+  int best = _nodes[0].prefix;
+  while (pos < path.length) {
+    int next = child(node, path.data[pos]);
+    if (next == -1) {
+      break;
+    }
+    const std::string& label = _nodes[next].label;
+    if (label.size() > path.length - pos || memcmp(label.data(), path.data + pos, label.size()) != 0) {
+      break;
+    }
+    pos += label.size();
+    node = next;
+    if (_nodes[node].prefix != -1) {
+      best = _nodes[node].prefix;
+    }
+  }
+  if (pos == path.length && _nodes[node].exact != -1) {
+    best = _nodes[node].exact;
+  }
+  return best == -1 ? NULL : &_routes[best];
+}
+
+size_t Router::size() const
+{
+  return _routes.size();
+}
+
+/*
+ * Returns the node where path ends, adding it if needed. An edge whose label only
+ * shares the first bytes with path is split at the end of the common part.
+ * */
+int Router::insert(const StringView& path)
+{
+  int node = 0;
+  size_t pos = 0;
+  while (pos < path.length) {
+    int next = child(node, path.data[pos]);
+    if (next == -1) {
+      int added = newNode(std::string(path.data + pos, path.length - pos));
+      _nodes[node].children.push_back(added);
+      return added;
+    }
+    std::string label = _nodes[next].label;
+    size_t common = 0;
+    while (common < label.size() && pos + common < path.length && label[common] == path.data[pos + common]) {
+      ++common;
+    }
+    if (common < label.size()) {
+      int middle = newNode(label.substr(0, common));
+      _nodes[middle].children.push_back(next);
+      _nodes[next].label = label.substr(common);
+      std::vector<int>& children = _nodes[node].children;
+      for (size_t i = 0; i < children.size(); ++i) {
+        if (children[i] == next) {
+          children[i] = middle;
+        }
+      }
+      next = middle;
+    }
+    pos += common;
+    node = next;
+  }
+  return node;
+}
+
+/*
+ * The child of node whose label starts with first, -1 if there is none.
+ * */
+int Router::child(int node, char first) const
+{
+  const std::vector<int>& children = _nodes[node].children;
+  for (size_t i = 0; i < children.size(); ++i) {
+    if (_nodes[children[i]].label[0] == first) {
+      return children[i];
+    }
+  }
+  return -1;
+}
+
+int Router::newNode(const std::string& label)
+{
+  Node node;
+  node.label = label;
+  node.exact = -1;
+  node.prefix = -1;
+  _nodes.push_back(node);
+  return static_cast<int>(_nodes.size()) - 1;
+}
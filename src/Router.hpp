@@ -0,0 +1,39 @@
+#ifndef ROUTER_HPP
+#define ROUTER_HPP
+
+#include <string>
+#include <vector>
+#include "Route.hpp"
+#include "StringView.hpp"
+
+/*
+ * Routes compiled into a radix tree over their paths, so finding the route of a request
+ * takes time proportional to the length of its path, however many routes there are.
+ * Nodes refer to each other and to the routes by index: a Router can be copied with
+ * the Config that holds it.
+ */
+class Router {
+public:
+  Router();
+
+  void add(const Route& route);
+  const Route *find(const StringView& path) const;
+  size_t size() const;
+
+private:
+  struct Node {
+    std::string label;         // Bytes of the path between the parent and this node
+    std::vector<int> children; // Their labels start with different bytes
+    int exact;                 // Route whose path ends here, -1 if none
+    int prefix;                // Prefix route whose base ends here, -1 if none
+  };
+
+  std::vector<Node> _nodes;    // _nodes[0] is the root, its label is empty
+  std::vector<Route> _routes;
+
+  int insert(const StringView& path);
+  int child(int node, char first) const;
+  int newNode(const std::string& label);
+};
+
+#endif // ROUTER_HPP
@@ -0,0 +1,216 @@
+#include "Scan.hpp"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define SCAN_X86 1
+# include <immintrin.h>
+#endif
+
+/*
+ * The SIMD kernels compare 16 (SSE2) or 32 (AVX2) bytes per instruction and turn the
+ * comparison into a bit mask, the position of the first set bit is the first match.
+ * Substring search compares the first and the last byte of the needle at every position
+ * of a block at once and only checks the middle of the needle where both match.
+ * Bytes left over at the end of the buffer go through the scalar versions.
+ * */
+namespace
+{
+  typedef const char *(*FindControlFn)(const char *, size_t, unsigned char);
+  typedef size_t (*FindFn)(const char *, size_t, const char *, size_t);
+
+  // Scalar versions
+
+  const char *findControlScalar(const char *data, size_t length, unsigned char below)
+  {
+    for (size_t i = 0; i < length; ++i) {
+      unsigned char byte = static_cast<unsigned char>(data[i]);
+      if (byte < below || byte == 0x7f)
+        return data + i;
+    }
+    return NULL;
+  }
+
+  size_t findScalar(const char *data, size_t length, const char *needle, size_t needleLength)
+  {
+    if (needleLength == 0)
+      return 0;
+    if (needleLength > length)
+      return length;
+    size_t last = length - needleLength;
+    for (size_t i = 0; i <= last; ++i) {
+      const char *hit = static_cast<const char*>(memchr(data + i, needle[0], last - i + 1));
+      if (hit == NULL)
+        break;
+      i = hit - data;
+      if (memcmp(hit + 1, needle + 1, needleLength - 1) == 0)
+        return i;
+    }
+    return length;
+  }
+
+#ifdef SCAN_X86
+
+  // SSE2 versions (always available on x86-64)
+
+  __attribute__((target("sse2")))
+  const char *findControlSse2(const char *data, size_t length, unsigned char below)
+  {
+    // Unsigned "byte < below" as a signed comparison after flipping the top bit
+    const __m128i flip = _mm_set1_epi8(static_cast<char>(0x80));
+    const __m128i limit = _mm_set1_epi8(static_cast<char>(below ^ 0x80));
+    const __m128i del = _mm_set1_epi8(0x7f);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+      __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+      __m128i low = _mm_cmplt_epi8(_mm_xor_si128(block, flip), limit);
+      int mask = _mm_movemask_epi8(_mm_or_si128(low, _mm_cmpeq_epi8(block, del)));
+      if (mask != 0)
+        return data + i + __builtin_ctz(mask);
+    }
+    return findControlScalar(data + i, length - i, below);
+  }
+
+  __attribute__((target("sse2")))
+  size_t findSse2(const char *data, size_t length, const char *needle, size_t needleLength)
+  {
+    if (needleLength < 2 || needleLength > length)
+      return findScalar(data, length, needle, needleLength);
+
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needleLength - 1]);
+    size_t i = 0;
+    for (; i + needleLength - 1 + 16 <= length; i += 16) {
+      __m128i blockFirst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+      __m128i blockLast = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + needleLength - 1));
+      int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(blockFirst, first),
+                                                 _mm_cmpeq_epi8(blockLast, last)));
+      while (mask != 0) {
+        int bit = __builtin_ctz(mask);
+        if (memcmp(data + i + bit + 1, needle + 1, needleLength - 2) == 0)
+          return i + bit;
+        mask &= mask - 1;
+      }
+    }
+    return i + findScalar(data + i, length - i, needle, needleLength);
+  }
+
+  // AVX2 versions
+
+  __attribute__((target("avx2")))
+  const char *findControlAvx2(const char *data, size_t length, unsigned char below)
+  {
+    const __m256i flip = _mm256_set1_epi8(static_cast<char>(0x80));
+    const __m256i limit = _mm256_set1_epi8(static_cast<char>(below ^ 0x80));
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+      __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+      __m256i low = _mm256_cmpgt_epi8(limit, _mm256_xor_si256(block, flip));
+      unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(low, _mm256_cmpeq_epi8(block, del)));
+      if (mask != 0)
+        return data + i + __builtin_ctz(mask);
+    }
+    return findControlSse2(data + i, length - i, below);
+  }
+
+  __attribute__((target("avx2")))
+  size_t findAvx2(const char *data, size_t length, const char *needle, size_t needleLength)
+  {
+    if (needleLength < 2 || needleLength > length)
+      return findScalar(data, length, needle, needleLength);
+
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needleLength - 1]);
+    size_t i = 0;
+    for (; i + needleLength - 1 + 32 <= length; i += 32) {
+      __m256i blockFirst = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+      __m256i blockLast = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + needleLength - 1));
+      unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(blockFirst, first),
+                                                                _mm256_cmpeq_epi8(blockLast, last)));
+      while (mask != 0) {
+        int bit = __builtin_ctz(mask);
+        if (memcmp(data + i + bit + 1, needle + 1, needleLength - 2) == 0)
+          return i + bit;
+        mask &= mask - 1;
+      }
+    }
+    return i + findSse2(data + i, length - i, needle, needleLength);
+  }
+
+#endif // SCAN_X86
+
+  struct Kernels {
+    FindControlFn findControl;
+    FindFn find;
+    const char *name;
+
+    // Runs during static initialization, before any worker thread starts
+    Kernels()
+      : findControl(findControlScalar), find(findScalar), name("scalar")
+    {
+#ifdef SCAN_X86
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2")) {
+        findControl = findControlAvx2;
+        find = findAvx2;
+        name = "avx2";
+      } else if (__builtin_cpu_supports("sse2")) {
+        findControl = findControlSse2;
+        find = findSse2;
+        name = "sse2";
+      }
+#endif
+    }
+  };
+
+  const Kernels g_kernels;
+}
+
+/*
+ * glibc's memchr() already picks an SSE2/AVX2/EVEX version at load time
+ * and is faster than a plain compare loop, so single bytes go through it.
+ * */
+const char *Scan::findByte(const char *data, size_t length, char c)
+{
+  return static_cast<const char*>(memchr(data, c, length));
+}
+
+const char *Scan::findControl(const char *data, size_t length, unsigned char below)
+{
+  return g_kernels.findControl(data, length, below);
+}
+
+/*
+ * memchr() skips ahead faster while the first byte of the needle is rare.
+ * Once it keeps stopping on false candidates (a boundary starting with "\r\n" in a text body),
+ * the first/last byte filter of the SIMD kernel takes over for the rest of the buffer.
+ * */
+size_t Scan::find(const char *data, size_t length, const char *needle, size_t needleLength)
+{
+  if (needleLength == 0) {
+    return 0;
+  }
+
+  size_t pos = 0;
+  int falseCandidates = 0;
+  while (pos + needleLength <= length) {
+    const char *hit = static_cast<const char*>(memchr(data + pos, needle[0], length - needleLength + 1 - pos));
+    if (hit == NULL) {
+      return length;
+    }
+    pos = hit - data;
+    if (memcmp(hit + 1, needle + 1, needleLength - 1) == 0) {
+      return pos;
+    }
+    ++pos;
+    if (++falseCandidates == 8) {
+      return pos + g_kernels.find(data + pos, length - pos, needle, needleLength);
+    }
+  }
+  return length;
+}
+
+const char *Scan::implementation()
+{
+  return g_kernels.name;
+}
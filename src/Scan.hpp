@@ -0,0 +1,27 @@
+#ifndef SCAN_HPP
+#define SCAN_HPP
+
+#include <cstddef>
+
+/*
+ * Byte scanning kernels used by the request parsers.
+ * findControl() and find() have a scalar, an SSE2 and an AVX2 version,
+ * the fastest one the CPU supports is selected once at startup (CPUID).
+ */
+namespace Scan
+{
+    // First occurrence of c, NULL if there is none (like memchr)
+    const char *findByte(const char *data, size_t length, char c);
+
+    // First byte lower than below or equal to DEL (0x7f), NULL if there is none.
+    // below=0x20 finds the end of a header value, below=0x21 the end of a URL.
+    const char *findControl(const char *data, size_t length, unsigned char below);
+
+    // Offset of the first occurrence of needle, length if there is none
+    size_t find(const char *data, size_t length, const char *needle, size_t needleLength);
+
+    // Name of the selected implementation: "avx2", "sse2" or "scalar"
+    const char *implementation();
+}
+
+#endif // SCAN_HPP
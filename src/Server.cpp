@@ -3,19 +3,27 @@
 #include "NetworkManager.hpp"
 #include "Response.hpp"
 #include "Config.hpp"
+#include "CGI.hpp"
+#include "FastCgiRequest.hpp"
 
 /*
 * Server manages high-level server operations, such as starting and stopping the server,
 * accepting new client connections, and processing client events.
 * It uses a NetworkManager object to handle low-level network operations.
+* Each Server owns its listening socket, epoll instance and client map, so several
+* Servers can run side by side in worker threads (see WorkerManager).
  * */
-Server::Server(const Config& config) 
+Server::Server(const Config& config, bool reusePort) 
   : _port(config.getPort()), 
     _serverSocket(-1), 
     _epollFd(-1), 
     _isRunning(false),
+    _lastTimeoutCheck(0),
+    _sharedListener(false),
+    _stats(NULL),
     _config(config),
-    _networkManager(NetworkManager(_port))
+    _networkManager(NetworkManager(_port, reusePort)),
+    _context(config)
 {
   std::cout << "Server initiated on port: " << _port << "\n";
 }
@@ -23,6 +31,28 @@ Server::Server(const Config& config)
 Server::~Server()
 {
   stop();
+  // Clients return their receive blocks to _bufferPool, so they go first
+  while (!_clients.empty()) {
+    removeClient(_clients.begin()->second);
+  }
+}
+
+/*
+ * Function makes the Server accept connections on a socket that is already listening,
+ * for example one bound once by the master process and shared by forked workers.
+ * */
+void Server::useListeningSocket(int serverSocket)
+{
+  _serverSocket = serverSocket;
+  _sharedListener = true;
+}
+
+/*
+ * Function sets the shared memory slot where this worker counts its connections and requests.
+ * */
+void Server::setStats(WorkerStats *stats)
+{
+  _stats = stats;
 }
 
 void Server::stop()
@@ -35,10 +65,21 @@ void Server::stop()
 void Server::start()
 {
   try {
-    _serverSocket = _networkManager.createSocket();
-    _networkManager.bindSocket(_serverSocket, _serverAddress);
-    _networkManager.listenForConnections(_serverSocket);
-    _epollFd = _networkManager.setupEpoll(_serverSocket);
+    if (!_sharedListener) {
+      _serverSocket = _networkManager.createSocket();
+      _networkManager.bindSocket(_serverSocket, _serverAddress);
+      _networkManager.listenForConnections(_serverSocket);
+    }
+    _epollFd = _networkManager.setupEpoll(_serverSocket, _sharedListener);
+    if (_context.fileCache.notifyFd() != -1) {
+      // File changes under the document root invalidate the cached descriptors
+      struct epoll_event event;
+      event.events = EPOLLIN;
+      event.data.fd = _context.fileCache.notifyFd();
+      if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, event.data.fd, &event) == -1)
+        throw std::runtime_error("Error: Failed to add inotify to epoll. " + std::string(strerror(errno)));
+    }
+    _context.fastcgi.setEpoll(_epollFd);
     _isRunning = true;
     
     // Resize the events vector to hold up to 64 events
@@ -60,16 +101,33 @@ void Server::handleEvents()
 {
   while (_isRunning)
   {
-    // epoll_wait() waits for events on the file descriptor in the epoll set
-    int numEvents = epoll_wait(_epollFd, _events.data(), _events.size(), -1);
+    // epoll_wait() waits for events on the file descriptor in the epoll set.
+    // It wakes up every second so idle keep-alive connections can be closed.
+    int numEvents = epoll_wait(_epollFd, _events.data(), _events.size(), 1000);
     if (numEvents == -1)
     {
       std::cerr << "Error: epoll_wait failed. " << strerror(errno) << "\n";
       continue;
     }
 
+    bool acceptPending = false;
     for (int i = 0; i < numEvents; ++i)
     {
+      if (_events[i].data.fd == _serverSocket) {
+        // Accepted after the batch: a descriptor closed while handling an earlier event
+        // may still have an event further down, it must not hit a client given its number
+        acceptPending = true;
+        continue;
+      }
+      if (_events[i].data.fd == _context.fileCache.notifyFd()) {
+        _context.fileCache.processEvents();
+        continue;
+      }
+      // A CGI pipe reports EPOLLHUP at EOF, it is not a client going away
+      if (processCgiEvent(_events[i].data.fd)
+          || _context.fastcgi.handleEvent(_events[i].data.fd, _events[i].events)) {
+        continue;
+      }
       // Event detected, check if it's for the server or client socket
       if (_events[i].events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
         std::map<int, Client*>::iterator it = _clients.find(_events[i].data.fd);
@@ -78,13 +136,206 @@ void Server::handleEvents()
         }
         continue;
       }
-      if (_events[i].data.fd == _serverSocket) { // server socket listens for incoming connections.
-        acceptClient(); // New client connection 
+      processClientEvent(_events[i].data.fd, _events[i].events); // Handle client data
+    }
+    if (acceptPending) {
+      acceptClient(); // New client connection
+    }
+    closeIdleClients();
+    serveFastCgiClients();
+    serveCgiWaiters();
+    _context.assetPack.reloadIfChanged();
+  }
+}
+
+/*
+ * Function closes keep-alive connections that stayed idle longer than keepalive_timeout
+ * between two requests. A client still sending a request or receiving a response may
+ * instead stay silent for client_timeout, so keepalive_timeout=0 does not cut downloads.
+ * The client table is scanned at most once per second. Clients waiting for a CGI script
+ * or a FastCGI application are not idle, a silent script is killed (a FastCGI request
+ * aborted) after cgi_timeout instead, and a client that takes none of the output for
+ * that long is dropped.
+ * */
+void Server::closeIdleClients()
+{
+  time_t now = time(NULL);
+  if (now == _lastTimeoutCheck) {
+    return;
+  }
+  _lastTimeoutCheck = now;
+
+  std::vector<Client*> expired;
+  std::vector<Client*> finished;
+  for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
+    CGI *cgi = it->second->getCgi();
+    FastCgiRequest *fastcgi = it->second->getFastCgi();
+    if (cgi != NULL || fastcgi != NULL) {
+      if (cgi != NULL) {
+        cgi->checkTimeout(now);
       } else {
-        processClientEvent(_events[i].data.fd); // Handle client data
+        fastcgi->checkTimeout(now);
+      }
+      if (cgi != NULL ? cgi->done() : fastcgi->done()) {
+        finished.push_back(it->second);
+      } else if (!it->second->getOutput().empty()
+                 && now - it->second->getLastActivity() >= _config.getCgiTimeout()) {
+        expired.push_back(it->second);
+      }
+    } else {
+      int timeout = it->second->isBetweenRequests() ? _config.getKeepaliveTimeout()
+                                                     : _config.getClientTimeout();
+      if (now - it->second->getLastActivity() >= timeout) {
+        expired.push_back(it->second);
       }
     }
   }
+  for (size_t i = 0; i < expired.size(); ++i) {
+    removeClient(expired[i]);
+  }
+  for (size_t i = 0; i < finished.size(); ++i) {
+    serveClient(finished[i]);
+  }
+}
+
+/*
+ * Function adds the pipes and the pidfd of the client's CGI script to the epoll set.
+ * A request waiting for the output of another script has none yet, it is kept until
+ * the CgiCache lets it go (see serveCgiWaiters()).
+ * */
+void Server::registerCgi(Client *client)
+{
+  CGI *cgi = client->getCgi();
+  if (cgi->waiting()) {
+    _cgiWaiters[cgi] = client;
+    return;
+  }
+  int fds[3] = { cgi->outputFd(), cgi->inputFd(), cgi->exitFd() };
+  uint32_t events[3] = { EPOLLIN | EPOLLET, EPOLLOUT | EPOLLET, EPOLLIN };
+  for (int i = 0; i < 3; ++i) {
+    if (fds[i] == -1) {
+      continue;
+    }
+    struct epoll_event event;
+    event.events = events[i];
+    event.data.fd = fds[i];
+    if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fds[i], &event) == -1) {
+      std::cerr << "Error: Failed to add CGI pipe to epoll. " << strerror(errno) << "\n";
+      continue;
+    }
+    _cgiClients[fds[i]] = client;
+  }
+}
+
+/*
+ * Function forgets the CGI descriptors or the FastCGI request of a client.
+ * Closing the descriptors removed them from epoll.
+ * */
+void Server::unregisterCgi(Client *client)
+{
+  if (client->getFastCgi() != NULL) {
+    _fastcgiClients.erase(client->getFastCgi());
+  }
+  if (client->getCgi() != NULL) {
+    _cgiWaiters.erase(client->getCgi());
+  }
+  std::map<int, Client*>::iterator it = _cgiClients.begin();
+  while (it != _cgiClients.end()) {
+    if (it->second == client) {
+      _cgiClients.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+/*
+ * Function passes an event on a CGI pipe or pidfd to the script and sends what it produced.
+ * Returns false if fd is not the descriptor of a running script. The script closes
+ * descriptors it is done with while it runs, so a number found in _cgiClients may
+ * meanwhile belong to a new client socket.
+ * */
+bool Server::processCgiEvent(int fd)
+{
+  std::map<int, Client*>::iterator it = _cgiClients.find(fd);
+  if (it == _cgiClients.end()) {
+    return false;
+  }
+  Client *client = it->second;
+  CGI *cgi = client->getCgi();
+  if (fd == cgi->outputFd()) {
+    cgi->readOutput();
+  } else if (fd == cgi->inputFd()) {
+    cgi->writeInput();
+  } else if (fd == cgi->exitFd()) {
+    cgi->handleExit();
+  } else {
+    _cgiClients.erase(it);
+    return false;
+  }
+  serveClient(client);
+  return true;
+}
+
+/*
+ * Function ends a CGI or FastCGI response: the connection is kept for the next request
+ * unless the output had to be delimited by closing it.
+ * */
+void Server::finishCgi(Client *client)
+{
+  bool keepAlive = client->getCgi() != NULL ? client->getCgi()->keepAlive() : client->getFastCgi()->keepAlive();
+  unregisterCgi(client);
+  client->endCgi();
+  if (keepAlive) {
+    client->reset();
+  } else {
+    client->closeAfterOutput();
+  }
+}
+
+/*
+ * Function serves the clients whose FastCGI requests got output or finished.
+ * Serving one can make the pool read more, so this repeats until nothing is left.
+ * */
+void Server::serveFastCgiClients()
+{
+  std::vector<FastCgiRequest*> touched;
+  _context.fastcgi.takeTouched(touched);
+  while (!touched.empty()) {
+    for (size_t i = 0; i < touched.size(); ++i) {
+      // Gone if an earlier client in the list failed and was removed with its request
+      std::map<FastCgiRequest*, Client*>::iterator it = _fastcgiClients.find(touched[i]);
+      if (it != _fastcgiClients.end()) {
+        serveClient(it->second);
+      }
+    }
+    _context.fastcgi.takeTouched(touched);
+  }
+}
+
+/*
+ * Function serves the clients whose requests waited in the CgiCache: they got the cached
+ * output, or run the script themselves now and their descriptors join the epoll set.
+ * */
+void Server::serveCgiWaiters()
+{
+  std::vector<CGI*> touched;
+  _context.cgiCache.takeTouched(touched);
+  while (!touched.empty()) {
+    for (size_t i = 0; i < touched.size(); ++i) {
+      std::map<CGI*, Client*>::iterator it = _cgiWaiters.find(touched[i]);
+      if (it == _cgiWaiters.end()) {
+        continue;
+      }
+      Client *client = it->second;
+      _cgiWaiters.erase(it);
+      if (!touched[i]->done()) {
+        registerCgi(client);
+      }
+      serveClient(client);
+    }
+    _context.cgiCache.takeTouched(touched);
+  }
 }
 
 /*
@@ -93,8 +344,14 @@ void Server::handleEvents()
 void Server::acceptClient()
 {
   try {
-    Client *client = _networkManager.acceptConnection(_serverSocket, _epollFd);
+    Client *client = _networkManager.acceptConnection(_serverSocket, _epollFd, &_bufferPool, &_config);
+    if (client == NULL) {
+      return; // Another worker accepted the connection first
+    }
     _clients[client->getSocket()] = client;
+    if (_stats) {
+      ++_stats->connections;
+    }
   }
   catch (const std::exception& e) {
     std::cerr << "Exception in acceptClient: " << e.what() << "\n";
@@ -103,33 +360,118 @@ void Server::acceptClient()
 
 void Server::removeClient(Client *client)
 {
+  // The Client destructor closes the socket and kills a CGI script still running
+  unregisterCgi(client);
+  _clients.erase(client->getSocket());
   epoll_ctl(_epollFd, EPOLL_CTL_DEL, client->getSocket(), NULL);
-  close(client->getSocket());
   delete client;
-  _clients.erase(client->getSocket());
 }
 
 /*
  * Function processes an event on a client socket.
- * It reads the client request, processes it, and sends a response.
+ * It reads the client request on EPOLLIN and resumes pending output on EPOLLOUT.
  * */
-void Server::processClientEvent(int clientSocket)
+void Server::processClientEvent(int clientSocket, uint32_t events)
 {
-  if (_clients.find(clientSocket) == _clients.end()) {
+  std::map<int, Client*>::iterator it = _clients.find(clientSocket);
+  if (it == _clients.end()) {
     std::cerr << "Error: Client socket not found in client map.\n";
     return;
   }
 
-  Client *client = _clients[clientSocket];
-  if (!client->readRequest()) {
+  Client *client = it->second;
+  if ((events & EPOLLIN) && !client->readRequest()) {
     removeClient(client);
     return;
   }
- 
-  if (client->hasCompleteRequest()) {
-    Request request = client->getRequest();
-    Response response(_config);
-    response.processRequest(request, clientSocket);
-    removeClient(client);
+  serveClient(client);
+}
+
+/*
+ * Function flushes the client's pending output and answers the next buffered request
+ * once the previous response is fully sent, so responses stay in order and a slow reader
+ * only holds its own queue. When the socket is full the loop stops and EPOLLOUT resumes it.
+ * Persistent connections are reset and kept in the client map for the next request,
+ * pipelined requests that are already buffered are answered in the same pass.
+ * While a CGI script runs, its output is read on as the client takes it (see CGI::resume),
+ * and so is the output of a FastCGI application.
+ * */
+void Server::serveClient(Client *client)
+{
+  while (true) {
+    OutputQueue::FlushResult result = client->flushOutput();
+    if (result == OutputQueue::FLUSH_ERROR) {
+      removeClient(client);
+      return;
+    }
+    CGI *cgi = client->getCgi();
+    FastCgiRequest *fastcgi = client->getFastCgi();
+    if ((cgi != NULL && cgi->resume()) || (fastcgi != NULL && fastcgi->resume())) {
+      continue; // Send what was read
+    }
+    if ((cgi != NULL && cgi->done()) || (fastcgi != NULL && fastcgi->done())) {
+      finishCgi(client);
+      continue;
+    }
+    if (result == OutputQueue::FLUSH_AGAIN) {
+      return; // Wait for EPOLLOUT
+    }
+    if (cgi != NULL || fastcgi != NULL) {
+      return; // Wait for the script or the application
+    }
+    if (client->isClosing()) {
+      removeClient(client);
+      return;
+    }
+    if (!client->hasCompleteRequest() && client->isReadPaused()) {
+      if (!client->readRequest()) {
+        removeClient(client);
+        return;
+      }
+      continue; // The next request may have been left in the socket
+    }
+    if (!client->hasCompleteRequest()) {
+      if (client->isPeerClosed()) {
+        removeClient(client);
+      }
+      return; // Wait for more data
+    }
+
+    if (_stats) {
+      ++_stats->requests;
+    }
+    if (client->getParseError()) {
+      // The rest of the stream can't be trusted after a malformed request
+      Response response(_config, client->getOutput(), _context);
+      response.sendErrorResponse(client->getParseError());
+      client->closeAfterOutput();
+      continue;
+    }
+    const Request& request = client->getRequest();
+    Response response(_config, client->getOutput(), _context);
+    response.setKeepAlive(_config.getKeepaliveTimeout() > 0
+                          && client->shouldKeepAlive(_config.getKeepaliveRequests()));
+    response.processRequest(request);
+    CGI *script = response.releaseCgi();
+    if (script != NULL) {
+      client->setCgi(script);
+      registerCgi(client);
+      continue;
+    }
+    FastCgiRequest *forwarded = response.releaseFastCgi();
+    if (forwarded != NULL) {
+      client->setFastCgi(forwarded);
+      _fastcgiClients[forwarded] = client;
+      continue;
+    }
+    if (_stats) {
+      _stats->cacheHits = _context.responseCache.hits();
+      _stats->cacheMisses = _context.responseCache.misses();
+    }
+    if (response.keepAlive()) {
+      client->reset();
+    } else {
+      client->closeAfterOutput();
+    }
   }
 }
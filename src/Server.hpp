@@ -4,6 +4,7 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <ctime>
 #include <stdexcept>
 #include <cstring>
 #include <sys/socket.h>
@@ -15,6 +16,8 @@
 #include "NetworkManager.hpp"
 #include "Config.hpp"
 #include "Client.hpp"
+#include "WorkerStats.hpp"
+#include "ServerContext.hpp"
 
 class Server
 {
@@ -26,18 +29,36 @@ private:
   struct sockaddr_in _serverAddress;
   std::vector<struct epoll_event> _events;
   std::map<int, Client*> _clients;  // Map of client socket to Client object
+  std::map<int, Client*> _cgiClients; // Pipes and pidfds of running CGI scripts to their Client
+  std::map<FastCgiRequest*, Client*> _fastcgiClients; // Requests at FastCGI applications to their Client
+  std::map<CGI*, Client*> _cgiWaiters; // Requests waiting in the CgiCache for another script's output
+  time_t _lastTimeoutCheck;
+  bool _sharedListener;
+  WorkerStats *_stats;
   Config _config;
   NetworkManager _networkManager;
+  BufferPool _bufferPool;           // Receive blocks shared by the clients of this event loop
+  ServerContext _context;           // Caches shared by the requests of this event loop
 
   void acceptClient();
   void removeClient(Client *client);
-  void processClientEvent(int clientSocket);
+  void processClientEvent(int clientSocket, uint32_t events);
+  void serveClient(Client *client);
+  void closeIdleClients();
+  void registerCgi(Client *client);
+  void unregisterCgi(Client *client);
+  bool processCgiEvent(int fd);
+  void finishCgi(Client *client);
+  void serveFastCgiClients();
+  void serveCgiWaiters();
   void handleEvents();
 
 public:
-  Server(const Config& config);
+  Server(const Config& config, bool reusePort = false);
   ~Server();
 
+  void useListeningSocket(int serverSocket);
+  void setStats(WorkerStats *stats);
   void start();
   void stop();
 };
@@ -0,0 +1,40 @@
+#ifndef SERVERCONTEXT_HPP
+#define SERVERCONTEXT_HPP
+
+#include "Config.hpp"
+#include "FileCache.hpp"
+#include "ResponseCache.hpp"
+#include "AssetPack.hpp"
+#include "CompressionCache.hpp"
+#include "HeaderBuilder.hpp"
+#include "FastCgiPool.hpp"
+#include "CgiCache.hpp"
+
+/*
+ * State of one event loop that outlives single requests and is shared by its Responses.
+ */
+struct ServerContext {
+  FileCache fileCache;               // Open static files
+  ResponseCache responseCache;       // Serialized responses for small hot files
+  AssetPack assetPack;               // Packed document root, if asset_pack is set
+  CompressionCache compressionCache; // gzip copies of text files
+  HeaderBuilder headers;             // Reused for every response head
+  FastCgiPool fastcgi;               // Connections to fastcgi_pass applications
+  CgiCache cgiCache;                 // Output of cgi_cache scripts
+  unsigned long rangeBoundaries;     // multipart/byteranges responses sent, numbers their boundaries
+
+  explicit ServerContext(const Config& config)
+    : fileCache(config.getOpenFileCache(), config.getOpenFileCacheValid()),
+      responseCache(config.getResponseCacheSize(), config.getResponseCacheMaxFile()),
+      compressionCache(config.getGzipCacheSize(), config.getGzipCompLevel()),
+      fastcgi(config.getFastcgiConnections(), config.getFastcgiQueue()),
+      cgiCache(config.getCgiCacheSize()),
+      rangeBoundaries(0)
+  {
+    if (!config.getAssetPack().empty()) {
+      assetPack.load(config.getAssetPack());
+    }
+  }
+};
+
+#endif // SERVERCONTEXT_HPP
@@ -0,0 +1,33 @@
+#ifndef SHAREDBUFFER_HPP
+#define SHAREDBUFFER_HPP
+
+#include <string>
+
+/*
+ * Immutable bytes shared by the ResponseCache and the OutputQueues sending them.
+ * Each holder calls release() once, the last one frees the buffer.
+ * Not thread-safe: a SharedBuffer stays within the event loop that built it.
+ */
+struct SharedBuffer {
+  const std::string data;
+  int refs;
+
+  explicit SharedBuffer(const std::string& bytes) : data(bytes), refs(1) {}
+
+  void retain() {
+    ++refs;
+  }
+
+  void release() {
+    if (--refs == 0) {
+      delete this;
+    }
+  }
+
+private:
+  ~SharedBuffer() {}
+  SharedBuffer(const SharedBuffer&);
+  SharedBuffer& operator=(const SharedBuffer&);
+};
+
+#endif // SHAREDBUFFER_HPP
@@ -0,0 +1,34 @@
+#ifndef SHAREDFILE_HPP
+#define SHAREDFILE_HPP
+
+#include <unistd.h>
+
+/*
+ * Open file descriptor shared by the FileCache and the OutputQueues sending it.
+ * Each holder calls release() once, the last one closes the descriptor.
+ * Not thread-safe: a SharedFile stays within the event loop that opened it.
+ */
+struct SharedFile {
+  int fd;
+  int refs;
+
+  explicit SharedFile(int descriptor) : fd(descriptor), refs(1) {}
+
+  void retain() {
+    ++refs;
+  }
+
+  void release() {
+    if (--refs == 0) {
+      close(fd);
+      delete this;
+    }
+  }
+
+private:
+  ~SharedFile() {}
+  SharedFile(const SharedFile&);
+  SharedFile& operator=(const SharedFile&);
+};
+
+#endif // SHAREDFILE_HPP
@@ -0,0 +1,77 @@
+#ifndef STRINGVIEW_HPP
+#define STRINGVIEW_HPP
+
+#include <string>
+#include <cstring>
+#include <ostream>
+#include <strings.h>
+
+/*
+ * Non-owning reference to a run of characters, for example a header value
+ * inside the receive buffer. It is only valid as long as that buffer is.
+ */
+struct StringView {
+  const char *data;
+  size_t length;
+
+  StringView() : data(""), length(0) {}
+  StringView(const char *str) : data(str), length(strlen(str)) {}
+  StringView(const char *str, size_t len) : data(str), length(len) {}
+  StringView(const std::string& str) : data(str.data()), length(str.size()) {}
+
+  bool empty() const { return length == 0; }
+  size_t size() const { return length; }
+  std::string str() const { return std::string(data, length); }
+
+  bool equals(const StringView& other) const {
+    return length == other.length && memcmp(data, other.data, length) == 0;
+  }
+
+  bool equalsIgnoreCase(const StringView& other) const {
+    return length == other.length && strncasecmp(data, other.data, length) == 0;
+  }
+
+  bool startsWith(const StringView& prefix) const {
+    return length >= prefix.length && memcmp(data, prefix.data, prefix.length) == 0;
+  }
+
+  StringView trim() const {
+    size_t start = 0;
+    size_t end = length;
+    while (start < end && (data[start] == ' ' || data[start] == '\t'))
+      ++start;
+    while (end > start && (data[end - 1] == ' ' || data[end - 1] == '\t'))
+      --end;
+    return StringView(data + start, end - start);
+  }
+
+  // True if the comma-separated list contains token (case-insensitive), e.g. "keep-alive" in "Keep-Alive, Upgrade"
+  bool hasToken(const StringView& token) const {
+    size_t pos = 0;
+    while (pos < length) {
+      while (pos < length && (data[pos] == ' ' || data[pos] == '\t' || data[pos] == ','))
+        ++pos;
+      size_t end = pos;
+      while (end < length && data[end] != ',')
+        ++end;
+      size_t last = end;
+      while (last > pos && (data[last - 1] == ' ' || data[last - 1] == '\t'))
+        --last;
+      if (StringView(data + pos, last - pos).equalsIgnoreCase(token))
+        return true;
+      pos = end;
+    }
+    return false;
+  }
+};
+
+inline bool operator==(const StringView& lhs, const StringView& rhs) { return lhs.equals(rhs); }
+inline bool operator!=(const StringView& lhs, const StringView& rhs) { return !lhs.equals(rhs); }
+inline bool operator==(const StringView& lhs, const char *rhs) { return lhs.equals(StringView(rhs)); }
+inline bool operator!=(const StringView& lhs, const char *rhs) { return !lhs.equals(StringView(rhs)); }
+inline bool operator==(const StringView& lhs, const std::string& rhs) { return lhs.equals(StringView(rhs)); }
+inline bool operator!=(const StringView& lhs, const std::string& rhs) { return !lhs.equals(StringView(rhs)); }
+inline std::string operator+(const std::string& lhs, const StringView& rhs) { return std::string(lhs).append(rhs.data, rhs.length); }
+inline std::ostream& operator<<(std::ostream& out, const StringView& view) { return out.write(view.data, view.length); }
+
+#endif // STRINGVIEW_HPP
@@ -1,6 +1,10 @@
 #include "Utils.hpp"
+#include "MimeTypes.hpp"
 #include <cstdlib>
 #include <string>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
 
 int Utils::stringToInt(const std::string& str)
 { 
@@ -8,3 +12,59 @@ int Utils::stringToInt(const std::string& str)
     return static_cast<int>(std::strtol(str.c_str(), NULL, 10));
 }
 
+namespace
+{
+    MimeTypes& mimeTypes()
+    {
+        static MimeTypes types;
+        return types;
+    }
+}
+
+/*
+ * Returns the MIME type for the extension of filePath.
+ */
+const std::string& Utils::getMimeType(const std::string& filePath)
+{
+    return mimeTypes().lookup(filePath);
+}
+
+/*
+ * Replaces the built-in MIME types with a mime.types file. Call it before the workers start.
+ */
+bool Utils::loadMimeTypes(const std::string& path)
+{
+    return mimeTypes().load(path);
+}
+
+/*
+ * Formats a time as an HTTP date (IMF-fixdate), for example "Sun, 06 Nov 1994 08:49:37 GMT".
+ */
+std::string Utils::httpDate(time_t time)
+{
+    struct tm parts;
+    char buffer[64];
+    gmtime_r(&time, &parts);
+    strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &parts);
+    return buffer;
+}
+
+/*
+ * Parses the three HTTP date formats: IMF-fixdate, the obsolete RFC 850 format and asctime().
+ * Returns false if date is none of them.
+ */
+bool Utils::parseHttpDate(const std::string& date, time_t& time)
+{
+    const char *formats[] = { "%a, %d %b %Y %H:%M:%S GMT", "%A, %d-%b-%y %H:%M:%S GMT", "%a %b %d %H:%M:%S %Y" };
+
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+        struct tm parts;
+        memset(&parts, 0, sizeof(parts));
+        const char *end = strptime(date.c_str(), formats[i], &parts);
+        if (end != NULL && *end == '\0') {
+            time = timegm(&parts);
+            return true;
+        }
+    }
+    return false;
+}
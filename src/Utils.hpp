@@ -2,10 +2,15 @@
 #define UTILS_HPP
 
 #include <string>
+#include <ctime>
 
 namespace Utils
 {
     int stringToInt(const std::string& str);
+    const std::string& getMimeType(const std::string& filePath);
+    bool loadMimeTypes(const std::string& path);
+    std::string httpDate(time_t time);
+    bool parseHttpDate(const std::string& date, time_t& time);
 }
 
 #endif // UTILS_HPP
@@ -0,0 +1,274 @@
+#include "WorkerManager.hpp"
+#include <fcntl.h>
+#include <errno.h>
+
+namespace
+{
+  // Set by the signal handlers of the master process
+  volatile sig_atomic_t g_shutdownRequested = 0;
+  volatile sig_atomic_t g_statsRequested = 0;
+
+  void handleShutdownSignal(int)
+  {
+    g_shutdownRequested = 1;
+  }
+
+  void handleStatsSignal(int)
+  {
+    g_statsRequested = 1;
+  }
+
+  void setSignalHandler(int signum, void (*handler)(int))
+  {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0; // No SA_RESTART: waitpid() must return on signals
+    sigaction(signum, &action, NULL);
+  }
+}
+
+/*
+ * WorkerManager starts the configured number of event loops.
+ * With worker_threads=1 and worker_processes=1 a single Server runs in the main thread.
+ *
+ * Thread mode: every worker thread gets its own Server: its own SO_REUSEPORT listening socket,
+ * epoll instance, client map and copy of the Config, so the threads share nothing
+ * while serving requests and the kernel balances new connections between them.
+ *
+ * Process mode: the master binds the listening socket once, forks one worker process per slot
+ * and restarts any worker that dies. Workers count their connections and requests in a
+ * shared memory segment, the master prints them on SIGUSR1 and stops the workers on SIGTERM/SIGINT.
+ * */
+WorkerManager::WorkerManager(const Config& config)
+  : _config(config),
+    _listenSocket(-1),
+    _stats(NULL)
+{
+}
+
+WorkerManager::~WorkerManager()
+{
+  for (size_t i = 0; i < _servers.size(); ++i) {
+    delete _servers[i];
+  }
+  if (_stats != NULL) {
+    munmap(_stats, sizeof(WorkerStats) * _pids.size());
+  }
+  if (_listenSocket != -1) {
+    close(_listenSocket);
+  }
+}
+
+void WorkerManager::run()
+{
+  if (_config.getWorkerProcesses() > 1) {
+    runProcesses(_config.getWorkerProcesses());
+    return;
+  }
+
+  int count = _config.getWorkerThreads();
+  if (count <= 1) {
+    Server server(_config);
+    server.start();
+    return;
+  }
+  runThreads(count);
+}
+
+void WorkerManager::runThreads(int count)
+{
+  for (int i = 0; i < count; ++i) {
+    _servers.push_back(new Server(_config, true));
+  }
+
+  for (int i = 0; i < count; ++i) {
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, &WorkerManager::runWorker, _servers[i]);
+    if (err != 0) {
+      std::cerr << "Error: Failed to start worker thread " << i << ". " << strerror(err) << "\n";
+      continue;
+    }
+    if (_config.getWorkerCpuAffinity()) {
+      pinThread(thread, i);
+    }
+    _threads.push_back(thread);
+  }
+  std::cout << "Started " << _threads.size() << " worker threads." << "\n";
+
+  for (size_t i = 0; i < _threads.size(); ++i) {
+    pthread_join(_threads[i], NULL);
+  }
+}
+
+void *WorkerManager::runWorker(void *arg)
+{
+  Server *server = static_cast<Server*>(arg);
+  server->start(); // Runs the event loop of this worker
+  return NULL;
+}
+
+/*
+ * Pins worker N to CPU N (modulo the number of CPUs) so its caches stay warm.
+ * */
+void WorkerManager::pinThread(pthread_t thread, int workerId)
+{
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus <= 0) {
+    return;
+  }
+
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  CPU_SET(workerId % cpus, &cpuSet);
+  int err = pthread_setaffinity_np(thread, sizeof(cpuSet), &cpuSet);
+  if (err != 0) {
+    std::cerr << "Warning: Failed to pin worker " << workerId << " to a CPU. " << strerror(err) << "\n";
+  }
+}
+
+void WorkerManager::runProcesses(int count)
+{
+  NetworkManager networkManager(_config.getPort());
+  sockaddr_in serverAddress;
+  _listenSocket = networkManager.createSocket();
+  networkManager.bindSocket(_listenSocket, serverAddress);
+  networkManager.listenForConnections(_listenSocket);
+
+  // Workers race for each connection, the losers must not block in accept()
+  int flags = fcntl(_listenSocket, F_GETFL, 0);
+  fcntl(_listenSocket, F_SETFL, flags | O_NONBLOCK);
+
+  void *segment = mmap(NULL, sizeof(WorkerStats) * count, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (segment == MAP_FAILED) {
+    throw std::runtime_error("Error: Failed to map worker counters. " + std::string(strerror(errno)));
+  }
+  _stats = static_cast<WorkerStats*>(segment);
+  memset(segment, 0, sizeof(WorkerStats) * count);
+  _pids.assign(count, -1);
+  _startTimes.assign(count, 0);
+
+  setSignalHandler(SIGTERM, handleShutdownSignal);
+  setSignalHandler(SIGINT, handleShutdownSignal);
+  setSignalHandler(SIGUSR1, handleStatsSignal);
+
+  for (int i = 0; i < count; ++i) {
+    spawnWorker(i);
+  }
+  std::cout << "Master " << getpid() << " started " << count << " worker processes." << "\n";
+
+  superviseWorkers();
+  stopWorkers();
+  printStats();
+}
+
+void WorkerManager::spawnWorker(int workerId)
+{
+  std::cout.flush(); // Buffered output would otherwise be printed by both processes
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    std::cerr << "Error: Failed to fork worker " << workerId << ". " << strerror(errno) << "\n";
+    return;
+  }
+
+  if (pid == 0) {
+    setSignalHandler(SIGTERM, SIG_DFL);
+    setSignalHandler(SIGINT, SIG_DFL);
+    setSignalHandler(SIGUSR1, SIG_DFL);
+    if (_config.getWorkerCpuAffinity()) {
+      pinThread(pthread_self(), workerId);
+    }
+
+    int exitCode = 0;
+    try {
+      Server server(_config);
+      server.useListeningSocket(_listenSocket);
+      server.setStats(&_stats[workerId]);
+      server.start(); // Only returns if the event loop failed
+      exitCode = 1;
+    } catch (const std::exception& e) {
+      std::cerr << "Error in worker " << workerId << ": " << e.what() << "\n";
+      exitCode = 1;
+    }
+    std::cout.flush();
+    _exit(exitCode);
+  }
+
+  _pids[workerId] = pid;
+  _startTimes[workerId] = time(NULL);
+  _stats[workerId].pid = pid;
+}
+
+/*
+ * Function waits for workers to exit and restarts them until a shutdown is requested.
+ * A worker that dies right after starting is restarted after a short pause
+ * so a crashing configuration does not turn into a fork loop.
+ * */
+void WorkerManager::superviseWorkers()
+{
+  while (!g_shutdownRequested) {
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+
+    if (pid == -1) {
+      if (errno != EINTR) {
+        std::cerr << "Error: waitpid failed. " << strerror(errno) << "\n";
+        return;
+      }
+      if (g_statsRequested) {
+        g_statsRequested = 0;
+        printStats();
+      }
+      continue;
+    }
+
+    for (size_t i = 0; i < _pids.size(); ++i) {
+      if (_pids[i] != pid) {
+        continue;
+      }
+      _pids[i] = -1;
+      std::cerr << "Worker " << i << " (pid " << pid << ") exited with status " << status << "\n";
+      if (g_shutdownRequested) {
+        break;
+      }
+      if (time(NULL) - _startTimes[i] < 1) {
+        sleep(1);
+      }
+      ++_stats[i].restarts;
+      spawnWorker(i);
+      break;
+    }
+  }
+}
+
+void WorkerManager::stopWorkers()
+{
+  for (size_t i = 0; i < _pids.size(); ++i) {
+    if (_pids[i] != -1) {
+      kill(_pids[i], SIGTERM);
+    }
+  }
+  for (size_t i = 0; i < _pids.size(); ++i) {
+    if (_pids[i] != -1) {
+      waitpid(_pids[i], NULL, 0);
+      _pids[i] = -1;
+    }
+  }
+  std::cout << "All worker processes stopped." << "\n";
+}
+
+void WorkerManager::printStats() const
+{
+  for (size_t i = 0; i < _pids.size(); ++i) {
+    std::cout << "Worker " << i << " pid=" << _stats[i].pid
+              << " restarts=" << _stats[i].restarts
+              << " connections=" << _stats[i].connections
+              << " requests=" << _stats[i].requests
+              << " cache_hits=" << _stats[i].cacheHits
+              << " cache_misses=" << _stats[i].cacheMisses << "\n";
+  }
+  std::cout.flush();
+}
@@ -0,0 +1,46 @@
+#ifndef WORKERMANAGER_HPP
+#define WORKERMANAGER_HPP
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+#include <pthread.h>
+#include <sched.h>
+#include <csignal>
+#include <ctime>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "Config.hpp"
+#include "Server.hpp"
+#include "NetworkManager.hpp"
+#include "WorkerStats.hpp"
+
+class WorkerManager {
+private:
+  const Config& _config;
+  std::vector<Server*> _servers;
+  std::vector<pthread_t> _threads;
+  int _listenSocket;
+  WorkerStats *_stats;
+  std::vector<pid_t> _pids;
+  std::vector<time_t> _startTimes;
+
+  static void *runWorker(void *arg);
+  void pinThread(pthread_t thread, int workerId);
+  void runThreads(int count);
+
+  void runProcesses(int count);
+  void spawnWorker(int workerId);
+  void superviseWorkers();
+  void stopWorkers();
+  void printStats() const;
+
+public:
+  WorkerManager(const Config& config);
+  ~WorkerManager();
+
+  void run();
+};
+
+#endif // WORKERMANAGER_HPP
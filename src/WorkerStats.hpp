@@ -0,0 +1,21 @@
+#ifndef WORKERSTATS_HPP
+#define WORKERSTATS_HPP
+
+#include <sys/types.h>
+
+/*
+ * Per-worker counters kept in a shared memory segment by the master process.
+ * Each field has a single writer: the master sets pid and restarts when it
+ * (re)spawns the worker of the slot, the worker updates the counters and the
+ * master only reads them.
+ */
+struct WorkerStats {
+  volatile pid_t pid;
+  volatile unsigned long restarts;
+  volatile unsigned long connections;
+  volatile unsigned long requests;
+  volatile unsigned long cacheHits;   // ResponseCache lookups answered from memory
+  volatile unsigned long cacheMisses;
+};
+
+#endif // WORKERSTATS_HPP
@@ -1,7 +1,10 @@
 #include <iostream>
 #include <string>
+#include <csignal>
 #include "Server.hpp"
 #include "Config.hpp"
+#include "Utils.hpp"
+#include "WorkerManager.hpp"
 
 void displayUsage(const char* programName) {
   std::cerr << "Usage: " << programName << " [config_file]" << std::endl;
@@ -9,6 +12,9 @@ void displayUsage(const char* programName) {
 }
 
 int main(int argc, char* argv[]) {
+  // Writing to a socket the peer closed must fail with EPIPE instead of killing the server
+  signal(SIGPIPE, SIG_IGN);
+
   try {
     std::string configFile = "config/default.conf";
     
@@ -22,10 +28,13 @@ int main(int argc, char* argv[]) {
     
     std::cout << "Loading configuration from: " << configFile << std::endl;
     Config config(configFile);
+    if (!config.getMimeTypes().empty()) {
+      Utils::loadMimeTypes(config.getMimeTypes());
+    }
     
     std::cout << "Starting server on port " << config.getPort() << std::endl;
-    Server server(config);
-    server.start(); 
+    WorkerManager workers(config);
+    workers.run();
   } catch (const std::exception& e) {
     std::cerr << "Error: " << e.what() << std::endl;
     return 1;
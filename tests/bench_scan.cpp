@@ -0,0 +1,95 @@
+#include "../src/Scan.hpp"
+#include <iostream>
+#include <string>
+#include <ctime>
+#include <x86intrin.h>
+
+/*
+ * Purpose of this benchmark:
+ * Compare the Scan kernels with std::string::find on the searches the parsers run:
+ * the end of a header value, a ':' and a multipart boundary.
+ * Every search runs over a buffer that does not contain the target,
+ * so the whole buffer is scanned. Results are in bytes per CPU cycle (higher is better).
+ * */
+
+const size_t BUFFER_SIZE = 1 << 20;
+const int ROUNDS = 200;
+
+double bytesPerCycle(unsigned long long cycles) {
+    return static_cast<double>(BUFFER_SIZE) * ROUNDS / cycles;
+}
+
+int main() {
+    // Header-like text without control characters, ':' or the boundary
+    std::string buffer;
+    const char text[] = "Mozilla/5.0 (X11; Linux x86_64) text/html,application/xhtml+xml;q=0.9 ";
+    while (buffer.size() < BUFFER_SIZE) {
+        buffer += text;
+    }
+    buffer.resize(BUFFER_SIZE);
+    for (size_t i = 0; i < buffer.size(); ++i) {
+        if (buffer[i] == ';' || buffer[i] == ':')
+            buffer[i] = ',';
+    }
+    const std::string boundary = "\r\n--WebKitFormBoundary7MA4YWxkTrZu0gW";
+    const std::string controls(" \x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f"
+                               "\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f\x7f", 33);
+    size_t found = 0;
+    unsigned long long start;
+
+    std::cout << "Scan implementation: " << Scan::implementation() << std::endl;
+
+    start = __rdtsc();
+    for (int i = 0; i < ROUNDS; ++i)
+        found += buffer.find(':');
+    std::cout << "find(':')            std::string " << bytesPerCycle(__rdtsc() - start);
+    start = __rdtsc();
+    for (int i = 0; i < ROUNDS; ++i)
+        found += (Scan::findByte(buffer.data(), buffer.size(), ':') != NULL);
+    std::cout << "  Scan " << bytesPerCycle(__rdtsc() - start) << std::endl;
+
+    start = __rdtsc();
+    for (int i = 0; i < ROUNDS; ++i)
+        found += buffer.find_first_of(controls.c_str() + 1, 0, controls.size() - 1);
+    std::cout << "header value end     std::string " << bytesPerCycle(__rdtsc() - start);
+    start = __rdtsc();
+    for (int i = 0; i < ROUNDS; ++i)
+        found += (Scan::findControl(buffer.data(), buffer.size(), 0x20) != NULL);
+    std::cout << "  Scan " << bytesPerCycle(__rdtsc() - start) << std::endl;
+
+    start = __rdtsc();
+    for (int i = 0; i < ROUNDS; ++i)
+        found += buffer.find("\r\n");
+    std::cout << "find(\"\\r\\n\")         std::string " << bytesPerCycle(__rdtsc() - start);
+    start = __rdtsc();
+    for (int i = 0; i < ROUNDS; ++i)
+        found += Scan::find(buffer.data(), buffer.size(), "\r\n", 2);
+    std::cout << "  Scan " << bytesPerCycle(__rdtsc() - start) << std::endl;
+
+    start = __rdtsc();
+    for (int i = 0; i < ROUNDS; ++i)
+        found += buffer.find(boundary);
+    std::cout << "find(boundary)       std::string " << bytesPerCycle(__rdtsc() - start);
+    start = __rdtsc();
+    for (int i = 0; i < ROUNDS; ++i)
+        found += Scan::find(buffer.data(), buffer.size(), boundary.data(), boundary.size());
+    std::cout << "  Scan " << bytesPerCycle(__rdtsc() - start) << std::endl;
+
+    // Text body with a line break every 72 bytes: the first byte of the boundary is frequent
+    std::string lines = buffer;
+    for (size_t i = 70; i + 1 < lines.size(); i += 72) {
+        lines[i] = '\r';
+        lines[i + 1] = '\n';
+    }
+    start = __rdtsc();
+    for (int i = 0; i < ROUNDS; ++i)
+        found += lines.find(boundary);
+    std::cout << "boundary in text     std::string " << bytesPerCycle(__rdtsc() - start);
+    start = __rdtsc();
+    for (int i = 0; i < ROUNDS; ++i)
+        found += Scan::find(lines.data(), lines.size(), boundary.data(), boundary.size());
+    std::cout << "  Scan " << bytesPerCycle(__rdtsc() - start) << std::endl;
+
+    // Keeps the searches from being optimized away
+    return found == 0 ? 1 : 0;
+}
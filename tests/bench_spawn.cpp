@@ -0,0 +1,113 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <ctime>
+#include <csignal>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+ * Purpose of this benchmark:
+ * Compare the cost of starting a CGI script with fork() + execve() (how CGI did it before)
+ * and with posix_spawn() (how CGI::spawnScript() does it) while the server is small and
+ * after it grew. fork() copies the page tables of the whole process, posix_spawn() shares
+ * the memory with the child until execve().
+ * "blocked" is the time the spawning thread spends in the call, that is the event loop
+ * standing still; "to exit" is until /bin/true exited and was reaped.
+ * Times are in microseconds per spawn (lower is better).
+ * */
+
+const int ROUNDS = 200;
+const size_t SIZES_MB[] = { 100, 2048 };
+
+double nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Spawns /bin/true with pipes on stdin and stdout like a CGI script
+void spawnOnce(bool useFork, double& blocked, double& toExit) {
+    int input[2];
+    int output[2];
+    if (pipe2(input, O_CLOEXEC) == -1 || pipe2(output, O_CLOEXEC) == -1) {
+        std::cerr << "Error: pipe2 failed. " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    char *args[] = { const_cast<char*>("/bin/true"), NULL };
+    char *env[] = { NULL };
+    double start = nowUs();
+    pid_t pid;
+    if (useFork) {
+        pid = fork();
+        if (pid == 0) {
+            dup2(input[0], STDIN_FILENO);
+            dup2(output[1], STDOUT_FILENO);
+            execve(args[0], args, env);
+            _exit(127);
+        }
+    } else {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, input[0], STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, output[1], STDOUT_FILENO);
+        if (posix_spawn(&pid, args[0], &actions, NULL, args, env) != 0) {
+            pid = -1;
+        }
+        posix_spawn_file_actions_destroy(&actions);
+    }
+    double spawned = nowUs();
+    if (pid == -1) {
+        std::cerr << "Error: spawn failed. " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    waitpid(pid, NULL, 0);
+    double exited = nowUs();
+    blocked += spawned - start;
+    toExit += exited - start;
+    close(input[0]);
+    close(input[1]);
+    close(output[0]);
+    close(output[1]);
+}
+
+void run(const char *name, bool useFork) {
+    double blocked = 0;
+    double toExit = 0;
+    for (int i = 0; i < ROUNDS; ++i) {
+        spawnOnce(useFork, blocked, toExit);
+    }
+    std::cout << "  " << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(1)
+              << "blocked " << std::setw(8) << blocked / ROUNDS
+              << "  to exit " << std::setw(8) << toExit / ROUNDS << std::endl;
+}
+
+int main() {
+    std::vector<char*> blocks;
+    size_t allocatedMb = 0;
+    for (size_t s = 0; s < sizeof(SIZES_MB) / sizeof(SIZES_MB[0]); ++s) {
+        // Touched memory stands in for the caches of a server that has been running a while
+        while (allocatedMb < SIZES_MB[s]) {
+            char *block = static_cast<char*>(malloc(1 << 20));
+            if (block == NULL) {
+                std::cerr << "Error: Could not allocate " << SIZES_MB[s] << " MB, stopping." << std::endl;
+                return 0;
+            }
+            memset(block, 1, 1 << 20);
+            blocks.push_back(block);
+            ++allocatedMb;
+        }
+        std::cout << "RSS ~" << SIZES_MB[s] << " MB (us per spawn, " << ROUNDS << " rounds)" << std::endl;
+        run("fork+execve", true);
+        run("posix_spawn", false);
+    }
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        free(blocks[i]);
+    }
+    return 0;
+}
@@ -1,6 +1,19 @@
 #include "../src/Request.hpp"
+#include "../src/HttpParser.hpp"
+#include "../src/Scan.hpp"
+#include "../src/MultipartParser.hpp"
+#include "../src/RequestBody.hpp"
+#include "../src/ChunkedDecoder.hpp"
+#include "../src/FastCgi.hpp"
+#include "../src/Router.hpp"
+#include "../src/FileCache.hpp"
+#include <cstdlib>
+#include <sstream>
 #include <iostream>
 #include <cassert>
+#include <fstream>
+#include <unistd.h>
+#include <dirent.h>
 
 void testRequestParsing() {
     // Test a simple HTTP GET request
@@ -29,8 +42,510 @@ void testRequestParsing() {
     std::cout << "All request parsing tests passed!" << std::endl;
 }
 
+void testIncrementalParsing() {
+    std::string rawRequest =
+        "POST /upload HTTP/1.1\r\n"
+        "host: localhost:8080\r\n"
+        "content-length:  12 \r\n"
+        "X-Empty:\r\n"
+        "\r\n"
+        "hello world!";
+
+    // Feed the parser one byte at a time, as if every byte arrived in its own read
+    HttpParser parser;
+    size_t fed = 0;
+    while (fed < rawRequest.size() && parser.status() == HttpParser::PARSE_INCOMPLETE) {
+        parser.parse(rawRequest.data() + fed, 1);
+        ++fed;
+    }
+    assert(parser.status() == HttpParser::PARSE_DONE);
+    assert(parser.headLength() == rawRequest.size() - 12);
+    assert(parser.hasContentLength() && parser.contentLength() == 12);
+
+    Request request(rawRequest.data(), parser);
+    assert(request.getMethod() == "POST");
+    assert(request.getUrl() == "/upload");
+    assert(request.getVersion() == "HTTP/1.1");
+
+    // Header names are case-insensitive, values are trimmed
+    assert(request.getHeader("Host") == "localhost:8080");
+    assert(request.getHeader("Content-Length") == "12");
+    assert(request.getHeader("X-Empty") == "");
+
+    std::cout << "All incremental parsing tests passed!" << std::endl;
+}
+
+int parseError(const std::string& rawRequest) {
+    HttpParser parser;
+    parser.parse(rawRequest.data(), rawRequest.size());
+    return parser.status() == HttpParser::PARSE_ERROR ? parser.errorStatus() : 0;
+}
+
+// Status the framing of a complete head is rejected with, chunked tells whether the body is chunked
+int framingError(const std::string& rawRequest, bool& chunked) {
+    HttpParser parser;
+    assert(parser.parse(rawRequest.data(), rawRequest.size()) == HttpParser::PARSE_DONE);
+    return parser.transferEncodingError(rawRequest.data(), chunked);
+}
+
+void testMalformedRequests() {
+    assert(parseError("GET /index.html HTTP/1.1\r\nHost: x\r\n\r\n") == 0);
+    assert(parseError("GET  /index.html HTTP/1.1\r\n\r\n") == 400);
+    assert(parseError("GET /index.html HTTP/2.0\r\n\r\n") == 505);
+    assert(parseError("GET /index.html HTTP/1.1\r\nBad Header: x\r\n\r\n") == 400);
+    assert(parseError("GET /index.html HTTP/1.1\r\nContent-Length: 1x\r\n\r\n") == 400);
+    assert(parseError("GET /index.html HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n") == 400);
+
+    // Every Transfer-Encoding line counts, chunked must be the final coding and can't be mixed with Content-Length
+    bool chunked;
+    assert(framingError("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n", chunked) == 0 && chunked);
+    assert(framingError("POST / HTTP/1.1\r\nTransfer-Encoding: Chunked\r\nHost: x\r\n\r\n", chunked) == 0 && chunked);
+    assert(framingError("POST / HTTP/1.1\r\nHost: x\r\n\r\n", chunked) == 0 && !chunked);
+    assert(framingError("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n", chunked) == 400);
+    assert(framingError("POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n", chunked) == 400);
+    assert(framingError("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: identity\r\n\r\n", chunked) == 400);
+    assert(framingError("POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n", chunked) == 400);
+    assert(framingError("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: chunked\r\n\r\n", chunked) == 400);
+    assert(framingError("POST / HTTP/1.1\r\nTransfer-Encoding: \r\n\r\n", chunked) == 400);
+    assert(framingError("POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\nTransfer-Encoding: chunked\r\n\r\n", chunked) == 501);
+    assert(framingError("POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n", chunked) == 501);
+
+    HttpParser small(32);
+    std::string longRequest = "GET /a-very-long-url-that-does-not-fit HTTP/1.1\r\n\r\n";
+    small.parse(longRequest.data(), longRequest.size());
+    assert(small.status() == HttpParser::PARSE_ERROR && small.errorStatus() == 431);
+
+    std::cout << "All malformed request tests passed!" << std::endl;
+}
+
+// URL of the request line after normalization, "400" if the request is rejected
+std::string normalizedUrl(const std::string& target) {
+    Request request("GET " + target + " HTTP/1.1\r\nHost: x\r\n\r\n");
+    if (!request.isValid())
+        return "400";
+    assert(request.getHeader(HEADER_HOST) == "x");
+    return request.getUrl().str();
+}
+
+void testUrlNormalization() {
+    assert(normalizedUrl("/") == "/");
+    assert(normalizedUrl("/index.html?a=1") == "/index.html?a=1");
+    assert(normalizedUrl("/a/b/") == "/a/b/");
+
+    // Repeated slashes collapse
+    assert(normalizedUrl("//b.txt") == "/b.txt");
+    assert(normalizedUrl("/a//b///c") == "/a/b/c");
+    assert(normalizedUrl("///") == "/");
+
+    // Dot segments are removed, a directory keeps its trailing slash
+    assert(normalizedUrl("/a/./b") == "/a/b");
+    assert(normalizedUrl("/uploads/../cgi-bin/echo.py") == "/cgi-bin/echo.py");
+    assert(normalizedUrl("/a/b/../../c?x=/../y") == "/c?x=/../y");
+    assert(normalizedUrl("/a/.") == "/a/");
+    assert(normalizedUrl("/a/b/..") == "/a/");
+    assert(normalizedUrl("/a/..") == "/");
+    assert(normalizedUrl("/a/.../b") == "/a/.../b");
+    assert(normalizedUrl("/a/..b/.c") == "/a/..b/.c");
+
+    // Percent-encoded unreserved characters are decoded first, others are kept
+    assert(normalizedUrl("/%7Euser/%61.txt") == "/~user/a.txt");
+    assert(normalizedUrl("/uploads/%2e%2e/cgi-bin/x") == "/cgi-bin/x");
+    assert(normalizedUrl("/uploads/%2E./%2e/x") == "/x");
+    assert(normalizedUrl("/a%2Fb/%20c%zz%2") == "/a%2Fb/%20c%zz%2");
+
+    // Nothing may climb above the root
+    assert(normalizedUrl("/..") == "400");
+    assert(normalizedUrl("/../../../etc/passwd") == "400");
+    assert(normalizedUrl("/a/../../etc/passwd") == "400");
+    assert(normalizedUrl("/%2e%2e/etc/passwd") == "400");
+    assert(normalizedUrl("//..//etc") == "400");
+
+    // Other forms of the request target are left alone
+    assert(normalizedUrl("*") == "*");
+    assert(normalizedUrl("http://example.com/a/../b") == "http://example.com/a/../b");
+
+    std::cout << "All URL normalization tests passed!" << std::endl;
+}
+
+bool acceptsGzip(const std::string& acceptEncoding) {
+    Request request("GET / HTTP/1.1\r\nAccept-Encoding: " + acceptEncoding + "\r\n\r\n");
+    assert(request.isValid());
+    return request.acceptsEncoding("gzip");
+}
+
+void testAcceptEncoding() {
+    assert(acceptsGzip("gzip"));
+    assert(acceptsGzip("br, GZIP;q=0.5"));
+    assert(!acceptsGzip("br"));
+    assert(!acceptsGzip("gzip;q=0"));
+    assert(!acceptsGzip("gzip;q=0.000"));
+    assert(acceptsGzip("*"));
+    assert(!acceptsGzip("*;q=0"));
+    assert(!acceptsGzip(""));
+
+    // An explicit entry overrides the wildcard, wherever each one stands
+    assert(!acceptsGzip("*, gzip;q=0"));
+    assert(!acceptsGzip("gzip;q=0, *"));
+    assert(acceptsGzip("*;q=0, gzip"));
+    assert(acceptsGzip("gzip, *;q=0"));
+    assert(acceptsGzip("br;q=0, *"));
+
+    std::cout << "All Accept-Encoding tests passed!" << std::endl;
+}
+
+void testHeaderTable() {
+    std::ostringstream raw;
+    raw << "GET / HTTP/1.1\r\n"
+        << "HOSTNAME: not-the-host\r\n"
+        << "hOsT: example.com\r\n"
+        << "Connection: Upgrade, Keep-Alive\r\n";
+    for (int i = 0; i < 40; ++i)
+        raw << "X-Extra-" << i << ": " << i << "\r\n";
+    raw << "If-None-Match: \"abc\"\r\n\r\n";
+
+    Request request(raw.str());
+    assert(request.isValid());
+    assert(request.getHeader(HEADER_HOST) == "example.com");
+    assert(request.getHeader("Hostname") == "not-the-host");
+    assert(request.getHeader(HEADER_IF_NONE_MATCH) == "\"abc\"");
+    assert(request.getHeader("x-extra-39") == "39");
+    assert(request.getHeader(HEADER_RANGE).empty());
+    assert(request.getHeader(HEADER_CONNECTION).hasToken("keep-alive"));
+    assert(request.isKeepAlive());
+
+    // Copies keep their own view of the headers
+    Request copy = request;
+    request = Request();
+    assert(copy.getHeader("X-Extra-0") == "0");
+
+    std::ostringstream tooMany;
+    tooMany << "GET / HTTP/1.1\r\n";
+    for (size_t i = 0; i <= HttpParser::MAX_HEADERS; ++i)
+        tooMany << "X: " << i << "\r\n";
+    tooMany << "\r\n";
+    assert(parseError(tooMany.str()) == 431);
+
+    std::cout << "All header table tests passed!" << std::endl;
+}
+
+void testScanKernels() {
+    // Random bytes from a small alphabet so needles are found at every possible alignment
+    std::srand(42);
+    for (int round = 0; round < 200; ++round) {
+        std::string data;
+        size_t length = std::rand() % 300;
+        for (size_t i = 0; i < length; ++i)
+            data += "ab\r\n-:\x7f "[std::rand() % 8];
+
+        std::string needle = data.substr(std::rand() % (length + 1), std::rand() % 6);
+        size_t expected = data.find(needle);
+        size_t found = Scan::find(data.data(), data.size(), needle.data(), needle.size());
+        assert(found == (expected == std::string::npos ? data.size() : expected));
+
+        size_t control = data.find_first_of("\r\n\x7f");
+        const char *hit = Scan::findControl(data.data(), data.size(), 0x20);
+        assert(hit == (control == std::string::npos ? NULL : data.data() + control));
+    }
+
+    std::cout << "All scan kernel tests passed! (" << Scan::implementation() << ")" << std::endl;
+}
+
+std::string readFile(const std::string& path) {
+    std::ifstream file(path.c_str(), std::ios::binary);
+    std::ostringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+void writeFile(const std::string& path, const std::string& content) {
+    std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+    file << content;
+}
+
+void testMultipartUpload() {
+    std::string boundary;
+    assert(MultipartParser::boundaryFrom("multipart/form-data; boundary=\"----x1\"", boundary));
+    assert(boundary == "----x1");
+    assert(!MultipartParser::boundaryFrom("text/plain; boundary=x", boundary));
+
+    // Contents with dashes and CRLFs that only look like a delimiter
+    std::string first = "--\r\n------x\r\n--x1 not the end\r\n";
+    std::string second(100000, '-');
+    std::string body =
+        "preamble\r\n"
+        "------x1\r\n"
+        "Content-Disposition: form-data; name=\"note\"\r\n"
+        "\r\n"
+        "skipped field\r\n"
+        "------x1\r\n"
+        "Content-Disposition: form-data; name=\"a\"; filename=\"C:\\tmp\\first.txt\"\r\n"
+        "Content-Type: text/plain\r\n"
+        "\r\n" + first + "\r\n"
+        "------x1\r\n"
+        "Content-Disposition: form-data; name=\"b\"; filename=\"second.bin\"\r\n"
+        "\r\n" + second + "\r\n"
+        "------x1--\r\n";
+
+    char directory[] = "/tmp/test_multipartXXXXXX";
+    assert(mkdtemp(directory) != NULL);
+
+    // Every split of the body must give the same files, try a few chunk sizes
+    size_t chunks[] = { 1, 7, 4096, body.size() };
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+        MultipartParser parser(boundary, directory);
+        for (size_t pos = 0; pos < body.size(); pos += chunks[c])
+            parser.feed(body.data() + pos, std::min(chunks[c], body.size() - pos));
+        parser.finish();
+        assert(parser.status() == MultipartParser::MULTIPART_DONE);
+        assert(parser.files().size() == 2);
+        assert(parser.files()[0] == "first.txt" && parser.files()[1] == "second.bin");
+        assert(readFile(std::string(directory) + "/first.txt") == first);
+        assert(readFile(std::string(directory) + "/second.bin") == second);
+    }
+
+    // A body cut before the closing delimiter leaves no file behind
+    MultipartParser truncated(boundary, directory);
+    std::string partial = "------x1\r\nContent-Disposition: form-data; filename=\"cut.txt\"\r\n\r\ndata";
+    truncated.feed(partial.data(), partial.size());
+    truncated.finish();
+    assert(truncated.status() == MultipartParser::MULTIPART_ERROR && truncated.errorStatus() == 400);
+    assert(access((std::string(directory) + "/cut.txt").c_str(), F_OK) == -1);
+
+    // So does one cut after a complete part, and the file it would replace is kept
+    writeFile(std::string(directory) + "/first.txt", "kept");
+    MultipartParser cutLater(boundary, directory);
+    std::string completeThenCut = body.substr(0, body.find("filename=\"second.bin\"") + 30);
+    cutLater.feed(completeThenCut.data(), completeThenCut.size());
+    cutLater.finish();
+    assert(cutLater.status() == MultipartParser::MULTIPART_ERROR && cutLater.files().empty());
+    assert(readFile(std::string(directory) + "/first.txt") == "kept");
+    DIR *listing = opendir(directory);
+    size_t entries = 0;
+    while (readdir(listing) != NULL)
+        ++entries;
+    closedir(listing);
+    assert(entries == 4); // ".", "..", first.txt and second.bin: no temporary file is left
+
+    unlink((std::string(directory) + "/first.txt").c_str());
+    unlink((std::string(directory) + "/second.bin").c_str());
+    assert(rmdir(directory) == 0);
+
+    std::cout << "All multipart upload tests passed!" << std::endl;
+}
+
+void testRequestBodySpooling() {
+    char directory[] = "/tmp/test_body_XXXXXX";
+    assert(mkdtemp(directory) != NULL);
+
+    std::string expected;
+    RequestBody body;
+    body.spoolAbove(100, directory);
+    for (int i = 0; i < 40; ++i) {
+        std::string piece = "chunk-" + std::string(1, static_cast<char>('a' + i % 26));
+        assert(body.append(piece.data(), piece.size()));
+        expected += piece;
+        // The body stays in memory until it outgrows the limit
+        assert(body.inMemory() == (expected.size() <= 100));
+    }
+    assert(body.size() == expected.size() && body.file() != NULL);
+    assert(body.str() == expected);
+
+    char buffer[16];
+    size_t length = body.read(95, buffer, sizeof(buffer));
+    assert(length == sizeof(buffer) && expected.compare(95, length, buffer, length) == 0);
+    assert(body.read(expected.size(), buffer, sizeof(buffer)) == 0);
+
+    // Copies share the spooled file, the temporary file has no name in the directory
+    RequestBody copy = body;
+    body.clear();
+    assert(body.empty() && copy.str() == expected);
+    assert(rmdir(directory) == 0);
+
+    std::cout << "All request body tests passed!" << std::endl;
+}
+
+static std::string decodeChunked(ChunkedDecoder& decoder, const std::string& input, size_t chunk, size_t *used) {
+    std::string output;
+    *used = 0;
+    while (*used < input.size() && decoder.status() == ChunkedDecoder::CHUNKED_INCOMPLETE) {
+        const char *payload;
+        size_t payloadLength;
+        size_t length = std::min(chunk, input.size() - *used);
+        *used += decoder.decode(input.data() + *used, length, &payload, &payloadLength);
+        output.append(payload ? payload : "", payloadLength);
+    }
+    return output;
+}
+
+void testChunkedDecoding() {
+    std::string body = "5\r\nHello\r\n1A;name=value\r\n, this is a chunked body!!\r\n"
+                       "0\r\nExpires: never\r\n\r\nGET /next HTTP/1.1\r\n";
+    size_t chunks[] = { 1, 3, 16, body.size() };
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+        ChunkedDecoder decoder;
+        size_t used;
+        std::string output = decodeChunked(decoder, body, chunks[c], &used);
+        assert(decoder.status() == ChunkedDecoder::CHUNKED_DONE);
+        assert(output == "Hello, this is a chunked body!!");
+        // The next pipelined request is left alone
+        assert(body.compare(used, std::string::npos, "GET /next HTTP/1.1\r\n") == 0);
+    }
+
+    const char *malformed[] = {
+        "x\r\n",                    // No size digits
+        "5\r\nHelloX\r\n",          // Data longer than the size
+        "3 x\r\nabc\r\n",           // Junk after the size
+        "fffffffffffffffff\r\n"      // Size overflow
+    };
+    int statuses[] = { 400, 400, 400, 413 };
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i) {
+        ChunkedDecoder decoder;
+        size_t used;
+        decodeChunked(decoder, malformed[i], 1, &used);
+        assert(decoder.status() == ChunkedDecoder::CHUNKED_ERROR);
+        assert(decoder.errorStatus() == statuses[i]);
+    }
+
+    std::cout << "All chunked decoding tests passed!" << std::endl;
+}
+
+void testFastCgiRecords() {
+    // Short and long (4 byte) lengths in name-value pairs
+    std::string pairs;
+    FastCgi::appendNameValue(pairs, "SCRIPT_NAME", "/app/index");
+    FastCgi::appendNameValue(pairs, "LONG", std::string(300, 'v'));
+    assert(pairs.size() == 2 + 11 + 10 + 5 + 4 + 300);
+    FastCgi::NameValues values;
+    assert(FastCgi::parseNameValues(pairs.data(), pairs.size(), values));
+    assert(values.size() == 2);
+    assert(values[0].first == "SCRIPT_NAME" && values[0].second == "/app/index");
+    assert(values[1].first == "LONG" && values[1].second == std::string(300, 'v'));
+    values.clear();
+    assert(!FastCgi::parseNameValues(pairs.data(), pairs.size() - 1, values));
+
+    // Records are padded to a multiple of 8 and only parsed once complete
+    std::string stream;
+    FastCgi::appendRecord(stream, FastCgi::STDOUT, 3, "hello", 5);
+    FastCgi::appendEndRequest(stream, 3, 0, FastCgi::REQUEST_COMPLETE);
+    assert(stream.size() == 16 + 16);
+    FastCgi::Record record;
+    assert(FastCgi::parseRecord(stream.data(), 15, record) == 0);
+    assert(FastCgi::parseRecord(stream.data(), stream.size(), record) == 16);
+    assert(record.type == FastCgi::STDOUT && record.requestId == 3);
+    assert(std::string(record.content, record.contentLength) == "hello");
+    assert(FastCgi::parseRecord(stream.data() + 16, 16, record) == 16);
+    assert(record.type == FastCgi::END_REQUEST && record.contentLength == 8);
+
+    std::cout << "All FastCGI record tests passed!" << std::endl;
+}
+
+Route makeRoute(const std::string& path, RouteHandler handler, const std::string& methods) {
+    Route route;
+    route.path = path;
+    route.handler = handler;
+    route.methods = Route::parseMethods(methods);
+    return route;
+}
+
+void testRouter() {
+    Router router;
+    router.add(makeRoute("/*", ROUTE_STATIC, "GET,DELETE"));
+    router.add(makeRoute("/upload", ROUTE_UPLOAD, "POST"));
+    router.add(makeRoute("/cgi-bin/*", ROUTE_CGI, "GET,POST"));
+    router.add(makeRoute("/cgi-bin/admin/*", ROUTE_REDIRECT, "ALL"));
+    router.add(makeRoute("/up", ROUTE_STATIC, "GET"));
+
+    // Exact routes match their path only, the longest prefix route wins otherwise
+    assert(router.find("/upload")->handler == ROUTE_UPLOAD);
+    assert(router.find("/uploads")->handler == ROUTE_STATIC && router.find("/uploads")->path == "/*");
+    assert(router.find("/up")->path == "/up");
+    assert(router.find("/u")->path == "/*");
+    assert(router.find("/cgi-bin/")->handler == ROUTE_CGI);
+    assert(router.find("/cgi-bin/a.sh")->handler == ROUTE_CGI);
+    assert(router.find("/cgi-bin/admin/x")->handler == ROUTE_REDIRECT);
+    assert(router.find("/cgi-bin/adm")->handler == ROUTE_CGI);
+    assert(router.find("/cgi-bin")->path == "/*");
+    assert(router.find("/")->path == "/*");
+
+    // The same path again replaces the route
+    router.add(makeRoute("/upload", ROUTE_UPLOAD, "POST,PUT"));
+    assert(router.size() == 5);
+    assert(router.find("/upload")->allowsMethod("PUT"));
+
+    // Methods are a bitmask, unknown ones are never allowed
+    const Route *route = router.find("/cgi-bin/a.sh");
+    assert(route->allowsMethod("GET") && route->allowsMethod("POST") && !route->allowsMethod("DELETE"));
+    assert(!route->allowsMethod("BREW"));
+    assert(route->allowHeader() == "GET, POST");
+    assert(router.find("/cgi-bin/admin/")->allowHeader() == "GET, HEAD, POST, PUT, DELETE, OPTIONS, PATCH");
+    assert(route->rest("/cgi-bin/a.sh") == "a.sh");
+
+    // Without a root route unmatched paths have none
+    Router sparse;
+    sparse.add(makeRoute("/api/*", ROUTE_STATIC, "GET"));
+    assert(sparse.find("/ap") == NULL);
+    assert(sparse.find("/api/v1")->path == "/api/*");
+
+    // Many routes sharing long prefixes
+    Router large;
+    for (int i = 0; i < 2000; ++i) {
+        std::ostringstream path;
+        path << "/api/v1/resource" << i;
+        large.add(makeRoute(path.str(), ROUTE_STATIC, "GET"));
+        large.add(makeRoute(path.str() + "/*", ROUTE_CGI, "POST"));
+    }
+    assert(large.size() == 4000);
+    assert(large.find("/api/v1/resource1234")->path == "/api/v1/resource1234");
+    assert(large.find("/api/v1/resource123/x")->path == "/api/v1/resource123/*");
+    assert(large.find("/api/v1/resource2000") == NULL);
+
+    std::cout << "All router tests passed!" << std::endl;
+}
+
+void testFileCacheSpellings() {
+    char directory[] = "/tmp/test_filecacheXXXXXX";
+    assert(mkdtemp(directory) != NULL);
+    std::string path = std::string(directory) + "/a.txt";
+    std::string doubled = std::string(directory) + "//a.txt";
+    writeFile(path, "one");
+
+    FileCache cache(100, 60);
+    assert(cache.notifyFd() != -1);
+    assert(cache.lookup(path).size == 3);
+    assert(cache.lookup(doubled).size == 3);
+
+    // Both spellings share one inotify watch, a change must reach the entries of each
+    writeFile(path, "changed");
+    cache.processEvents();
+    assert(cache.lookup(path).size == 7);
+    assert(cache.lookup(doubled).size == 7);
+
+    // And still does after an entry of one spelling was dropped
+    cache.invalidate(doubled);
+    writeFile(path, "changed again");
+    cache.processEvents();
+    assert(cache.lookup(path).size == 13);
+
+    unlink(path.c_str());
+    assert(rmdir(directory) == 0);
+
+    std::cout << "All file cache tests passed!" << std::endl;
+}
+
 int main() {
     testRequestParsing();
+    testIncrementalParsing();
+    testMalformedRequests();
+    testUrlNormalization();
+    testAcceptEncoding();
+    testHeaderTable();
+    testScanKernels();
+    testMultipartUpload();
+    testRequestBodySpooling();
+    testChunkedDecoding();
+    testFastCgiRecords();
+    testRouter();
+    testFileCacheSpellings();
     return 0;
 }
 
@@ -1,20 +1,156 @@
 #include "../src/Server.hpp"
+#include "../src/Config.hpp"
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
 #include <cassert>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
-void testServer() {
-    Server server(8080);
+const int TEST_PORT = 18090;
+const size_t BIG_FILE_SIZE = 20 * 1024 * 1024;
 
-    // Test server initialization
-    server.start();
+/*
+ * Runs a Server with the given config lines in a child process, serving directory.
+ * */
+pid_t startServer(const std::string& directory, const std::string& settings) {
+    std::string configPath = directory + "/test.conf";
+    std::ofstream config(configPath.c_str());
+    config << "port=" << TEST_PORT << "\ndocument_root=" << directory << "\n" << settings;
+    config.close();
 
-    // TODO: Add more tests for server functionality
-    // For example, test handling multiple clients, serving files, etc.
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        // Don't outlive a test that failed an assertion
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        signal(SIGPIPE, SIG_IGN);
+        Config serverConfig(configPath);
+        Server server(serverConfig);
+        server.start();
+        _exit(0);
+    }
+    // Wait for the listening socket
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        int probe = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = sockaddr_in();
+        address.sin_family = AF_INET;
+        address.sin_port = htons(TEST_PORT);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bool up = connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        close(probe);
+        if (up)
+            return pid;
+        usleep(20000);
+    }
+    assert(false && "server did not start");
+    return pid;
+}
+
+void stopServer(pid_t pid) {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+int connectToServer() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = sockaddr_in();
+    address.sin_family = AF_INET;
+    address.sin_port = htons(TEST_PORT);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+    return fd;
+}
+
+void sendAll(int fd, const std::string& data) {
+    assert(send(fd, data.data(), data.size(), 0) == static_cast<ssize_t>(data.size()));
+}
+
+// Reads until the server closes the connection
+std::string readAll(int fd) {
+    std::string received;
+    char buffer[65536];
+    ssize_t length;
+    while ((length = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+        received.append(buffer, length);
+    return received;
+}
+
+// Length of the body of the single response in raw
+size_t bodyLength(const std::string& raw) {
+    size_t end = raw.find("\r\n\r\n");
+    assert(end != std::string::npos);
+    return raw.size() - end - 4;
+}
+
+void testKeepaliveTimeoutZero(const std::string& directory) {
+    pid_t server = startServer(directory, "keepalive_timeout=0\n");
+
+    // A client that takes its response only after several idle-connection sweeps gets all of it
+    int fd = connectToServer();
+    sendAll(fd, "GET /big.bin HTTP/1.1\r\nHost: x\r\n\r\n");
+    sleep(3);
+    std::string response = readAll(fd);
+    close(fd);
+    assert(response.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+    assert(bodyLength(response) == BIG_FILE_SIZE);
+
+    // So does one that pauses in the middle of its request
+    fd = connectToServer();
+    sendAll(fd, "GET /small.txt HTTP/1.1\r\n");
+    sleep(2);
+    sendAll(fd, "Host: x\r\n\r\n");
+    response = readAll(fd);
+    close(fd);
+    assert(response.compare(0, 15, "HTTP/1.1 200 OK") == 0 && bodyLength(response) == 6);
+
+    stopServer(server);
+    std::cout << "All keepalive_timeout=0 tests passed!" << std::endl;
+}
+
+void testKeepaliveTimeout(const std::string& directory) {
+    pid_t server = startServer(directory, "keepalive_timeout=1\n");
+
+    // An answered connection that stays idle is closed after keepalive_timeout
+    int fd = connectToServer();
+    sendAll(fd, "GET /small.txt HTTP/1.1\r\nHost: x\r\n\r\n");
+    time_t start = time(NULL);
+    std::string response = readAll(fd);
+    close(fd);
+    assert(response.compare(0, 15, "HTTP/1.1 200 OK") == 0 && bodyLength(response) == 6);
+    assert(time(NULL) - start <= 3);
 
-    std::cout << "All server tests passed!" << std::endl;
+    stopServer(server);
+    std::cout << "All keepalive_timeout tests passed!" << std::endl;
 }
 
 int main() {
-    testServer();
+    char directory[] = "/tmp/test_serverXXXXXX";
+    assert(mkdtemp(directory) != NULL);
+    std::string big = std::string(directory) + "/big.bin";
+    std::string small = std::string(directory) + "/small.txt";
+    {
+        std::ofstream file(big.c_str(), std::ios::binary);
+        std::string block(1024 * 1024, 'x');
+        for (size_t i = 0; i < BIG_FILE_SIZE / block.size(); ++i)
+            file << block;
+        std::ofstream smallFile(small.c_str());
+        smallFile << "small\n";
+    }
+
+    testKeepaliveTimeoutZero(directory);
+    testKeepaliveTimeout(directory);
+
+    unlink(big.c_str());
+    unlink(small.c_str());
+    unlink((std::string(directory) + "/test.conf").c_str());
+    rmdir(directory);
     return 0;
 }
@@ -0,0 +1,337 @@
+#include "../src/FastCgi.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <ctime>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * FastCGI responder for trying out fastcgi_pass:
+ *   ./fcgi_responder unix:/tmp/app.sock
+ *   ./fcgi_responder 127.0.0.1:9000
+ * It multiplexes requests and keeps connections, and answers with text/plain listing
+ * a few parameters followed by the request body. Query parameters change the answer:
+ * delay=<ms> holds it back (without blocking other requests), size=<n> appends n bytes.
+ * */
+
+namespace
+{
+  struct Job {
+    std::string params;
+    std::string input;
+    bool paramsDone;
+    bool inputDone;
+    bool keepConnection;
+    long long readyAt;   // Milliseconds, the answer is sent from then on
+  };
+
+  struct Connection {
+    int fd;
+    std::string in;
+    std::string out;
+    std::map<unsigned short, Job> jobs;
+    bool closeWhenWritten;
+  };
+
+  long long nowMs()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+  }
+
+  std::string param(const FastCgi::NameValues& params, const std::string& name)
+  {
+    for (size_t i = 0; i < params.size(); ++i) {
+      if (params[i].first == name) {
+        return params[i].second;
+      }
+    }
+    return "";
+  }
+
+  long queryValue(const std::string& query, const std::string& name)
+  {
+    size_t pos = 0;
+    while (pos < query.size()) {
+      size_t end = query.find('&', pos);
+      if (end == std::string::npos) {
+        end = query.size();
+      }
+      if (query.compare(pos, name.size() + 1, name + "=") == 0) {
+        return atol(query.c_str() + pos + name.size() + 1);
+      }
+      pos = end + 1;
+    }
+    return 0;
+  }
+
+  void appendStream(std::string& out, unsigned char type, unsigned short id, const std::string& data)
+  {
+    for (size_t offset = 0; offset < data.size(); offset += FastCgi::MAX_CONTENT_LENGTH) {
+      size_t length = std::min(data.size() - offset, FastCgi::MAX_CONTENT_LENGTH);
+      FastCgi::appendRecord(out, type, id, data.data() + offset, length);
+    }
+    FastCgi::appendRecord(out, type, id, "", 0);
+  }
+
+  void respond(Connection& connection, unsigned short id, Job& job)
+  {
+    FastCgi::NameValues params;
+    FastCgi::parseNameValues(job.params.data(), job.params.size(), params);
+    std::string query = param(params, "QUERY_STRING");
+    std::string body = "SCRIPT_NAME=" + param(params, "SCRIPT_NAME") + "\n"
+                       + "QUERY_STRING=" + query + "\n"
+                       + "REQUEST_METHOD=" + param(params, "REQUEST_METHOD") + "\n"
+                       + job.input;
+    long size = queryValue(query, "size");
+    if (size > 0) {
+      body.append(size, 'x');
+    }
+    appendStream(connection.out, FastCgi::STDOUT, id, "Content-Type: text/plain\r\n\r\n" + body);
+    FastCgi::appendEndRequest(connection.out, id, 0, FastCgi::REQUEST_COMPLETE);
+    if (!job.keepConnection) {
+      connection.closeWhenWritten = true;
+    }
+  }
+
+  void handleRecord(Connection& connection, const FastCgi::Record& record)
+  {
+    unsigned short id = record.requestId;
+    if (id == 0) {
+      if (record.type == FastCgi::GET_VALUES) {
+        std::string values;
+        FastCgi::appendNameValue(values, "FCGI_MPXS_CONNS", "1");
+        FastCgi::appendNameValue(values, "FCGI_MAX_REQS", "100");
+        FastCgi::appendNameValue(values, "FCGI_MAX_CONNS", "100");
+        FastCgi::appendRecord(connection.out, FastCgi::GET_VALUES_RESULT, 0, values.data(), values.size());
+      } else {
+        char body[8] = { static_cast<char>(record.type), 0, 0, 0, 0, 0, 0, 0 };
+        FastCgi::appendRecord(connection.out, FastCgi::UNKNOWN_TYPE, 0, body, sizeof(body));
+      }
+      return;
+    }
+
+    if (record.type == FastCgi::BEGIN_REQUEST && record.contentLength >= 8) {
+      const unsigned char *body = reinterpret_cast<const unsigned char*>(record.content);
+      if (((body[0] << 8) | body[1]) != FastCgi::RESPONDER) {
+        FastCgi::appendEndRequest(connection.out, id, 0, FastCgi::UNKNOWN_ROLE);
+        return;
+      }
+      Job job;
+      job.paramsDone = false;
+      job.inputDone = false;
+      job.keepConnection = (body[2] & FastCgi::KEEP_CONN) != 0;
+      job.readyAt = 0;
+      connection.jobs[id] = job;
+      return;
+    }
+    std::map<unsigned short, Job>::iterator it = connection.jobs.find(id);
+    if (it == connection.jobs.end()) {
+      return;
+    }
+    Job& job = it->second;
+    if (record.type == FastCgi::PARAMS) {
+      if (record.contentLength == 0) {
+        job.paramsDone = true;
+      }
+      job.params.append(record.content, record.contentLength);
+    } else if (record.type == FastCgi::STDIN) {
+      job.input.append(record.content, record.contentLength);
+      if (record.contentLength == 0) {
+        FastCgi::NameValues params;
+        FastCgi::parseNameValues(job.params.data(), job.params.size(), params);
+        job.inputDone = true;
+        job.readyAt = nowMs() + queryValue(param(params, "QUERY_STRING"), "delay");
+      }
+    } else if (record.type == FastCgi::ABORT_REQUEST) {
+      FastCgi::appendEndRequest(connection.out, id, 1, FastCgi::REQUEST_COMPLETE);
+      if (!job.keepConnection) {
+        connection.closeWhenWritten = true;
+      }
+      connection.jobs.erase(it);
+    }
+  }
+
+  // Returns false once the connection is to be closed
+  bool readConnection(Connection& connection)
+  {
+    char buffer[65536];
+    while (true) {
+      ssize_t received = recv(connection.fd, buffer, sizeof(buffer), 0);
+      if (received > 0) {
+        connection.in.append(buffer, received);
+        continue;
+      }
+      if (received == -1 && errno == EINTR) {
+        continue;
+      }
+      if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        break;
+      }
+      return false;
+    }
+    size_t offset = 0;
+    size_t length;
+    FastCgi::Record record;
+    while ((length = FastCgi::parseRecord(connection.in.data() + offset, connection.in.size() - offset, record)) != 0) {
+      handleRecord(connection, record);
+      offset += length;
+    }
+    connection.in.erase(0, offset);
+    return true;
+  }
+
+  // Returns false once the connection is to be closed
+  bool writeConnection(Connection& connection)
+  {
+    size_t written = 0;
+    while (written < connection.out.size()) {
+      ssize_t sent = send(connection.fd, connection.out.data() + written, connection.out.size() - written,
+                          MSG_NOSIGNAL);
+      if (sent == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        connection.out.erase(0, written);
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+      }
+      written += sent;
+    }
+    connection.out.clear();
+    return !connection.closeWhenWritten;
+  }
+
+  int listenOn(const std::string& address)
+  {
+    int fd;
+    if (address.compare(0, 5, "unix:") == 0) {
+      struct sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      std::string path = address.substr(5);
+      strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+      unlink(path.c_str());
+      fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      if (fd == -1 || bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+        return -1;
+      }
+    } else {
+      size_t colon = address.rfind(':');
+      struct sockaddr_in addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(atoi(address.c_str() + colon + 1));
+      if (colon == std::string::npos || inet_pton(AF_INET, address.substr(0, colon).c_str(), &addr.sin_addr) != 1) {
+        return -1;
+      }
+      fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      int reuse = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+      if (fd == -1 || bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+        return -1;
+      }
+    }
+    if (listen(fd, 128) == -1) {
+      return -1;
+    }
+    return fd;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " unix:<path> | <ipv4>:<port>\n";
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  int listener = listenOn(argv[1]);
+  if (listener == -1) {
+    std::cerr << "Error: Failed to listen on " << argv[1] << ". " << strerror(errno) << "\n";
+    return 1;
+  }
+
+  std::vector<Connection> connections;
+  while (true) {
+    std::vector<struct pollfd> fds(1);
+    fds[0].fd = listener;
+    fds[0].events = POLLIN;
+    long long now = nowMs();
+    int timeout = -1;
+    for (size_t i = 0; i < connections.size(); ++i) {
+      struct pollfd pfd;
+      pfd.fd = connections[i].fd;
+      pfd.events = POLLIN | (connections[i].out.empty() ? 0 : POLLOUT);
+      fds.push_back(pfd);
+      std::map<unsigned short, Job>& jobs = connections[i].jobs;
+      for (std::map<unsigned short, Job>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+        if (it->second.inputDone) {
+          int wait = static_cast<int>(std::max(0LL, it->second.readyAt - now));
+          timeout = (timeout == -1) ? wait : std::min(timeout, wait);
+        }
+      }
+    }
+    if (poll(&fds[0], fds.size(), timeout) == -1 && errno != EINTR) {
+      std::cerr << "Error: poll failed. " << strerror(errno) << "\n";
+      return 1;
+    }
+
+    now = nowMs();
+    size_t kept = 0;
+    for (size_t i = 0; i < connections.size(); ++i) {
+      Connection& connection = connections[i];
+      bool alive = true;
+      if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+        alive = readConnection(connection);
+      }
+      std::map<unsigned short, Job>::iterator it = connection.jobs.begin();
+      while (alive && it != connection.jobs.end()) {
+        if (it->second.inputDone && it->second.readyAt <= now) {
+          respond(connection, it->first, it->second);
+          connection.jobs.erase(it++);
+        } else {
+          ++it;
+        }
+      }
+      if (alive) {
+        alive = writeConnection(connection);
+      }
+      if (!alive) {
+        close(connection.fd);
+        continue;
+      }
+      if (kept != i) {
+        connections[kept].fd = connection.fd;
+        connections[kept].in.swap(connection.in);
+        connections[kept].out.swap(connection.out);
+        connections[kept].jobs.swap(connection.jobs);
+        connections[kept].closeWhenWritten = connection.closeWhenWritten;
+      }
+      ++kept;
+    }
+    connections.resize(kept);
+
+    if (fds[0].revents & POLLIN) {
+      int fd;
+      while ((fd = accept(listener, NULL, NULL)) != -1) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        Connection connection;
+        connection.fd = fd;
+        connection.closeWhenWritten = false;
+        connections.push_back(connection);
+      }
+    }
+  }
+}
@@ -0,0 +1,204 @@
+#include "../src/AssetPack.hpp"
+#include "../src/Utils.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/*
+ * Packs a document root into one file for the asset_pack config key:
+ *   ./pack_assets www www.pack
+ * A file.gz next to file is stored as its precompressed variant.
+ * The pack is written next to the output and renamed over it, so a running server
+ * never sees a half-written pack.
+ * */
+
+namespace
+{
+  struct Asset {
+    std::string urlPath;   // "/css/site.css"
+    std::string filePath;  // "www/css/site.css"
+    std::string gzipPath;  // "www/css/site.css.gz" if it exists
+    struct stat fileStat;
+    off_t gzipSize;
+    AssetPack::Entry entry;
+  };
+
+  void collect(const std::string& root, const std::string& urlPath, std::vector<Asset>& assets)
+  {
+    std::string directory = root + urlPath;
+    DIR *dir = opendir(directory.c_str());
+    if (dir == NULL) {
+      std::cerr << "Error: Failed to open " << directory << ". " << strerror(errno) << "\n";
+      return;
+    }
+    struct dirent *item;
+    while ((item = readdir(dir)) != NULL) {
+      std::string name = item->d_name;
+      if (name == "." || name == "..") {
+        continue;
+      }
+      Asset asset;
+      asset.urlPath = urlPath + "/" + name;
+      asset.filePath = root + asset.urlPath;
+      if (stat(asset.filePath.c_str(), &asset.fileStat) != 0) {
+        continue;
+      }
+      if (S_ISDIR(asset.fileStat.st_mode)) {
+        collect(root, asset.urlPath, assets);
+      } else if (S_ISREG(asset.fileStat.st_mode)) {
+        struct stat gzipStat;
+        std::string gzipPath = asset.filePath + ".gz";
+        asset.gzipSize = 0;
+        if (stat(gzipPath.c_str(), &gzipStat) == 0 && S_ISREG(gzipStat.st_mode)) {
+          asset.gzipPath = gzipPath;
+          asset.gzipSize = gzipStat.st_size;
+        }
+        assets.push_back(asset);
+      }
+    }
+    closedir(dir);
+  }
+
+  bool copyFile(const std::string& path, std::ofstream& out, off_t expected)
+  {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    char buffer[65536];
+    off_t copied = 0;
+    while (in && copied < expected) {
+      in.read(buffer, sizeof(buffer));
+      out.write(buffer, in.gcount());
+      copied += in.gcount();
+    }
+    if (copied != expected) {
+      std::cerr << "Error: " << path << " changed while it was packed.\n";
+      return false;
+    }
+    return true;
+  }
+
+  uint64_t align(uint64_t offset)
+  {
+    return (offset + 7) & ~static_cast<uint64_t>(7);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <document_root> <output.pack>\n";
+    return 1;
+  }
+  std::string root = argv[1];
+  std::string output = argv[2];
+  while (root.size() > 1 && root[root.size() - 1] == '/') {
+    root.erase(root.size() - 1);
+  }
+
+  std::vector<Asset> assets;
+  collect(root, "", assets);
+
+  uint32_t slotCount = 16;
+  while (slotCount < assets.size() * 2) {
+    slotCount *= 2;
+  }
+
+  // Strings first, their offsets are known once the index size is
+  uint64_t stringsOffset = sizeof(AssetPack::Header) + static_cast<uint64_t>(slotCount) * sizeof(AssetPack::Entry);
+  std::string strings;
+  for (size_t i = 0; i < assets.size(); ++i) {
+    Asset& asset = assets[i];
+    std::ostringstream etag;
+    etag << std::hex << "\"" << asset.fileStat.st_mtime << "-" << asset.fileStat.st_size << "\"";
+    std::string mime = Utils::getMimeType(asset.filePath);
+
+    memset(&asset.entry, 0, sizeof(asset.entry));
+    asset.entry.hash = AssetPack::hashPath(asset.urlPath.data(), asset.urlPath.size());
+    asset.entry.mtime = asset.fileStat.st_mtime;
+    asset.entry.pathOffset = stringsOffset + strings.size();
+    asset.entry.pathLength = asset.urlPath.size();
+    strings += asset.urlPath;
+    asset.entry.mimeOffset = stringsOffset + strings.size();
+    asset.entry.mimeLength = mime.size();
+    strings += mime;
+    asset.entry.etagOffset = stringsOffset + strings.size();
+    asset.entry.etagLength = etag.str().size();
+    strings += etag.str();
+  }
+
+  uint64_t offset = align(stringsOffset + strings.size());
+  uint64_t dataOffset = offset;
+  for (size_t i = 0; i < assets.size(); ++i) {
+    Asset& asset = assets[i];
+    asset.entry.offset = offset;
+    asset.entry.length = asset.fileStat.st_size;
+    offset = align(offset + asset.entry.length);
+    if (!asset.gzipPath.empty()) {
+      asset.entry.gzipOffset = offset;
+      asset.entry.gzipLength = asset.gzipSize;
+      offset = align(offset + asset.entry.gzipLength);
+    }
+  }
+
+  AssetPack::Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, AssetPack::MAGIC, sizeof(header.magic));
+  header.version = AssetPack::VERSION;
+  header.entryCount = assets.size();
+  header.slotCount = slotCount;
+  header.packSize = offset;
+
+  std::vector<AssetPack::Entry> slots(slotCount);
+  memset(&slots[0], 0, sizeof(AssetPack::Entry) * slotCount);
+  for (size_t i = 0; i < assets.size(); ++i) {
+    uint32_t slot = assets[i].entry.hash & (slotCount - 1);
+    while (slots[slot].hash != 0) {
+      slot = (slot + 1) & (slotCount - 1);
+    }
+    slots[slot] = assets[i].entry;
+  }
+
+  std::string temporary = output + ".tmp";
+  std::ofstream out(temporary.c_str(), std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(&slots[0]), sizeof(AssetPack::Entry) * slotCount);
+  out.write(strings.data(), strings.size());
+
+  uint64_t written = stringsOffset + strings.size();
+  const char padding[8] = { 0 };
+  out.write(padding, dataOffset - written);
+  for (size_t i = 0; i < assets.size(); ++i) {
+    const Asset& asset = assets[i];
+    if (!copyFile(asset.filePath, out, asset.entry.length)) {
+      std::remove(temporary.c_str());
+      return 1;
+    }
+    out.write(padding, align(asset.entry.length) - asset.entry.length);
+    if (!asset.gzipPath.empty()) {
+      if (!copyFile(asset.gzipPath, out, asset.entry.gzipLength)) {
+        std::remove(temporary.c_str());
+        return 1;
+      }
+      out.write(padding, align(asset.entry.gzipLength) - asset.entry.gzipLength);
+    }
+  }
+  out.close();
+  if (!out) {
+    std::cerr << "Error: Failed to write " << temporary << "\n";
+    std::remove(temporary.c_str());
+    return 1;
+  }
+
+  if (rename(temporary.c_str(), output.c_str()) != 0) {
+    std::cerr << "Error: Failed to rename " << temporary << ". " << strerror(errno) << "\n";
+    return 1;
+  }
+  std::cout << "Packed " << assets.size() << " files (" << offset << " bytes) into " << output << "\n";
+  return 0;
+}